@@ -0,0 +1,106 @@
+/*********************************************************************************************************************
+ *
+ * anderson.cpp
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+
+#include "anderson.h"
+
+#include <algorithm>
+#include <assert.h>
+
+
+namespace CompGeom
+{
+
+    void AndersonAcceleration::init(unsigned int _memory, const Eigen::VectorXd& _u0)
+    {
+        const Eigen::Index dim = _u0.size();
+
+        m_memory = std::max(_memory, 1u);
+        m_curU = _u0;
+        m_curF.resize(dim);
+        m_prevDG.resize(dim, m_memory);
+        m_prevDF.resize(dim, m_memory);
+        m_matM.resize(m_memory, m_memory);
+        m_theta.resize(m_memory);
+        m_iter = 0;
+        m_colId = 0;
+    }
+
+
+    const Eigen::VectorXd& AndersonAcceleration::compute(const Eigen::VectorXd& _g)
+    {
+        assert(_g.size() == m_curU.size());
+
+        m_curF = _g - m_curU;
+
+        if (m_iter == 0)
+        {
+            // no history yet: plain fixed-point step
+            m_prevDF.col(0) = -m_curF;
+            m_prevDG.col(0) = -_g;
+            m_curU = _g;
+        }
+        else
+        {
+            // complete differences with current values
+            m_prevDF.col(m_colId) += m_curF;
+            m_prevDG.col(m_colId) += _g;
+
+            double eps = 1e-14;
+            double scale = std::max(eps, m_prevDF.col(m_colId).norm());
+            m_prevDF.col(m_colId) /= scale;
+            m_prevDG.col(m_colId) /= scale;
+
+            const unsigned int k = std::min(m_memory, m_iter);
+
+            if (k == 1)
+            {
+                m_theta(0) = 0.0;
+                double sqNorm = m_prevDF.col(m_colId).squaredNorm();
+                m_matM(0, 0) = sqNorm;
+                if (sqNorm > eps)
+                {
+                    m_theta(0) = m_prevDF.col(m_colId).dot(m_curF) / sqNorm;
+                }
+            }
+            else
+            {
+                // update the row/column of the normal equations matrix corresponding to the new entry
+                Eigen::VectorXd newInnerProd = (m_prevDF.col(m_colId).transpose() * m_prevDF.leftCols(k)).transpose();
+                m_matM.block(m_colId, 0, 1, k) = newInnerProd.transpose();
+                m_matM.block(0, m_colId, k, 1) = newInnerProd;
+
+                // solve least squares min || F - dF * theta ||
+                m_cod.compute(m_matM.topLeftCorner(k, k));
+                m_theta.head(k) = m_cod.solve(m_prevDF.leftCols(k).transpose() * m_curF);
+            }
+
+            m_curU = _g - m_prevDG.leftCols(k) * m_theta.head(k);
+
+            // start differences for next iteration
+            m_colId = (m_colId + 1) % m_memory;
+            m_prevDF.col(m_colId) = -m_curF;
+            m_prevDG.col(m_colId) = -_g;
+        }
+
+        m_iter++;
+
+        return m_curU;
+    }
+
+
+    void AndersonAcceleration::reset(const Eigen::VectorXd& _u)
+    {
+        m_iter = 0;
+        m_colId = 0;
+        m_curU = _u;
+    }
+
+
+} // namespace CompGeom
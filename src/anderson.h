@@ -0,0 +1,102 @@
+/*********************************************************************************************************************
+ *
+ * anderson.h
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#ifndef ANDERSON_H
+#define ANDERSON_H
+
+#include <Eigen/Core>
+#include <Eigen/QR>
+
+
+namespace CompGeom
+{
+
+/*!
+* \class AndersonAcceleration
+* \brief Anderson acceleration of a fixed-point iteration u_k+1 = G(u_k), as described in:
+* Y. Peng, B. Deng, J. Zhang, F. Geng, W. Qin and L. Liu. "Anderson acceleration for geometry optimization and physics simulation".
+* ACM Transactions on Graphics 37(4), 2018.
+*
+* The next iterate is a linear combination of the last m values of G,
+* whose coefficients minimize the norm of the combined residual F = G(u) - u.
+*/
+class AndersonAcceleration
+{
+
+public:
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        CONSTRUCTORS                                           |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn AndersonAcceleration
+    * \brief Default constructor
+    */
+    AndersonAcceleration() = default;
+
+    /*!
+    * \fn ~AndersonAcceleration
+    * \brief Destructor
+    */
+    virtual ~AndersonAcceleration() = default;
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        MISCELLANEOUS                                          |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn init
+    * \brief Allocates history and sets the initial iterate
+    * \param _memory : number of previous iterates used (m)
+    * \param _u0 : initial iterate
+    */
+    void init(unsigned int _memory, const Eigen::VectorXd& _u0);
+
+    /*!
+    * \fn compute
+    * \brief Computes the accelerated iterate from G(u_k)
+    * \param _g : value of G at current iterate
+    * \return : accelerated iterate u_k+1
+    */
+    const Eigen::VectorXd& compute(const Eigen::VectorXd& _g);
+
+    /*!
+    * \fn reset
+    * \brief Clears history and restarts from _u (e.g., when the accelerated iterate is rejected)
+    */
+    void reset(const Eigen::VectorXd& _u);
+
+
+protected:
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                         ATTRIBUTES                                            |
+    +-----------------------------------------------------------------------------------------------*/
+
+    unsigned int m_memory = 5;       /*!< number of previous iterates used */
+    unsigned int m_iter = 0;         /*!< number of iterations since last reset */
+    unsigned int m_colId = 0;        /*!< column of the oldest entry in history */
+
+    Eigen::VectorXd m_curU;          /*!< current iterate */
+    Eigen::VectorXd m_curF;          /*!< current residual G(u) - u */
+    Eigen::MatrixXd m_prevDG;        /*!< history of differences of G */
+    Eigen::MatrixXd m_prevDF;        /*!< history of differences of F */
+    Eigen::MatrixXd m_matM;          /*!< normal equations matrix (dF^T dF) */
+    Eigen::VectorXd m_theta;         /*!< combination coefficients */
+
+    Eigen::CompleteOrthogonalDecomposition<Eigen::MatrixXd> m_cod; /*!< solver for the (possibly rank-deficient) least squares */
+
+
+}; // class AndersonAcceleration
+
+} // namespace CompGeom
+
+#endif // ANDERSON_H
@@ -11,6 +11,11 @@
 #include "arap.h"
 
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <limits>
+#include <queue>
 
 
 namespace CompGeom
@@ -24,11 +29,19 @@ namespace CompGeom
         m_initVertices = _verticesPos;
         m_anchorsWeight = 100.0;
 
-        // 1. build adjacency matrix
+        // 1. build adjacency lists
 
-        // initializes empty adjacency matrix
-        m_adjacency.clear();
-        m_adjacency = std::vector<std::vector<bool> >(_verticesPos.size(), std::vector<bool> (_verticesPos.size(), false));
+        m_neighbors.clear();
+        m_neighbors.resize(_verticesPos.size());
+
+        auto addEdge = [this](uint32_t _id0, uint32_t _id1)
+        {
+            if (std::find(m_neighbors.at(_id0).begin(), m_neighbors.at(_id0).end(), _id1) == m_neighbors.at(_id0).end())
+            {
+                m_neighbors.at(_id0).push_back(_id1);
+                m_neighbors.at(_id1).push_back(_id0);
+            }
+        };
 
         // for each triangle
         for(auto it = _indices.begin(); it != _indices.end(); it += 3)
@@ -38,17 +51,20 @@ namespace CompGeom
             unsigned int id1 = *(it+1);
             unsigned int id2 = *(it+2);
 
-            // add corresponding edges in adjacency matrix
+            // add corresponding edges in adjacency lists
             // Edge (0,1)
-            m_adjacency.at(id0).at(id1) = m_adjacency.at(id1).at(id0) = true;
+            addEdge(id0, id1);
             // Edge (1,2) 
-            m_adjacency.at(id1).at(id2) = m_adjacency.at(id2).at(id1) = true;
+            addEdge(id1, id2);
             // Edge (2,0)
-            m_adjacency.at(id2).at(id0) = m_adjacency.at(id0).at(id2) = true;
+            addEdge(id2, id0);
         }
 
 
         // 2. add _fixedPointsIds to m_anchorsMap
+        m_anchorsMap.clear();
+        m_roiCache.clear();
+        m_activeRoiKey.clear();
         std::vector<std::pair<uint32_t, glm::vec3> > fixedAnchors;
         for (size_t i = 0; i < _fixedPointsIds.size(); ++i)
         {
@@ -73,7 +89,18 @@ namespace CompGeom
 
         updateAnchors();
 
-        const size_t nbVert = _verticesPos.size();
+        bool success = initializeGraph();
+
+        // stats of the first factorization only (anchor edits, coarse levels and regions of interest are silent)
+        m_solver.printStats();
+
+        return success;
+    }
+
+
+    bool Arap::initializeGraph()
+    {
+        const size_t nbVert = m_initVertices.size();
 
 		m_rot.resize(nbVert);
 
@@ -85,6 +112,356 @@ namespace CompGeom
 
         bool success = initGuessMatrixX();
 
+        // fit rotations to the initial guess, so that the first solve can be warm-started from (m_matX, m_rot)
+        if (success)
+        {
+            localStep();
+        }
+
+        // build (and factorize) coarser levels
+        m_coarseLevel.reset();
+        m_isHierarchyDirty = false;
+        if (success && m_nbLevels > 1 && nbVert > m_minNbVerticesCoarse)
+        {
+            success = buildCoarseLevel();
+        }
+
+        return success;
+    }
+
+
+    bool Arap::buildCoarseLevel()
+    {
+        const size_t nbVert = m_initVertices.size();
+
+        // 1. Greedy aggregation: each seed vertex absorbs its free first-ring neighbors.
+        // Anchors are always seeds (processed first, and never absorbed),
+        // so that each anchor has its own coarse vertex at the same position
+        m_clusterIds.assign(nbVert, UINT32_MAX);
+        m_clusterSeeds.clear();
+
+        std::vector<uint32_t> seedCandidates;
+        seedCandidates.reserve(nbVert);
+        for (auto it = m_anchorsMap.begin(); it != m_anchorsMap.end(); ++it)
+        {
+            seedCandidates.push_back(it->first);
+        }
+        for (uint32_t i = 0; i < nbVert; i++)
+        {
+            if (m_anchorsMap.find(i) == m_anchorsMap.end())
+            {
+                seedCandidates.push_back(i);
+            }
+        }
+
+        for (auto it = seedCandidates.begin(); it != seedCandidates.end(); ++it)
+        {
+            uint32_t i = *it;
+            if (m_clusterIds.at(i) != UINT32_MAX)
+            {
+                continue;
+            }
+
+            uint32_t c = (uint32_t)m_clusterSeeds.size();
+            m_clusterSeeds.push_back(i);
+            m_clusterIds.at(i) = c;
+
+            for (auto itN = m_neighbors.at(i).begin(); itN != m_neighbors.at(i).end(); ++itN)
+            {
+                if (m_clusterIds.at(*itN) == UINT32_MAX && m_anchorsMap.find(*itN) == m_anchorsMap.end())
+                {
+                    m_clusterIds.at(*itN) = c;
+                }
+            }
+        }
+
+        const size_t nbCoarseVert = m_clusterSeeds.size();
+        if (nbCoarseVert == nbVert)
+        {
+            // nothing to coarsen
+            return true;
+        }
+
+        // 2. Coarse graph: seeds positions, and one edge between clusters connected by (at least) one fine edge
+        m_coarseLevel = std::make_unique<Arap>();
+        Arap& coarse = *m_coarseLevel;
+
+        copySettings(coarse);
+        coarse.m_nbLevels = m_nbLevels - 1;
+        coarse.m_minNbVerticesCoarse = m_minNbVerticesCoarse;
+
+        coarse.m_initVertices.resize(nbCoarseVert);
+        for (size_t c = 0; c < nbCoarseVert; c++)
+        {
+            coarse.m_initVertices.at(c) = m_initVertices.at(m_clusterSeeds.at(c));
+        }
+
+        coarse.m_neighbors.assign(nbCoarseVert, std::vector<uint32_t>());
+        for (uint32_t i = 0; i < nbVert; i++)
+        {
+            uint32_t ci = m_clusterIds.at(i);
+            for (auto itN = m_neighbors.at(i).begin(); itN != m_neighbors.at(i).end(); ++itN)
+            {
+                uint32_t cj = m_clusterIds.at(*itN);
+                std::vector<uint32_t>& neighbors = coarse.m_neighbors.at(ci);
+                if (ci != cj && std::find(neighbors.begin(), neighbors.end(), cj) == neighbors.end())
+                {
+                    neighbors.push_back(cj);
+                }
+            }
+        }
+
+        // 3. Coarse anchors (fixed at coarse level, their motion is driven by the fine level)
+        for (auto it = m_anchorsMap.begin(); it != m_anchorsMap.end(); ++it)
+        {
+            coarse.m_anchorsMap.insert(std::make_pair(m_clusterIds.at(it->first), it->second));
+        }
+
+        return coarse.initializeGraph();
+    }
+
+
+    void Arap::prolongate(const Eigen::MatrixX3d& _prevCoarseX, const std::vector<Eigen::Matrix3d>& _prevCoarseRot)
+    {
+        const Arap& coarse = *m_coarseLevel;
+
+        // each fine vertex follows the rigid motion of its cluster between previous and new coarse solutions:
+        // x_i = x_c + dR_c * (x_i - x_c_prev), R_i = dR_c * R_i, with dR_c = R_c * R_c_prev^T
+        // (so that fine details of the warm start are kept, and only the coarse motion is transferred)
+        #pragma omp parallel for
+        for (int i = 0; i < (int)m_initVertices.size(); i++)
+        {
+            uint32_t c = m_clusterIds.at(i);
+            const Eigen::Matrix3d dR_c = coarse.m_rot.at(c) * _prevCoarseRot.at(c).transpose();
+
+            const Eigen::Vector3d x_ci = (m_matX.row(i) - _prevCoarseX.row(c)).transpose();
+
+            m_matX.row(i) = coarse.m_matX.row(c) + (dR_c * x_ci).transpose();
+            m_rot.at(i) = dR_c * m_rot.at(i);
+        }
+    }
+
+
+    void Arap::copySettings(Arap& _other) const
+    {
+        _other.m_anchorsWeight = m_anchorsWeight;
+        _other.m_edgesWeight = m_edgesWeight;
+        _other.m_solveMode = m_solveMode;
+        _other.m_useAnderson = m_useAnderson;
+        _other.m_andersonMemory = m_andersonMemory;
+        _other.m_maxIterations = m_maxIterations;
+        _other.m_timeBudgetMs = m_timeBudgetMs;
+        _other.m_solver.setType(m_solver.getType());
+        _other.m_solver.setLevelScheduling(m_solveMode == eArapSolveMode::LEVEL_SCHEDULED);
+    }
+
+
+    void Arap::setRegionOfInterest(double _radius, bool _useGeodesicDistance)
+    {
+        m_roiRadius = _radius;
+        m_roiUseGeodesicDistance = _useGeodesicDistance;
+        m_roiCache.clear();
+        m_activeRoiKey.clear();
+    }
+
+
+    void Arap::setRegionCacheSize(size_t _cacheSize)
+    {
+        m_roiCacheSize = std::max(_cacheSize, (size_t)1);
+        trimRegionCache();
+    }
+
+
+    void Arap::trimRegionCache()
+    {
+        while (m_roiCache.size() > m_roiCacheSize)
+        {
+            auto itOldest = m_roiCache.begin();
+            for (auto it = m_roiCache.begin(); it != m_roiCache.end(); ++it)
+            {
+                if (it->second.m_lastUse < itOldest->second.m_lastUse)
+                {
+                    itOldest = it;
+                }
+            }
+            m_roiCache.erase(itOldest);
+        }
+    }
+
+
+    bool Arap::buildRegionOfInterest(const std::vector<uint32_t>& _handles, ArapRegion& _region)
+    {
+        const size_t nbVert = m_initVertices.size();
+
+        // 1. Distance to the closest handle (multi-source Dijkstra on the rest mesh),
+        // edges have unit length for graph distance, or their rest length for geodesic distance
+        std::vector<double> distances(nbVert, std::numeric_limits<double>::max());
+        typedef std::pair<double, uint32_t> DistId;
+        std::priority_queue<DistId, std::vector<DistId>, std::greater<DistId> > queue;
+        for (auto it = _handles.begin(); it != _handles.end(); ++it)
+        {
+            distances.at(*it) = 0.0;
+            queue.push(std::make_pair(0.0, *it));
+        }
+
+        while (!queue.empty())
+        {
+            DistId cur = queue.top();
+            queue.pop();
+            uint32_t i = cur.second;
+            if (cur.first > distances.at(i))
+                continue;
+
+            for (auto it = m_neighbors.at(i).begin(); it != m_neighbors.at(i).end(); ++it)
+            {
+                uint32_t j = *it;
+                double edgeLength = m_roiUseGeodesicDistance ? (double)glm::length(m_initVertices.at(i) - m_initVertices.at(j)) : 1.0;
+                double d = cur.first + edgeLength;
+                if (d <= m_roiRadius && d < distances.at(j))
+                {
+                    distances.at(j) = d;
+                    queue.push(std::make_pair(d, j));
+                }
+            }
+        }
+
+        // 2. Free vertices (inside ROI), then border vertices (outside ROI, adjacent to it)
+        std::vector<uint32_t> localIds(nbVert, UINT32_MAX);
+        _region.m_vertices.clear();
+        for (uint32_t i = 0; i < nbVert; i++)
+        {
+            if (distances.at(i) <= m_roiRadius)
+            {
+                localIds.at(i) = (uint32_t)_region.m_vertices.size();
+                _region.m_vertices.push_back(i);
+            }
+        }
+        _region.m_nbFree = _region.m_vertices.size();
+
+        for (size_t k = 0; k < _region.m_nbFree; k++)
+        {
+            uint32_t i = _region.m_vertices.at(k);
+            for (auto it = m_neighbors.at(i).begin(); it != m_neighbors.at(i).end(); ++it)
+            {
+                if (localIds.at(*it) == UINT32_MAX)
+                {
+                    localIds.at(*it) = (uint32_t)_region.m_vertices.size();
+                    _region.m_vertices.push_back(*it);
+                }
+            }
+        }
+
+        // 3. Sub-model on ROI + border: edges with at least one free vertex,
+        // anchors are the mesh anchors inside the ROI and the border vertices
+        _region.m_model = std::make_unique<Arap>();
+        Arap& roi = *_region.m_model;
+        copySettings(roi);
+
+        const size_t nbRoiVert = _region.m_vertices.size();
+        roi.m_initVertices.resize(nbRoiVert);
+        roi.m_neighbors.assign(nbRoiVert, std::vector<uint32_t>());
+        for (size_t k = 0; k < nbRoiVert; k++)
+        {
+            uint32_t i = _region.m_vertices.at(k);
+            roi.m_initVertices.at(k) = m_initVertices.at(i);
+
+            for (auto it = m_neighbors.at(i).begin(); it != m_neighbors.at(i).end(); ++it)
+            {
+                uint32_t l = localIds.at(*it);
+                if (l != UINT32_MAX && (k < _region.m_nbFree || l < _region.m_nbFree))
+                {
+                    roi.m_neighbors.at(k).push_back(l);
+                }
+            }
+
+            auto itA = m_anchorsMap.find(i);
+            if (itA != m_anchorsMap.end())
+            {
+                roi.m_anchorsMap.insert(std::make_pair((uint32_t)k, itA->second));
+            }
+            else if (k >= _region.m_nbFree)
+            {
+                roi.m_anchorsMap.insert(std::make_pair((uint32_t)k, glm::vec3(m_matX.row(i)[0], m_matX.row(i)[1], m_matX.row(i)[2])));
+            }
+        }
+
+        return roi.initializeGraph();
+    }
+
+
+    bool Arap::solveRegionOfInterest(double _eps)
+    {
+        // ROIs (and their factorization) are cached for each set of handles
+        std::vector<uint32_t> key;
+        for (auto it = m_constraints.begin(); it != m_constraints.end(); ++it)
+        {
+            key.push_back(it->first);
+        }
+        std::sort(key.begin(), key.end());
+
+        bool isNewRegion = false;
+        auto itRoi = m_roiCache.find(key);
+        if (itRoi == m_roiCache.end())
+        {
+            itRoi = m_roiCache.insert(std::make_pair(key, ArapRegion())).first;
+            if (!buildRegionOfInterest(key, itRoi->second))
+            {
+                m_roiCache.erase(itRoi);
+                return false;
+            }
+            isNewRegion = true;
+        }
+
+        ArapRegion& region = itRoi->second;
+        region.m_lastUse = ++m_roiCacheClock;
+        if (isNewRegion)
+        {
+            // the new region is the most recent one, so it is kept
+            trimRegionCache();
+        }
+        Arap& roi = *region.m_model;
+        const size_t nbRoiVert = region.m_vertices.size();
+
+        // warm start from current mesh state, unless this ROI was already the active one
+        if (isNewRegion || key != m_activeRoiKey)
+        {
+            for (size_t k = 0; k < nbRoiVert; k++)
+            {
+                roi.m_matX.row(k) = m_matX.row(region.m_vertices.at(k));
+            }
+            roi.localStep();
+        }
+        m_activeRoiKey = key;
+
+        // update anchors (handles move, border vertices keep current positions)
+        for (size_t k = 0; k < nbRoiVert; k++)
+        {
+            uint32_t i = region.m_vertices.at(k);
+            auto itA = m_anchorsMap.find(i);
+            if (itA != m_anchorsMap.end())
+            {
+                roi.m_anchorsMap.at((uint32_t)k) = itA->second;
+            }
+            else if (k >= region.m_nbFree)
+            {
+                roi.m_anchorsMap.at((uint32_t)k) = glm::vec3(m_matX.row(i)[0], m_matX.row(i)[1], m_matX.row(i)[2]);
+            }
+        }
+
+        bool success = roi.solve(_eps);
+
+        // copy back free vertices
+        for (size_t k = 0; k < region.m_nbFree; k++)
+        {
+            uint32_t i = region.m_vertices.at(k);
+            m_matX.row(i) = roi.m_matX.row(k);
+            m_rot.at(i) = roi.m_rot.at(k);
+        }
+
+        m_hasConverged = roi.m_hasConverged;
+        m_nbIterations = roi.m_nbIterations;
+        m_energy = roi.m_energy;
+
         return success;
     }
 
@@ -137,35 +514,24 @@ namespace CompGeom
 
         // Number of Non-Zero (nnz) element in the matrix
         size_t nnz = 0;
-        for (int i = 0; i < m_adjacency.size(); i++)
+        for (size_t i = 0; i < m_neighbors.size(); i++)
         {
-            // diagonal elements
-            nnz++;
-            for (int j = 0; j < m_adjacency.at(i).size(); j++)
-            {
-                if (m_adjacency.at(i).at(j) == true)
-                {
-                    // count edges
-                    nnz++;
-                }
-            }
+            // diagonal elements + edges
+            nnz += 1 + m_neighbors.at(i).size();
         }
 
         // Each non-zero element is stored as a triplet (idRow, idColumn, value)
         std::vector<Eigen::Triplet<double> > triples;
         triples.reserve(nnz);
 
-        for (int i=0; i<m_adjacency.size(); i++)
+        for (size_t i = 0; i < m_neighbors.size(); i++)
 		{
             double d_i = 0.0;
-			for (int j=0; j<m_adjacency.at(i).size(); j++)
+			for (auto it = m_neighbors.at(i).begin(); it != m_neighbors.at(i).end(); ++it)
 		    {
-                if (m_adjacency.at(i).at(j) == true)
-                {
-                    // each neighbor v_j is assigned a -1 factor
-                    triples.push_back(Eigen::Triplet<double>(i, j, -m_edgesWeight));
-					d_i += m_edgesWeight;
-                }
+                // each neighbor v_j is assigned a -1 factor
+                triples.push_back(Eigen::Triplet<double>(i, *it, -m_edgesWeight));
+				d_i += m_edgesWeight;
 		    }
             
             // add anchor weights in diagonal
@@ -182,19 +548,153 @@ namespace CompGeom
 
         // Build sparse Laplacian matrix from triplets
         const size_t nbVert = m_initVertices.size();
-        Eigen::SparseMatrix<double> Laplace((int)nbVert, (int)nbVert);
-        Laplace.setFromTriplets(triples.begin(),triples.end());
+        m_matL.resize((int)nbVert, (int)nbVert);
+        m_matL.setFromTriplets(triples.begin(),triples.end());
 
-        m_llt.compute(Laplace);
+        // Convert sparse matrix to dense matrix for console printout
+        //std::cout <<  Eigen::MatrixXd(m_matL) << std::endl;
 
-        auto info = m_llt.info();
-        std::string success = info == Eigen::Success ? "Success" : Eigen::NumericalIssue ? "NumericalIssue" : "Unknown";
-        std::cout << "SimplicialLLT computation: " << success << std::endl;
+        // The sparsity pattern of L only depends on the mesh connectivity (anchors only change diagonal values),
+        // so the symbolic analysis (ordering + elimination tree) is done once here, 
+        // and anchor changes only need a numerical factorization (see factorizeMatrixL())
+        m_solver.analyzePattern(m_matL);
 
-        // Convert sparse matrix to dense matrix for console printout
-        //std::cout <<  Eigen::MatrixXd(Laplace) << std::endl;
+        return factorizeMatrixL();
+    }
+
+
+    bool Arap::factorizeMatrixL()
+    {
+        m_solver.factorize(m_matL);
+        m_isFactorizationDirty = false;
+
+        return m_solver.info() == Eigen::Success;
+    }
+
+
+    void Arap::setSolverType(eSparseSolverType _solverType)
+    {
+        m_solver.setType(_solverType);
+
+        // new backend needs its own symbolic analysis
+        if (m_matL.rows() > 0)
+        {
+            m_solver.analyzePattern(m_matL);
+            factorizeMatrixL();
+        }
+    }
+
+
+    bool Arap::addAnchor(const uint32_t _id, const glm::vec3& _pos)
+    {
+        if (_id >= m_initVertices.size() || m_matL.rows() != (Eigen::Index)m_initVertices.size())
+        {
+            std::cerr << "Arap::addAnchor(): invalid vertex id or model not initialized" << std::endl;
+            return false;
+        }
+
+        // a fixed anchor is not a handle anymore
+        m_constraints.erase(std::remove_if(m_constraints.begin(), m_constraints.end(),
+                                           [_id](const std::pair<uint32_t, glm::vec3>& _c) { return _c.first == _id; }),
+                            m_constraints.end());
+
+        auto it = m_anchorsMap.find(_id);
+        if (it != m_anchorsMap.end())
+        {
+            // already an anchor: only its position changes, not the matrix
+            it->second = _pos;
+            return true;
+        }
+
+        m_anchorsMap.insert(std::make_pair(_id, _pos));
+
+        // anchor weight is only added to the diagonal, so the sparsity pattern is unchanged
+        m_matL.coeffRef(_id, _id) += m_anchorsWeight;
+        m_isFactorizationDirty = true;
+        m_roiCache.clear();
+
+        // the aggregation is kept, the cluster of the new anchor is pinned at coarse level
+        if (m_coarseLevel)
+        {
+            m_coarseLevel->addAnchor(m_clusterIds.at(_id), _pos);
+        }
+
+        return true;
+    }
+
+
+    bool Arap::addHandle(const uint32_t _id, const glm::vec3& _targetPos)
+    {
+        if (_id >= m_initVertices.size() || m_matX.rows() != (Eigen::Index)m_initVertices.size())
+        {
+            std::cerr << "Arap::addHandle(): invalid vertex id or model not initialized" << std::endl;
+            return false;
+        }
+
+        // handle starts at current vertex position
+        glm::vec3 currentPos(m_matX.row(_id)[0], m_matX.row(_id)[1], m_matX.row(_id)[2]);
+        if (!addAnchor(_id, currentPos))
+        {
+            return false;
+        }
+
+        m_constraints.push_back(std::make_pair(_id, _targetPos));
+
+        return true;
+    }
+
+
+    bool Arap::setHandleTarget(const uint32_t _id, const glm::vec3& _targetPos)
+    {
+        for (auto it = m_constraints.begin(); it != m_constraints.end(); ++it)
+        {
+            if (it->first == _id)
+            {
+                it->second = _targetPos;
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+    bool Arap::removeAnchor(const uint32_t _id)
+    {
+        auto it = m_anchorsMap.find(_id);
+        if (it == m_anchorsMap.end())
+        {
+            return false;
+        }
+
+        // without anchors, L is the uniform (umbrella) Laplacian, which is singular (translations)
+        if (m_anchorsMap.size() == 1)
+        {
+            std::cerr << "Arap::removeAnchor(): the last anchor cannot be removed" << std::endl;
+            return false;
+        }
+
+        m_anchorsMap.erase(it);
+        m_constraints.erase(std::remove_if(m_constraints.begin(), m_constraints.end(),
+                                           [_id](const std::pair<uint32_t, glm::vec3>& _c) { return _c.first == _id; }),
+                            m_constraints.end());
+
+        m_matL.coeffRef(_id, _id) -= m_anchorsWeight;
+        m_isFactorizationDirty = true;
+        m_roiCache.clear();
+
+        // the cluster is released at coarse level if no other anchor belongs to it
+        if (m_coarseLevel)
+        {
+            const uint32_t c = m_clusterIds.at(_id);
+            auto itOther = std::find_if(m_anchorsMap.begin(), m_anchorsMap.end(),
+                                        [this, c](const std::pair<const uint32_t, glm::vec3>& _a) { return m_clusterIds.at(_a.first) == c; });
+            if (itOther == m_anchorsMap.end())
+            {
+                m_coarseLevel->removeAnchor(c);
+            }
+        }
 
-        return info == Eigen::Success;
+        return true;
     }
 
 
@@ -218,8 +718,9 @@ namespace CompGeom
 
     void Arap::localStep()
     {
-        // For each vertex i
-        for (int i = 0; i < m_initVertices.size(); ++i)
+        // For each vertex i (rotations are independent)
+        #pragma omp parallel for
+        for (int i = 0; i < (int)m_initVertices.size(); ++i)
         {
             Eigen::Matrix3d J  = Eigen::Matrix3d::Zero();
 
@@ -227,22 +728,21 @@ namespace CompGeom
 
             const Eigen::Vector3d v_i(m_initVertices.at(i).x, m_initVertices.at(i).y, m_initVertices.at(i).z);
 
-            for (int j=0; j < m_adjacency.at(i).size(); ++j)
+            for (auto it = m_neighbors.at(i).begin(); it != m_neighbors.at(i).end(); ++it)
             {
                 // For each neigbhor j
-                if (i != j && m_adjacency.at(i).at(j) != 0)
-                {
-                    // compute vector (v_j, v_i)
-                    
-                    const Eigen::Vector3d v_j(m_initVertices.at(j).x, m_initVertices.at(j).y, m_initVertices.at(j).z);
+                const uint32_t j = *it;
 
-                    const Eigen::Vector3d rv_ji = v_i - v_j;
+                // compute vector (v_j, v_i)
+                
+                const Eigen::Vector3d v_j(m_initVertices.at(j).x, m_initVertices.at(j).y, m_initVertices.at(j).z);
 
-                    // call m_matX = llt.solve(b) before to init m_matX
-                    const Eigen::Vector3d dv_ji = m_matX.row(i) - m_matX.row(j);
+                const Eigen::Vector3d rv_ji = v_i - v_j;
 
-                    J += m_edgesWeight * rv_ji * dv_ji.transpose();
-                }
+                // call m_matX = llt.solve(b) before to init m_matX
+                const Eigen::Vector3d dv_ji = m_matX.row(i) - m_matX.row(j);
+
+                J += m_edgesWeight * rv_ji * dv_ji.transpose();
             }
             extractRot(J, R);
         }
@@ -258,19 +758,18 @@ namespace CompGeom
         {
             const Eigen::Vector3d v_i(m_initVertices.at(i).x, m_initVertices.at(i).y, m_initVertices.at(i).z);
 
-            for (int j = 0; j < m_adjacency.at(i).size(); ++j)
+            for (auto it = m_neighbors.at(i).begin(); it != m_neighbors.at(i).end(); ++it)
             {
                 // For each neigbhor j
-                if (i != j && m_adjacency.at(i).at(j) != 0)
-                {
-                    // compute vector (v_j, v_i)
+                const uint32_t j = *it;
 
-                    const Eigen::Vector3d v_j(m_initVertices.at(j).x, m_initVertices.at(j).y, m_initVertices.at(j).z);
+                // compute vector (v_j, v_i)
 
-                    const Eigen::Vector3d v_ji = v_i - v_j;
+                const Eigen::Vector3d v_j(m_initVertices.at(j).x, m_initVertices.at(j).y, m_initVertices.at(j).z);
 
-                    matB.row(i) += m_edgesWeight * v_ji;
-                }
+                const Eigen::Vector3d v_ji = v_i - v_j;
+
+                matB.row(i) += m_edgesWeight * v_ji;
             }
         }
         
@@ -280,9 +779,9 @@ namespace CompGeom
             matB.row(it->first) += m_anchorsWeight * Eigen::Vector3d(anchorPos.x, anchorPos.y, anchorPos.z);
         }
 
-        if(m_llt.info() == Eigen::Success)
+        if(m_solver.info() == Eigen::Success)
         {
-            m_matX = m_llt.solve(matB);
+            solveMatrixL(matB, m_matX);
             return true;
         }
 
@@ -294,28 +793,28 @@ namespace CompGeom
     {
         Eigen::MatrixX3d matB = Eigen::MatrixX3d::Zero(m_initVertices.size(), 3);
 
-        // For each vertex i
-        for (int i = 0; i < m_initVertices.size(); ++i)
+        // For each vertex i (rows of B are independent)
+        #pragma omp parallel for
+        for (int i = 0; i < (int)m_initVertices.size(); ++i)
         {
             Eigen::Matrix3d& R_i = m_rot.at(i);
 
             const Eigen::Vector3d v_i(m_initVertices.at(i).x, m_initVertices.at(i).y, m_initVertices.at(i).z);
 
-            for (int j = 0; j < m_adjacency.at(i).size(); ++j)
+            for (auto it = m_neighbors.at(i).begin(); it != m_neighbors.at(i).end(); ++it)
             {
                 // For each neigbhor j
-                if (i != j && m_adjacency.at(i).at(j) != 0)
-                {
-                    // compute vector (v_j, v_i)
+                const uint32_t j = *it;
 
-                    const Eigen::Vector3d v_j(m_initVertices.at(j).x, m_initVertices.at(j).y, m_initVertices.at(j).z);
+                // compute vector (v_j, v_i)
 
-                    const Eigen::Vector3d v_ji = v_i - v_j;
+                const Eigen::Vector3d v_j(m_initVertices.at(j).x, m_initVertices.at(j).y, m_initVertices.at(j).z);
 
-                    const Eigen::Matrix3d& R_j = m_rot.at(j);
+                const Eigen::Vector3d v_ji = v_i - v_j;
 
-                    matB.row(i) += 0.5 * m_edgesWeight * (R_i + R_j) * v_ji;
-                }
+                const Eigen::Matrix3d& R_j = m_rot.at(j);
+
+                matB.row(i) += 0.5 * m_edgesWeight * (R_i + R_j) * v_ji;
             }
         }
 
@@ -325,15 +824,36 @@ namespace CompGeom
             matB.row(it->first) += m_anchorsWeight * Eigen::Vector3d(anchorPos.x, anchorPos.y, anchorPos.z);
         }
 
-        if(m_llt.info() == Eigen::Success)
+        if(m_solver.info() == Eigen::Success)
         {
-            m_matX = m_llt.solve(matB);
+            solveMatrixL(matB, m_matX);
             return true;
         }
         return false;
     }
 
 
+    void Arap::solveMatrixL(const Eigen::MatrixX3d& _matB, Eigen::MatrixX3d& _matX)
+    {
+        _matX.resize(_matB.rows(), 3);
+
+        if (m_solveMode == eArapSolveMode::PARALLEL_COLUMNS)
+        {
+            // x, y and z are 3 independent right-hand sides, sharing the same (read-only) factorization
+            #pragma omp parallel for num_threads(3)
+            for (int c = 0; c < 3; c++)
+            {
+                m_solver.solve(_matB.col(c), _matX.col(c));
+            }
+        }
+        else
+        {
+            // SERIAL, or LEVEL_SCHEDULED (see SparseSolver::setLevelScheduling())
+            m_solver.solve(_matB, _matX);
+        }
+    }
+
+
     double Arap::l2Energy()
     {
         double e = 0;
@@ -345,48 +865,144 @@ namespace CompGeom
 
             const Eigen::Vector3d v_i(m_initVertices.at(i).x, m_initVertices.at(i).y, m_initVertices.at(i).z);
 
-            for (int j = 0; j < m_adjacency.at(i).size(); ++j)
+            for (auto it = m_neighbors.at(i).begin(); it != m_neighbors.at(i).end(); ++it)
             {
                 // For each neigbhor j
-                if (i != j && m_adjacency.at(i).at(j) != 0)
-                {
-                    // compute vector (v_j, v_i)
+                const uint32_t j = *it;
 
-                    const Eigen::Vector3d v_j(m_initVertices.at(j).x, m_initVertices.at(j).y, m_initVertices.at(j).z);
+                // compute vector (v_j, v_i)
 
-                    const Eigen::Vector3d rv_ji = v_i - v_j;
+                const Eigen::Vector3d v_j(m_initVertices.at(j).x, m_initVertices.at(j).y, m_initVertices.at(j).z);
 
-                    const Eigen::Vector3d dv_ji = m_matX.row(i) - m_matX.row(j);
+                const Eigen::Vector3d rv_ji = v_i - v_j;
 
-                    e += m_edgesWeight * (dv_ji - R * rv_ji).squaredNorm();
-                }
+                const Eigen::Vector3d dv_ji = m_matX.row(i) - m_matX.row(j);
+
+                e += m_edgesWeight * (dv_ji - R * rv_ji).squaredNorm();
             }
         }
         return e;
     }
 
 
-    bool Arap::solve(double _eps)
+    bool Arap::solveIterations(double _eps)
     {
         bool success = false;
 
-        updateAnchors();
+        // multiresolution settings changed: coarse levels are rebuilt
+        if (m_isHierarchyDirty)
+        {
+            m_coarseLevel.reset();
+            m_isHierarchyDirty = false;
+            if (m_nbLevels > 1 && m_initVertices.size() > m_minNbVerticesCoarse && !buildCoarseLevel())
+            {
+                return false;
+            }
+        }
+
+        // coarse-to-fine: solve on coarse level with current anchors positions, 
+        // and use its prolongated solution as initial guess
+        if (m_coarseLevel)
+        {
+            for (auto it = m_anchorsMap.begin(); it != m_anchorsMap.end(); ++it)
+            {
+                m_coarseLevel->m_anchorsMap.at(m_clusterIds.at(it->first)) = it->second;
+            }
+            const Eigen::MatrixX3d prevCoarseX = m_coarseLevel->m_matX;
+            const std::vector<Eigen::Matrix3d> prevCoarseRot = m_coarseLevel->m_rot;
+            m_coarseLevel->solve(_eps);
+            prolongate(prevCoarseX, prevCoarseRot);
+        }
+
+        auto startTime = std::chrono::steady_clock::now();
 
         size_t iter = 0;
         double err1 = 1,err2 = 0;
-        //local-to-global interations
+
+        // energy of the last accepted iterate, for the Anderson acceleration safeguard
+        double err2Prev = 0.0;
+        if (m_useAnderson)
+        {
+            m_anderson.init(m_andersonMemory, Eigen::Map<const Eigen::VectorXd>(m_matX.data(), m_matX.size()));
+            err2Prev = l2Energy();
+        }
+
+        //local-to-global interations, warm-started from previous rotations and positions
         while(fabs(err2-err1) > _eps)
         {
-            localStep();
+            double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+            // stop if iteration cap is reached, or if another iteration would exceed the time budget
+            if (m_maxIterations > 0 && iter >= m_maxIterations)
+                break;
+            if (m_timeBudgetMs > 0.0 && iter > 0 && elapsedMs + elapsedMs / iter > m_timeBudgetMs)
+                break;
+
             success = globalStep();
+
+            if (m_useAnderson)
+            {
+                // G(X) = global step after local step, stored in m_matX
+                Eigen::VectorXd matXg = Eigen::Map<const Eigen::VectorXd>(m_matX.data(), m_matX.size());
+
+                Eigen::Map<Eigen::VectorXd>(m_matX.data(), m_matX.size()) = m_anderson.compute(matXg);
+                localStep();
+                double energyAA = l2Energy();
+
+                // safeguard: reject accelerated iterate if energy increases, and fall back to plain step
+                if (energyAA > err2Prev)
+                {
+                    Eigen::Map<Eigen::VectorXd>(m_matX.data(), m_matX.size()) = matXg;
+                    localStep();
+                    m_anderson.reset(matXg);
+                    energyAA = l2Energy();
+                }
+                err2Prev = energyAA;
+            }
+            else
+            {
+                localStep();
+            }
+
             err1 = err2;
-            err2 = l2Energy();
+            err2 = m_useAnderson ? err2Prev : l2Energy();
             iter++;
         }
 
         //std::cout<<"The number of iteration is: "<<iter<<std::endl;
         //std::cout<<"The residual is "<<err2<<std::endl;
 
+        m_hasConverged = fabs(err2-err1) <= _eps;
+        m_nbIterations = (unsigned int)iter;
+        m_energy = err2;
+
+        return success;
+    }
+
+
+    bool Arap::solve(double _eps)
+    {
+        bool success = false;
+
+        // anchor set changed: refactorize L (symbolic analysis is reused)
+        if (m_isFactorizationDirty && !factorizeMatrixL())
+        {
+            return false;
+        }
+
+        updateAnchors();
+
+        // region of interest: only vertices close to the handles are solved
+        if (m_roiRadius > 0.0 && !m_constraints.empty())
+        {
+            success = solveRegionOfInterest(_eps);
+        }
+        else
+        {
+            m_activeRoiKey.clear();
+            success = solveIterations(_eps);
+        }
+
         //update moving anchors positions
         for (auto it = m_constraints.begin(); it != m_constraints.end(); ++it)
         {
@@ -398,16 +1014,15 @@ namespace CompGeom
 
 
     /*
-     * Check if adjacency matrix is empty (i.e., contains only false) 
+     * Check if adjacency is empty (i.e., no edges) 
      */
     bool Arap::isAdjacencyEmpty() const
     {
     
-        bool isEmpty = std::all_of(m_adjacency.begin(), m_adjacency.end(),
-                                   [](const std::vector<bool>& _vec)
+        bool isEmpty = std::all_of(m_neighbors.begin(), m_neighbors.end(),
+                                   [](const std::vector<uint32_t>& _vec)
                                     {
-                                           return std::all_of(_vec.begin(), _vec.end(),
-                                                              [](bool _value){ return _value == false; });
+                                           return _vec.empty();
                                     });
 
         return isEmpty;
@@ -420,14 +1035,7 @@ namespace CompGeom
      */
     unsigned int Arap::getVertexDegree(const unsigned int _id) const
     {
-
-        unsigned int cpt = 0;
-        for (auto it = m_adjacency.at(_id).begin(); it != m_adjacency.at(_id).end(); ++it)
-        {
-            if(*it == true)
-                cpt++;
-        }
-        return cpt;
+        return (unsigned int)m_neighbors.at(_id).size();
     }
 	
 
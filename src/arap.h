@@ -11,6 +11,11 @@
 #define ARAP_H
 
 #include "dynamicalmodel.h"
+#include "anderson.h"
+#include "sparsesolver.h"
+
+#include <map>
+#include <memory>
 
 #include <Eigen/Core>
 #include <Eigen/Sparse>
@@ -21,6 +26,16 @@
 namespace CompGeom
 {
 
+    /*!
+     * Back-substitution modes for the global step L * X = B
+     */
+    enum class eArapSolveMode
+    {
+        SERIAL,            /* Eigen solve, columns x, y, z solved one after the other */
+        PARALLEL_COLUMNS,  /* columns x, y, z solved concurrently */
+        LEVEL_SCHEDULED    /* level-scheduled parallel triangular solves, for large factors */
+    };
+
 /*!
 * \class Arap
 * \brief As-Rigid-as-Possible mesh deformation, described is:
@@ -31,9 +46,6 @@ namespace CompGeom
 */
 class Arap : public DynamicalModel
 {
-    // Sparse LL^T Cholesky factorization
-    typedef Eigen::SimplicialLLT<Eigen::SparseMatrix<double>, Eigen::Upper> ArapSimplicialLLT;
-        
 
 public:
 
@@ -59,7 +71,82 @@ public:
     |                                     GETTERS / SETTERS                                         |
     +-----------------------------------------------------------------------------------------------*/
 
-    
+    /*!
+    * \fn setSolveBudget
+    * \brief Bounds the work done by one call to iterate()
+    * \param _maxIterations : max number of local/global iterations (0 = unbounded)
+    * \param _timeBudgetMs : wall-clock budget in milliseconds (0.0 = unbounded)
+    */
+    inline void setSolveBudget(unsigned int _maxIterations, double _timeBudgetMs) { m_maxIterations = _maxIterations; m_timeBudgetMs = _timeBudgetMs; }
+
+    /*!
+    * \fn setAndersonAcceleration
+    * \brief Enables/disables Anderson acceleration of the local/global iterations
+    * \param _useAnderson : enable flag
+    * \param _memory : number of previous iterates used by the acceleration
+    */
+    inline void setAndersonAcceleration(bool _useAnderson, unsigned int _memory = 5) { m_useAnderson = _useAnderson; m_andersonMemory = _memory; }
+
+    /*!
+    * \fn setSolveMode
+    * \brief Selects how the triangular solves of the global step are run
+    */
+    inline void setSolveMode(eArapSolveMode _solveMode) { m_solveMode = _solveMode; m_solver.setLevelScheduling(_solveMode == eArapSolveMode::LEVEL_SCHEDULED); }
+
+    /*!
+    * \fn setSolverType
+    * \brief Selects the sparse direct solver used for the Laplacian matrix (refactorizes it if already built)
+    */
+    void setSolverType(eSparseSolverType _solverType);
+
+    /*!
+    * \fn getSolver
+    */
+    inline const SparseSolver& getSolver() const { return m_solver; }
+
+    /*!
+    * \fn setMultiresolution
+    * \brief Enables coarse-to-fine solving: the solution on a coarsened graph is prolongated 
+    *        as initial guess for the finer level (hierarchy is built in initialize())
+    * \param _nbLevels : number of levels, including the full-resolution mesh (1 = disabled)
+    * \param _minNbVertices : a level is not coarsened if it has less vertices than this
+    */
+    inline void setMultiresolution(unsigned int _nbLevels, unsigned int _minNbVertices = 500) { m_nbLevels = _nbLevels; m_minNbVerticesCoarse = _minNbVertices; m_isHierarchyDirty = !m_initVertices.empty(); }
+
+    /*!
+    * \fn setRegionOfInterest
+    * \brief Restricts the solve to vertices close to the handles, vertices on the border of this region are fixed.
+    *        Regions and their factorization are cached for each set of handles (see setRegionCacheSize())
+    * \param _radius : max distance to a handle (0.0 = disabled, the whole mesh is solved)
+    * \param _useGeodesicDistance : distance is the length of the shortest path on the rest mesh if true, 
+    *                               the number of edges otherwise
+    */
+    void setRegionOfInterest(double _radius, bool _useGeodesicDistance = false);
+
+    /*!
+    * \fn setRegionCacheSize
+    * \brief Sets the max number of cached regions of interest, the least recently used ones are released first
+    */
+    void setRegionCacheSize(size_t _cacheSize);
+
+    /*!
+    * \fn hasConverged
+    * \brief Returns true if the last solve reached the tolerance (false if stopped by the budget)
+    */
+    inline bool hasConverged() const { return m_hasConverged; }
+
+    /*!
+    * \fn getNbIterations
+    * \brief Returns the number of local/global iterations done during the last solve
+    */
+    inline unsigned int getNbIterations() const { return m_nbIterations; }
+
+    /*!
+    * \fn getEnergy
+    * \brief Returns the ARAP energy at the end of the last solve
+    */
+    inline double getEnergy() const { return m_energy; }
+
 
     /*----------------------------------------------------------------------------------------------+
     |                                        MISCELLANEOUS                                          |
@@ -101,18 +188,127 @@ public:
     */
     void updateAnchors();
 
+    /*!
+    * \fn addAnchor
+    * \brief Pins a vertex at a given position (or updates an existing anchor).
+    *        Coarse levels keep their aggregation, the anchor is forwarded to the cluster of the vertex
+    * \param _id : vertex index
+    * \param _pos : anchor position
+    * \return : success
+    */
+    bool addAnchor(const uint32_t _id, const glm::vec3& _pos);
+
+    /*!
+    * \fn addHandle
+    * \brief Adds a moving anchor, starting at the vertex's current position and moving toward _targetPos
+    * \param _id : vertex index
+    * \param _targetPos : target position of the handle
+    * \return : success
+    */
+    bool addHandle(const uint32_t _id, const glm::vec3& _targetPos);
+
+    /*!
+    * \fn setHandleTarget
+    * \brief Changes the target position of an existing handle
+    * \return : success
+    */
+    bool setHandleTarget(const uint32_t _id, const glm::vec3& _targetPos);
+
+    /*!
+    * \fn removeAnchor
+    * \brief Releases an anchor or a handle (the last one is kept: without anchors, the system is singular)
+    * \param _id : vertex index
+    * \return : success
+    */
+    bool removeAnchor(const uint32_t _id);
+
     bool isAdjacencyEmpty() const;
     unsigned int getVertexDegree(const unsigned int _id) const;
 
 
 protected:
 
+    /*!
+    * \struct ArapRegion
+    * \brief Region of interest: sub-model and its vertices in the full mesh
+    */
+    struct ArapRegion
+    {
+        std::unique_ptr<Arap> m_model;       /*!< sub-model, with its own factorization */
+        std::vector<uint32_t> m_vertices;    /*!< mesh ids of sub-model vertices (free vertices first, then border) */
+        size_t m_nbFree = 0;                 /*!< number of free vertices */
+        uint64_t m_lastUse = 0;              /*!< value of m_roiCacheClock when the region was last solved */
+    };
+
+    /*!
+    * \fn trimRegionCache
+    * \brief Releases the least recently used regions until the cache holds m_roiCacheSize regions at most
+    */
+    void trimRegionCache();
+
+    /*!
+    * \fn copySettings
+    * \brief Copies solver settings to a coarse level or a region of interest
+    */
+    void copySettings(Arap& _other) const;
+
+    /*!
+    * \fn solveIterations
+    * \brief Local/global iterations on the whole model (coarse-to-fine if multiresolution is enabled)
+    * \return : success
+    */
+    bool solveIterations(double _eps);
+
+    /*!
+    * \fn buildRegionOfInterest
+    * \brief Builds and factorizes the sub-model around a set of handles
+    * \return : success
+    */
+    bool buildRegionOfInterest(const std::vector<uint32_t>& _handles, ArapRegion& _region);
+
+    /*!
+    * \fn solveRegionOfInterest
+    * \brief Solves only the region of interest around current handles
+    * \return : success
+    */
+    bool solveRegionOfInterest(double _eps);
+
+    /*!
+    * \fn initializeGraph
+    * \brief Builds and factorizes the Laplacian from m_initVertices, m_neighbors and m_anchorsMap, 
+    *        computes the initial guess, and builds coarser levels
+    * \return : success
+    */
+    bool initializeGraph();
+
+    /*!
+    * \fn buildCoarseLevel
+    * \brief Builds the next coarser level, by greedy aggregation of first-ring neighborhoods
+    * \return : success
+    */
+    bool buildCoarseLevel();
+
+    /*!
+    * \fn prolongate
+    * \brief Updates m_matX and m_rot with the motion of the coarser level since its previous solution
+    * \param _prevCoarseX : coarse vertices before last coarse solve
+    * \param _prevCoarseRot : coarse rotations before last coarse solve
+    */
+    void prolongate(const Eigen::MatrixX3d& _prevCoarseX, const std::vector<Eigen::Matrix3d>& _prevCoarseRot);
+
     /*!
     * \fn buildMatrixL
     * \brief Build Laplacaian matrix
     */
     bool buildMatrixL();
 
+    /*!
+    * \fn factorizeMatrixL
+    * \brief Numerical Cholesky factorization of L, reusing the symbolic analysis done in buildMatrixL()
+    * \return : success
+    */
+    bool factorizeMatrixL();
+
     /*!
     * \fn initGuessMatrixX
     * \brief First iteration to fill-in matrix X 
@@ -138,6 +334,12 @@ protected:
     */
     bool globalStep();
 
+    /*!
+    * \fn solveMatrixL
+    * \brief Solves L * _matX = _matB with the current factorization, according to m_solveMode
+    */
+    void solveMatrixL(const Eigen::MatrixX3d& _matB, Eigen::MatrixX3d& _matX);
+
     /*!
     * \fn l2Energy
     */
@@ -145,7 +347,9 @@ protected:
 
     /*!
     * \fn solve
-    * \brief Complete solving process, i.e., one iteration for live animation
+    * \brief Complete solving process, i.e., one iteration for live animation.
+    *        Warm-starts from the previous m_matX and m_rot, and stops when the energy
+    *        variation is below _eps or when the budget (see setSolveBudget()) is exhausted
     * \return : success
     */
     bool solve(double _eps);
@@ -155,7 +359,10 @@ protected:
     |                                         ATTRIBUTES                                            |
     +-----------------------------------------------------------------------------------------------*/
 
-    ArapSimplicialLLT m_llt;                /*!< sparse Cholesky decomposition from the Laplacian matrix if the mesh */
+    SparseSolver m_solver;                  /*!< sparse Cholesky decomposition from the Laplacian matrix if the mesh */
+    Eigen::SparseMatrix<double> m_matL;     /*!< Laplacian matrix, with anchors' weights in diagonal */
+    bool m_isFactorizationDirty = false;    /*!< true if anchors changed since last factorization of m_matL */
+    eArapSolveMode m_solveMode = eArapSolveMode::SERIAL; /*!< back-substitution mode */
     std::vector<Eigen::Matrix3d> m_rot;     /*!< list of local rotation matrices */
     Eigen::MatrixX3d m_matX;                /*!< X matrix (coordinates of vertices) */
 
@@ -165,7 +372,31 @@ protected:
     double m_edgesWeight = 1.0;                 /* edges' weight, we use constant weight instead of cotan weights */
 
     std::vector<glm::vec3> m_initVertices;       /* initial vertices */
-    std::vector<std::vector<bool> > m_adjacency; /* adjacency matrix */
+    std::vector<std::vector<uint32_t> > m_neighbors; /* adjacency lists (first-ring neighbors of each vertex) */
+
+    unsigned int m_maxIterations = 0;   /*!< max number of local/global iterations per solve (0 = unbounded) */
+    double m_timeBudgetMs = 0.0;        /*!< wall-clock budget per solve, in ms (0.0 = unbounded) */
+    bool m_hasConverged = false;        /*!< convergence status of last solve */
+    unsigned int m_nbIterations = 0;    /*!< number of iterations of last solve */
+    double m_energy = 0.0;              /*!< ARAP energy at the end of last solve */
+
+    bool m_useAnderson = false;          /*!< use Anderson acceleration in solve() */
+    unsigned int m_andersonMemory = 5;   /*!< number of previous iterates used by Anderson acceleration */
+    AndersonAcceleration m_anderson;     /*!< Anderson accelerator, on the stacked vertices coordinates */
+
+    unsigned int m_nbLevels = 1;                /*!< number of multiresolution levels (1 = disabled) */
+    unsigned int m_minNbVerticesCoarse = 500;   /*!< min number of vertices for a level to be coarsened */
+    bool m_isHierarchyDirty = false;            /*!< true if coarse levels must be rebuilt (multiresolution settings changed) */
+    std::unique_ptr<Arap> m_coarseLevel;        /*!< next coarser level (with its own cached factorization) */
+    std::vector<uint32_t> m_clusterIds;         /*!< coarse vertex (cluster) of each vertex */
+    std::vector<uint32_t> m_clusterSeeds;       /*!< seed vertex of each cluster */
+
+    double m_roiRadius = 0.0;                   /*!< radius of the region of interest (0.0 = disabled) */
+    bool m_roiUseGeodesicDistance = false;      /*!< geodesic (true) or graph (false) distance for the ROI */
+    std::map<std::vector<uint32_t>, ArapRegion> m_roiCache; /*!< cached regions, for each set of handles */
+    std::vector<uint32_t> m_activeRoiKey;       /*!< handles of the last solved region */
+    size_t m_roiCacheSize = 4;                  /*!< max number of cached regions */
+    uint64_t m_roiCacheClock = 0;               /*!< incremented at each region solve */
 
 
 }; // class Arap
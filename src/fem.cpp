@@ -11,6 +11,14 @@
 #include "fem.h"
 
 #include <iostream>
+#include <cmath>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+
+#include <Eigen/Eigenvalues>
 
 
 namespace CompGeom
@@ -23,13 +31,27 @@ bool Fem::initialize( std::vector<glm::vec3>& _verticesPos
 					, std::vector<std::pair<uint32_t, glm::vec3> >& _constraintPoints)
 {
 	m_initVertices = _verticesPos;
+	m_restVertices = _verticesPos;
     m_indices = _indices;
 
+	// quadratic elements: edge nodes are appended to the vertices
+	m_edgeNodes.clear();
+	m_quadraticIndices.clear();
+	if (m_elementType == eFemElementType::QUADRATIC_TRIANGLE)
+	{
+		buildQuadraticNodes();
+	}
+
 	m_mu = 10.5 /*_mu*/;
 	m_lambda = 0.5 /*_lambda*/;
 
 	buildE();
-	assembleK();
+
+	// matrix-free mode never stores K
+	if (m_solverType != eFemSolverType::MATRIX_FREE_CG)
+	{
+		assembleK();
+	}
 
 
 	this->addConstraints(_fixedPointsIds, _constraintPoints);
@@ -48,7 +70,7 @@ void Fem::addConstraints(std::vector<uint32_t>& _fixedConstraints, std::vector<s
 }
 
 
-void Fem::buildPe(Eigen::Matrix3d& _Pe, int _i1, int _i2, int _i3)
+double Fem::buildBe(Matrix36d& _Be, int _i1, int _i2, int _i3) const
 {
 	/*
     * Piecewise Approximation 2D:
@@ -61,91 +83,43 @@ void Fem::buildPe(Eigen::Matrix3d& _Pe, int _i1, int _i2, int _i3)
 	*
 	* - A linear triangular element is composed of 3 nodes and 3 linear basis functions:
 	*   N_i(x,y) = alpha_i + beta_i * x + gamma_i * y , i = 1, 2, 3
-	*   with alpha, beta, gamma unknown factors
-	*
-	* - N_1(x,y) is maximal for node i=1, with coords (x_1, y_1) ( N_1(x_1, y_1) = 1), 
-	*   whereas it is minimal for nodes i=2 and i=3 ( N_1(x_2, y_2) = 0, N_1(x_3, y_3) = 0), 
-	*   therefore we can build the system:
-	*	N_1(x_1,y_1) = alpha_1 + beta_1 * x_1 + gamma_1 * y_1 = 1
-	*	N_1(x_2,y_2) = alpha_1 + beta_1 * x_2 + gamma_1 * y_2 = 0
-	*	N_1(x_3,y_3) = alpha_1 + beta_1 * x_3 + gamma_1 * y_3 = 0
-	*   in matrix form:
-	*   | 1 x_1 y_1|   |alpha_1|   |1|
-	*   | 1 x_2 y_2| * |beta_1 | = |0|
-	*   | 1 x_3 y_3|   |gamma_1|   |0|
-	*
-	* - Repeating for N_2 and N_3 ( N_2(x_1, y_1) = 0, N_2(x_2, y_2) = 1, N_2(x_3, y_3) = 0,
-	*                               N_3(x_1, y_1) = 0, N_3(x_2, y_2) = 0, N_3(x_3, y_3) = 1)
-	*   gives the full system for the element e:
-	*   *   in matrix form:
-	*   |1 x_1 y_1|   |alpha_1 alpha_2 alpha_3|   |1 0 0|
-	*   |1 x_2 y_2| * |beta_1  beta_2  beta_3 | = |0 1 0|
-	*   |1 x_3 y_3|   |gamma_1 gamma_2 gamma_3|   |0 0 1|
-	*
-	* - The unknown factors (alpha_i, beta_i, gamma_i) contained in matrix Pe 
-	*   can then be deduced by solving the system:
+	*   such that N_i = 1 on node i and N_i = 0 on the 2 other nodes, i.e.:
 	*         |alpha_1 alpha_2 alpha_3|          |1 x_1 y_1|
 	*   Pe =  |beta_1  beta_2  beta_3 | = inverse|1 x_2 y_2|
 	*         |gamma_1 gamma_2 gamma_3|          |1 x_3 y_3|
-    */
-
-	_Pe.col(0) = Eigen::Vector3d(1.0, 1.0, 1.0);
-
-	// x_1 y_1
-	_Pe.row(0)[1] = m_initVertices[_i1].x;
-	_Pe.row(0)[2] = m_initVertices[_i1].y;
-
-	// x_2 y_2
-	_Pe.row(1)[1] = m_initVertices[_i2].x;
-	_Pe.row(1)[2] = m_initVertices[_i2].y;
-
-	// x_3 y_3
-	_Pe.row(2)[1] = m_initVertices[_i3].x;
-	_Pe.row(2)[2] = m_initVertices[_i3].y;
-
-	_Pe = _Pe.inverse().eval();
-}
-
-
-void Fem::buildBe(Eigen::MatrixXd& _Be, const Eigen::Matrix3d& _Pe)
-{
-	/*
-    * Displacement deformation matrix Be for the element e, defined by:
-	*         |alpha_2    0    beta_2   0    gamma_2   0    |
-	*   Be =  |   0    alpha_3   0    beta_3    0    gamma_3|
-	*         |alpha_3 alpha_2 beta_3 beta_2 gamma_3 gamma_2|
 	*
-	*   with factors (alpha_i, beta_i, gamma_i) taken from matrix Pe:
-	*         |alpha_1 alpha_2 alpha_3|
-	*   Pe =  |beta_1  beta_2  beta_3 |
-	*         |gamma_1 gamma_2 gamma_3|
+	* - The gradients of the basis functions (beta_i, gamma_i) have a closed form,
+	*   with (i, j, k) a cyclic permutation of (1, 2, 3) and A the (signed) area of the triangle:
+	*   beta_i  = dN_i/dx = (y_j - y_k) / (2 * A)
+	*   gamma_i = dN_i/dy = (x_k - x_j) / (2 * A)
+	*
+	* Displacement deformation matrix Be for the element e, which gives the strain 
+	* (eps_xx, eps_yy, gamma_xy) from the displacements (u_1, v_1, u_2, v_2, u_3, v_3) of its nodes:
+	*         |beta_1     0    beta_2     0    beta_3     0   |
+	*   Be =  |   0    gamma_1    0    gamma_2    0    gamma_3|
+	*         |gamma_1  beta_1 gamma_2  beta_2 gamma_3  beta_3|
     */
 
-	_Be.resize(3, 6);
-	_Be.setZero();
+	const glm::vec3& p1 = m_restVertices[_i1];
+	const glm::vec3& p2 = m_restVertices[_i2];
+	const glm::vec3& p3 = m_restVertices[_i3];
 
-	double alpha_2 = _Pe.row(0)[1];
-	double beta_2  = _Pe.row(1)[1];
-	double gamma_2 = _Pe.row(2)[1];
-	double alpha_3 = _Pe.row(0)[2];
-	double beta_3  = _Pe.row(1)[2];
-	double gamma_3 = _Pe.row(2)[2];
+	const double twiceArea = ((double)p2.x - p1.x) * ((double)p3.y - p1.y) - ((double)p3.x - p1.x) * ((double)p2.y - p1.y);
 
-	_Be.row(0)[0] = alpha_2;
-	_Be.row(0)[2] = beta_2;
-	_Be.row(0)[4] = gamma_2;
+	const double beta[3]  = { (p2.y - p3.y) / twiceArea, (p3.y - p1.y) / twiceArea, (p1.y - p2.y) / twiceArea };
+	const double gamma[3] = { (p3.x - p2.x) / twiceArea, (p1.x - p3.x) / twiceArea, (p2.x - p1.x) / twiceArea };
 
-	_Be.row(1)[1] = alpha_3; 
-	_Be.row(1)[3] = beta_3; 
-	_Be.row(1)[5] = gamma_3;
-	
-	_Be.row(2)[0] = /*0.5 * */alpha_3;
-	_Be.row(2)[1] = /*0.5 * */alpha_2;
-	_Be.row(2)[2] = /*0.5 * */beta_3;
-	_Be.row(2)[3] = /*0.5 * */beta_2;
-	_Be.row(2)[4] = /*0.5 * */gamma_3;
-	_Be.row(2)[5] = /*0.5 * */gamma_2;
+	_Be.setZero();
+	for (int i = 0; i < 3; i++)
+	{
+		_Be(0, 2 * i)     = beta[i];
+		_Be(1, 2 * i + 1) = gamma[i];
+		_Be(2, 2 * i)     = gamma[i];
+		_Be(2, 2 * i + 1) = beta[i];
+	}
 
+	// triangle volume (2D->area)
+	return std::abs(0.5 * twiceArea);
 }
 
 
@@ -175,67 +149,137 @@ void Fem::buildE()
 }
 
 
-void Fem::buildKe(Eigen::MatrixXd& _Ke, int _i1, int _i2, int _i3)
+void Fem::buildKe(Matrix66d& _Ke, int _i1, int _i2, int _i3) const
 {
-	_Ke.resize(6, 6);
-	_Ke.setZero();
+	Matrix36d Be;
+	double vol = buildBe(Be, _i1, _i2, _i3);
+
+	_Ke.noalias() = Be.transpose() * m_matE * Be * vol; 
+}
+
+
+//Global stiffness matrix. Dimensions (2 x numberOfVertices, 2 x numberOfVertices)
+void Fem::assembleK()
+{
+	if (m_elementType == eFemElementType::QUADRATIC_TRIANGLE)
+	{
+		assembleElements<6, 2>([this](int _e, Matrix1212d& _Ke) { buildQuadraticKe(_Ke, _e); }, m_quadraticIndices, m_initVertices.size(), false, m_matKFull);
+		return;
+	}
 
-	Eigen::MatrixXd Be(3, 6);
-	Eigen::Matrix3d Pe(3, 3);
-	double vol;
+	assembleElements<3, 2>([this](int _e, Matrix66d& _Ke) { buildKe(_Ke, m_indices[_e * 3], m_indices[_e * 3 + 1], m_indices[_e * 3 + 2]); },
+					       m_indices, m_initVertices.size(), false, m_matKFull);
+}
 
-	Be.setZero();
-	Pe.setZero();
 
-	buildPe(Pe, _i1, _i2, _i3);
+void Fem::buildQuadraticNodes()
+{
+	// one node per edge, shared by the 2 elements of the edge
+	const size_t nbVertices = m_restVertices.size();
+	const size_t nbTriangles = m_indices.size() / 3;
+	std::unordered_map<uint64_t, uint32_t> edgeNodeIds;
+	edgeNodeIds.reserve(2 * nbTriangles);
 
-	double detPe = Pe.determinant();
+	m_quadraticIndices.resize(6 * nbTriangles);
+	for (size_t tId = 0; tId < nbTriangles; tId++)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			uint32_t a = m_indices[tId * 3 + i];
+			uint32_t b = m_indices[tId * 3 + (i + 1) % 3];
+			uint64_t key = a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
 
-	vol = std::abs(1 / (detPe * 2)); //Calculation of the triangle volume (2D->area)
+			auto it = edgeNodeIds.find(key);
+			if (it == edgeNodeIds.end())
+			{
+				it = edgeNodeIds.emplace(key, (uint32_t)(nbVertices + m_edgeNodes.size())).first;
+				m_edgeNodes.push_back(std::make_pair(a, b));
 
-	buildBe(Be, Pe);
+				// straight edges: the node is in the middle
+				m_restVertices.push_back(0.5f * (m_restVertices[a] + m_restVertices[b]));
+				m_initVertices.push_back(0.5f * (m_initVertices[a] + m_initVertices[b]));
+			}
 
-	_Ke = Be.transpose() * m_matE * Be * vol; 
+			m_quadraticIndices[tId * 6 + i] = a;
+			m_quadraticIndices[tId * 6 + 3 + i] = it->second;
+		}
+	}
 }
 
 
-//Global stiffness matrix. Dimensions (2 x numberOfVertices, 2 x numberOfVertices)
-void Fem::assembleK()
+double Fem::buildQuadraticBe(Matrix312d& _Be, int _e, const Eigen::Vector3d& _L) const
 {
-	size_t nbVertices = m_initVertices.size();
-	size_t nbTriangles = m_indices.size() / 3;
-	
-	m_matK.resize(2 * nbVertices, 2 * nbVertices);
-	m_matK.setZero();
+	// gradients of the area coordinates L_i are the gradients of the linear shape functions (see buildBe())
+	Matrix36d linearBe;
+	const double area = buildBe(linearBe, m_indices[_e * 3], m_indices[_e * 3 + 1], m_indices[_e * 3 + 2]);
+	Eigen::Vector2d gradL[3];
+	for (int i = 0; i < 3; i++)
+	{
+		gradL[i] = Eigen::Vector2d(linearBe(0, 2 * i), linearBe(1, 2 * i + 1));
+	}
 
-	for (size_t tId = 0; tId < nbTriangles; tId++)
+	// vertices: grad N_i = (4 * L_i - 1) * grad L_i
+	// edge (i, j): grad N_ij = 4 * (L_i * grad L_j + L_j * grad L_i)
+	Eigen::Vector2d gradN[6];
+	for (int i = 0; i < 3; i++)
 	{
-		// build matrix Ke for triangle element e
-		Eigen::MatrixXd Ke(6, 6);
-		Ke.setZero();
-		buildKe(Ke, m_indices[tId * 3], m_indices[tId * 3 + 1], m_indices[tId * 3 + 2]);
+		const int j = (i + 1) % 3;
+		gradN[i] = (4.0 * _L[i] - 1.0) * gradL[i];
+		gradN[3 + i] = 4.0 * (_L[i] * gradL[j] + _L[j] * gradL[i]);
+	}
 
-		for (int i = 0; i < 3; i++)
+	_Be.setZero();
+	for (int k = 0; k < 6; k++)
+	{
+		_Be(0, 2 * k)     = gradN[k].x();
+		_Be(1, 2 * k + 1) = gradN[k].y();
+		_Be(2, 2 * k)     = gradN[k].y();
+		_Be(2, 2 * k + 1) = gradN[k].x();
+	}
+
+	return area;
+}
+
+
+void Fem::buildQuadraticKe(Matrix1212d& _Ke, int _e) const
+{
+	// 3-point Gauss quadrature on the triangle (degree 2), weights A / 3
+	static const Eigen::Vector3d gaussPoints[3] = { Eigen::Vector3d(2.0 / 3.0, 1.0 / 6.0, 1.0 / 6.0),
+	                                                Eigen::Vector3d(1.0 / 6.0, 2.0 / 3.0, 1.0 / 6.0),
+	                                                Eigen::Vector3d(1.0 / 6.0, 1.0 / 6.0, 2.0 / 3.0) };
+
+	_Ke.setZero();
+	for (int q = 0; q < 3; q++)
+	{
+		Matrix312d Be;
+		const double area = buildQuadraticBe(Be, _e, gaussPoints[q]);
+		_Ke.noalias() += Be.transpose() * m_matE * Be * (area / 3.0);
+	}
+}
+
+
+void Fem::buildDofMap()
+{
+	// edge nodes of quadratic elements between 2 fixed vertices are fixed
+	std::vector<uint32_t> fixedNodes = m_fixedConstraints;
+	if (!m_edgeNodes.empty())
+	{
+		const size_t nbVertices = getNbVertices();
+		std::vector<bool> isFixedVertex(nbVertices, false);
+		for (auto it = m_fixedConstraints.begin(); it != m_fixedConstraints.end(); ++it)
 		{
-			for (int j = 0; j < 3; j++)
+			isFixedVertex.at(*it) = true;
+		}
+		for (size_t k = 0; k < m_edgeNodes.size(); k++)
+		{
+			if (isFixedVertex.at(m_edgeNodes[k].first) && isFixedVertex.at(m_edgeNodes[k].second))
 			{
-				// for each node in e
-				// calculate node index in global matrix K
-				int destI, destJ;
-				destI = 2 * m_indices[tId * 3 + i];
-				destJ = 2 * m_indices[tId * 3 + j];
-
-				// copy content of Ke into K
-				for (int x = 0; x < 2; x++)
-				{
-					for (int y = 0; y < 2; y++)
-					{
-						m_matK.row(destI + x)[destJ + y] += Ke.row((i * 2) + x)[ (j * 2) + y];
-					}
-				}
+				fixedNodes.push_back((uint32_t)(nbVertices + k));
 			}
 		}
 	}
+
+	FemModel::buildDofMap(m_initVertices.size(), fixedNodes);
 }
 
 
@@ -245,63 +289,45 @@ void Fem::setBoundaryConditionsFixed()
 	// which correspond to a fixed node:
 	// New number of nodes = original node number - fixed node number 
 	// New matrix K dimension = New number of nodes * 2 coords
-	size_t nbNodes = m_initVertices.size();
-	const size_t matDim = 2 * (nbNodes - m_fixedConstraints.size());
-
-	// build a temporary K matrix with new dimensions
-	Eigen::MatrixXd tempK(matDim, matDim);
-	tempK.setZero();
+	buildDofMap();
+	const size_t matDim = getNbFreeDofs();
+	m_isSystemDirty = true;
+	m_isModalBasisDirty = true;
 
-	// build a temporary list of non-fixed nodes indices
-	std::vector<uint32_t> tempMovingNodes;
-	for(uint32_t i = 0; i < nbNodes; i++)
+	if (m_matKFull.rows() == 0)
 	{
-		if (std::find(m_fixedConstraints.begin(), m_fixedConstraints.end(), i) == m_fixedConstraints.end())
-		{
-			tempMovingNodes.push_back(i);
-		}
+		// matrix-free mode: fixed dofs are skipped by the operator
+		m_matK.resize(0, 0);
+		return;
 	}
 
-	// Copy K matrix factors which correspond to moving nodes into tempK
-	int cptI = 0; // coord in new matrix K
-	for(auto it1 = tempMovingNodes.begin(); it1 != tempMovingNodes.end(); ++it1)
+	// copy non-zeros of the full matrix K which correspond to moving nodes, in O(nnz)
+	std::vector<Eigen::Triplet<double> > triplets;
+	triplets.reserve(m_matKFull.nonZeros());
+	for (int col = 0; col < m_matKFull.outerSize(); col++)
 	{
-		// get node coords in original K (iterate over rows)
-		int idNodeI = (*it1);
-		int nodeIX = 2 * idNodeI;
-		int nodeIY = 2 * idNodeI + 1;
+		int newCol = m_nodeToFreeId.at(col / 2);
+		if (newCol < 0)
+			continue;
 
-		int cptJ = 0; // coord in new matrix K
-		for(auto it2 = tempMovingNodes.begin(); it2 != tempMovingNodes.end(); ++it2)
+		for (Eigen::SparseMatrix<double>::InnerIterator it(m_matKFull, col); it; ++it)
 		{
-			// get node coords in original K (iterate over columns)
-			int idNodeJ = (*it2);
-			int nodeJX = 2 * idNodeJ;
-			int nodeJY = 2 * idNodeJ + 1;
-
-			// new coords
-			int newI = 2 * cptI;
-			int newJ = 2 * cptJ;
-			tempK.row(newI)[newJ] = m_matK.row(nodeIX)[nodeJX];
-			tempK.row(newI)[newJ + 1] = m_matK.row(nodeIX)[nodeJY];
-
-			tempK.row(newI + 1)[newJ] = m_matK.row(nodeIY)[nodeJX];
-			tempK.row(newI + 1)[newJ + 1] = m_matK.row(nodeIY)[nodeJY];
-
-			cptJ++;
+			int newRow = m_nodeToFreeId.at(it.row() / 2);
+			if (newRow >= 0)
+			{
+				triplets.push_back(Eigen::Triplet<double>(2 * newRow + (int)(it.row() % 2), 2 * newCol + (col % 2), it.value()));
+			}
 		}
-		cptI++;
 	}
 
-	// overwrite global matrix K with temporary K
-	m_matK = tempK;
+	m_matK.resize(matDim, matDim);
+	m_matK.setFromTriplets(triplets.begin(), triplets.end());
 }
 
 
 void Fem::setBoundaryConditionsForces()
 {
-	assert(m_matK.rows() == m_matK.cols());
-	const size_t dimVec = m_matK.rows();
+	const size_t dimVec = getNbFreeDofs();
 
 	Eigen::VectorXd tempVecU;
 	tempVecU.resize(dimVec);
@@ -317,99 +343,1722 @@ void Fem::setBoundaryConditionsForces()
 
 	m_vecU = tempVecU;
 	m_vecF = tempVecF;
+	m_vecFTotal = Eigen::VectorXd::Zero(dimVec);
 }
 
 
 void Fem::updateBoundaryConditions()
 {
-	const size_t dimVec = m_matK.rows();
+	const Eigen::Index dimVec = getNbFreeDofs();
+
+	// previous displacements are kept, as initial guess for the iterative solver
+	if (m_vecU.size() != dimVec)
+	{
+		m_vecU = Eigen::VectorXd::Zero(dimVec);
+	}
 
-	Eigen::VectorXd tempVecU;
-	tempVecU.resize(dimVec);
 	Eigen::VectorXd tempVecF;
 	tempVecF.resize(dimVec);
-
-	tempVecU.setZero();
 	tempVecF.setZero();
 	
 	uint32_t constraintVertId = m_movingConstraints.at(0).first;
 	glm::vec3 constraintTargetPos = m_movingConstraints.at(0).second;
 	glm::vec3 constraintInitPos = m_initVertices.at(constraintVertId);
 	glm::vec3 constraintDisplacement = constraintTargetPos - constraintInitPos;
-	uint32_t constraintVecId = 2 * (constraintVertId - 2);
+	if (m_nodeToFreeId.at(constraintVertId) < 0)
+	{
+		std::cerr << "Fem::updateBoundaryConditions(): moving constraint is a fixed node" << std::endl;
+		return;
+	}
+	uint32_t constraintVecId = 2 * m_nodeToFreeId.at(constraintVertId);
 	tempVecF.row(constraintVecId)[0] = constraintDisplacement.x * 0.1;
 	tempVecF.row(constraintVecId + 1)[0] = constraintDisplacement.y * 0.1;
 
-	m_vecU = tempVecU;
 	m_vecF = tempVecF;
 }
 
 
-bool Fem::iterate()
+void Fem::setSolverType(eFemSolverType _solverType)
 {
-	assert(m_matK.row(0).size() == m_vecU.size());
-	assert(m_matK.row(0).size() == m_vecF.size());
-	assert(m_matK.row(0).size() == m_matK.col(0).size());
+	m_solverType = _solverType;
+	if (m_solverType == eFemSolverType::MATRIX_FREE_CG && m_elementType == eFemElementType::QUADRATIC_TRIANGLE)
+	{
+		std::cerr << "Fem: quadratic elements, using CONJUGATE_GRADIENT instead of MATRIX_FREE_CG" << std::endl;
+		m_solverType = eFemSolverType::CONJUGATE_GRADIENT;
+	}
+	if (m_solverType == eFemSolverType::MATRIX_FREE_CG && FemPreconditioner::needsAssembledMatrix(m_preconditioner))
+	{
+		std::cerr << "Fem: matrix-free operator, using JACOBI preconditioner instead" << std::endl;
+	}
+	m_isSystemDirty = true;
+}
 
-	m_CG.compute(m_matK);
-	auto info = m_CG.info();
-	std::string computationInfo = info == Eigen::Success ? "Success" : Eigen::NumericalIssue ? "NumericalIssue" : "Unknown";
-    if(computationInfo != "Success")
-		std::cerr << "m_CG computation error: " << computationInfo << std::endl;
 
-	m_vecU = m_CG.solve(m_vecF);
+void Fem::setElementType(eFemElementType _elementType)
+{
+	if (!m_restVertices.empty())
+	{
+		std::cerr << "Fem::setElementType(): must be called before initialize()" << std::endl;
+		return;
+	}
 
-	info = m_CG.info();
-    computationInfo = info == Eigen::Success ? "Success" : Eigen::NumericalIssue ? "NumericalIssue" : "Unknown";
-	if (computationInfo != "Success")
+	m_elementType = _elementType;
+	if (m_elementType == eFemElementType::QUADRATIC_TRIANGLE)
 	{
-		std::cerr << "m_CG solve error:       " << computationInfo << std::endl;
-		return false;
+		if (m_isCorotational || m_material != eFemMaterial::LINEAR)
+		{
+			std::cerr << "Fem: quadratic elements, using the linear material" << std::endl;
+			m_isCorotational = false;
+			m_material = eFemMaterial::LINEAR;
+		}
+		setSolverType(m_solverType);
 	}
-	
-	//std::cout << "#iterations:      " << m_CG.iterations() << std::endl;
-    //std::cout << "estimated error:  " << m_CG.error()      << std::endl;
-	return true;
+	m_isSystemDirty = true;
 }
 
 
-bool Fem::getResult(std::vector<glm::vec3>& _res)
+void Fem::setMaterial(eFemMaterial _material)
 {
-    _res.clear();
+	if (_material != eFemMaterial::LINEAR && m_elementType == eFemElementType::QUADRATIC_TRIANGLE)
+	{
+		std::cerr << "Fem::setMaterial(): quadratic elements only support the linear material" << std::endl;
+		return;
+	}
+	m_material = _material;
+	m_isSystemDirty = true;
+}
 
-	// init result with original positions
-	_res = m_initVertices;
 
-	// build a temporary list of non-fixed nodes indices
-	size_t nbNodes = m_initVertices.size();
-	std::vector<uint32_t> tempMovingNodes;
-	for(uint32_t i = 0; i < nbNodes; i++)
+void Fem::setCorotational(bool _isCorotational)
+{
+	if (_isCorotational && m_elementType == eFemElementType::QUADRATIC_TRIANGLE)
+	{
+		std::cerr << "Fem::setCorotational(): quadratic elements only support the linear material" << std::endl;
+		return;
+	}
+	m_isCorotational = _isCorotational;
+	m_isSystemDirty = true;
+}
+
+
+void Fem::setTimeIntegration(eFemTimeIntegration _timeIntegration, double _timeStep)
+{
+	m_timeIntegration = _timeIntegration;
+	m_timeStep = _timeStep;
+	m_isSystemDirty = true;
+}
+
+
+void Fem::setRayleighDamping(double _alpha, double _beta)
+{
+	m_rayleighAlpha = _alpha;
+	m_rayleighBeta = _beta;
+	m_isSystemDirty = true;
+}
+
+
+void Fem::setNewmarkParameters(double _beta, double _gamma)
+{
+	m_newmarkBeta = _beta;
+	m_newmarkGamma = _gamma;
+	m_isSystemDirty = true;
+}
+
+
+void Fem::setDensity(double _density)
+{
+	m_density = _density;
+	m_isSystemDirty = true;
+	m_isModalBasisDirty = true;
+}
+
+
+void Fem::setModalReduction(unsigned int _nbModes, const std::string& _cacheFileName)
+{
+	m_nbModes = _nbModes;
+	m_modalCacheFileName = _cacheFileName;
+	m_isSystemDirty = true;
+	m_isModalBasisDirty = true;
+}
+
+
+void Fem::setPreconditioner(eFemPreconditioner _preconditioner)
+{
+	FemModel::setPreconditioner(_preconditioner);
+	if (m_solverType == eFemSolverType::MATRIX_FREE_CG && FemPreconditioner::needsAssembledMatrix(m_preconditioner))
+	{
+		std::cerr << "Fem: matrix-free operator, using JACOBI preconditioner instead" << std::endl;
+	}
+}
+
+
+void Fem::setSolverTolerance(double _tolerance, unsigned int _maxIterations)
+{
+	FemModel::setSolverTolerance(_tolerance, _maxIterations);
+	m_matrixFreeCG.setTolerance(_tolerance);
+	if (_maxIterations > 0)
+	{
+		m_matrixFreeCG.setMaxIterations(_maxIterations);
+	}
+}
+
+
+bool Fem::factorizeSystem()
+{
+	// K only depends on the mesh and on fixed nodes:
+	// it is factorized (or CG is set up) once, and only solved at each frame
+	// (in corotational mode, only the parts which do not depend on rotations are set up here)
+	bool success = false;
+
+	const size_t nbTriangles = m_indices.size() / 3;
+	const eFemFormulation formulation = getActiveFormulation();
+
+	// reduced-order mode: modes of the linear K, nothing is factorized at runtime
+	if (formulation == eFemFormulation::MODAL)
 	{
-		if (std::find(m_fixedConstraints.begin(), m_fixedConstraints.end(), i) == m_fixedConstraints.end())
+		if (m_isCorotational || m_material != eFemMaterial::LINEAR)
 		{
-			tempMovingNodes.push_back(i);
+			std::cerr << "Fem: modal reduction uses the linear K, corotational and nonlinear formulations are ignored" << std::endl;
 		}
+		if (m_matKFull.rows() == 0)
+		{
+			assembleK();
+			setBoundaryConditionsFixed();
+		}
+		success = !m_isModalBasisDirty || computeModalBasis();
+		m_isSystemDirty = !success;
+		return success;
 	}
 
-	int cpt = 0;
-	for (auto it = tempMovingNodes.begin(); it != tempMovingNodes.end(); ++it)
+	if ((m_isCorotational || m_material != eFemMaterial::LINEAR) && isDynamic())
 	{
-		int idNode = (*it);
+		std::cerr << "Fem: corotational and nonlinear formulations are quasi-static only, dynamic mode uses the linear K" << std::endl;
+	}
+	const bool isNonlinear = formulation == eFemFormulation::NEO_HOOKEAN;
+	const bool isCorotational = formulation == eFemFormulation::COROTATIONAL;
 
-		glm::vec3 initPos = m_initVertices.at(idNode);
-		Eigen::Vector3d displacement;
-		displacement.setZero();
+	if (isDynamic())
+	{
+		buildLumpedMass();
+	}
 
-		displacement[0] = m_vecU.row(cpt * 2)[0];
-		displacement[1] = m_vecU.row(cpt * 2 + 1)[0];
+	if (isCorotational)
+	{
+		// rest frame of each element, rotations start from identity (or from current displacements, in updateRotations())
+		const bool cacheKe = m_solverType != eFemSolverType::MATRIX_FREE_CG || m_cacheElementsKe;
+		m_elementsKe.resize(cacheKe ? nbTriangles : 0);
+		m_elementsRot.assign(nbTriangles, Eigen::Matrix2d::Identity());
+		buildRestShapes();
+
+		#pragma omp parallel for
+		for (int tId = 0; tId < (int)nbTriangles; tId++)
+		{
+			if (cacheKe)
+			{
+				buildKe(m_elementsKe[tId], m_indices[tId * 3], m_indices[tId * 3 + 1], m_indices[tId * 3 + 2]);
+			}
+		}
+	}
+	else
+	{
+		m_elementsKe.clear();
+		m_elementsRot.clear();
+		m_matKRot.resize(0, 0);
+	}
 
-		// update position of moving nodes
-		_res.at(idNode) = initPos + glm::vec3(displacement[0], displacement[1], displacement[2]);
-		
-		m_initVertices.at(idNode) = _res.at(idNode);
+	if (isNonlinear)
+	{
+		// Hessians at the current displacements (from rest if they invert an element)
+		buildRestShapes();
+		m_elementsHessian.resize(nbTriangles);
+		if (std::isinf(evaluateNeoHookean(m_vecU, nullptr, true)))
+		{
+			m_vecU.setZero();
+			evaluateNeoHookean(m_vecU, nullptr, true);
+		}
+	}
+	else
+	{
+		m_elementsHessian.clear();
+		m_matH.resize(0, 0);
+	}
+
+	if (!isCorotational && !isNonlinear)
+	{
+		m_elementsInvDm.clear();
+	}
+
+	if (m_solverType == eFemSolverType::MATRIX_FREE_CG)
+	{
+		// reduced dofs of each element
+		std::vector<std::array<int, 6> > elementsDofs(nbTriangles);
+		for (size_t tId = 0; tId < nbTriangles; tId++)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				int freeId = m_nodeToFreeId.at(m_indices[tId * 3 + i]);
+				elementsDofs[tId][2 * i] = freeId >= 0 ? 2 * freeId : -1;
+				elementsDofs[tId][2 * i + 1] = freeId >= 0 ? 2 * freeId + 1 : -1;
+			}
+		}
+
+		// rotated Ke (or Hessians) change at each frame: they are not cached by the operator
+		if (isNonlinear)
+		{
+			m_operator.initialize(getNbFreeDofs(), elementsDofs,
+								  [this](int _e, FemOperator::Matrix66d& _Ke) { _Ke = m_elementsHessian[_e]; },
+								  false);
+		}
+		else if (isCorotational)
+		{
+			m_operator.initialize(getNbFreeDofs(), elementsDofs,
+								  [this](int _e, FemOperator::Matrix66d& _Ke) { getRotatedKe(_e, _Ke); },
+								  false);
+		}
+		else
+		{
+			m_operator.initialize(getNbFreeDofs(), elementsDofs,
+								  [this](int _e, FemOperator::Matrix66d& _Ke) { buildKe(_Ke, m_indices[_e * 3], m_indices[_e * 3 + 1], m_indices[_e * 3 + 2]); },
+								  m_cacheElementsKe);
+		}
+
+		// dynamic mode: the operator is the effective matrix c_M * M + c_K * K
+		if (isDynamic())
+		{
+			double coefU, coefV, coefM, coefK;
+			getEffectiveCoefficients(coefU, coefV, coefM, coefK);
+			m_operator.setShift(coefM * m_vecMass, coefK);
+		}
+
+		m_matrixFreeCG.preconditioner().setType(m_preconditioner);
+		if (isNonlinear)
+		{
+			// the preconditioner is computed at each Newton iteration
+			m_isSystemDirty = false;
+			return true;
+		}
+		m_matrixFreeCG.compute(m_operator);
+		success = m_matrixFreeCG.info() == Eigen::Success;
+		m_isSystemDirty = !success;
+		return success;
+	}
+
+	if (isNonlinear)
+	{
+		// the pattern of the Hessian is the pattern of K: the symbolic factorization is reused by all Newton iterations
+		assembleElements<3, 2>([this](int _e, Matrix66d& _He) { _He = m_elementsHessian[_e]; }, m_indices, m_initVertices.size(), true, m_matH);
+		m_CG.preconditioner().setType(m_preconditioner);
+		if (m_solverType == eFemSolverType::DIRECT)
+		{
+			m_solver.analyzePattern(m_matH);
+		}
+		m_isSystemDirty = false;
+		return true;
+	}
+
+	if (isCorotational)
+	{
+		// the pattern of the rotated K does not depend on rotations: the symbolic factorization is reused at each frame
+		assembleElements<3, 2>([this](int _e, Matrix66d& _Ke) { getRotatedKe(_e, _Ke); }, m_indices, m_initVertices.size(), true, m_matKRot);
+		m_CG.preconditioner().setType(m_preconditioner);
+		if (m_solverType == eFemSolverType::DIRECT)
+		{
+			m_solver.analyzePattern(m_matKRot);
+		}
+		m_isSystemDirty = false;
+		return true;
+	}
+
+	// K not assembled yet (model initialized in matrix-free mode)
+	if (m_matKFull.rows() == 0)
+	{
+		assembleK();
+		setBoundaryConditionsFixed();
+	}
+
+	// dynamic mode: the effective matrix c_M * M + c_K * K only depends on the time step, it is factorized once
+	if (isDynamic())
+	{
+		double coefU, coefV, coefM, coefK;
+		getEffectiveCoefficients(coefU, coefV, coefM, coefK);
+		m_matA = coefK * m_matK;
+		m_matA.diagonal() += coefM * m_vecMass;
+	}
+	else
+	{
+		m_matA.resize(0, 0);
+	}
+	const Eigen::SparseMatrix<double>& matSystem = isDynamic() ? m_matA : m_matK;
+
+	if (m_solverType == eFemSolverType::DIRECT)
+	{
+		success = m_solver.compute(matSystem);
+		m_solver.printStats();
+	}
+	else
+	{
+		m_CG.preconditioner().setType(m_preconditioner);
+		m_CG.compute(matSystem);
+		success = m_CG.info() == Eigen::Success;
+		if (!success)
+			std::cerr << "m_CG computation error" << std::endl;
+	}
+
+	m_isSystemDirty = !success;
+	return success;
+}
+
+
+void Fem::buildRestShapes()
+{
+	const size_t nbTriangles = m_indices.size() / 3;
+	m_elementsInvDm.resize(nbTriangles);
+
+	#pragma omp parallel for
+	for (int tId = 0; tId < (int)nbTriangles; tId++)
+	{
+		const uint32_t* ids = &m_indices[tId * 3];
+
+		Eigen::Matrix2d Dm;
+		Dm << m_restVertices[ids[1]].x - m_restVertices[ids[0]].x, m_restVertices[ids[2]].x - m_restVertices[ids[0]].x,
+			  m_restVertices[ids[1]].y - m_restVertices[ids[0]].y, m_restVertices[ids[2]].y - m_restVertices[ids[0]].y;
+		m_elementsInvDm[tId] = Dm.inverse();
+	}
+}
+
+
+Eigen::Matrix2d Fem::computeDeformationGradient(int _e, const Eigen::VectorXd& _vecU) const
+{
+	// current positions: rest positions + displacements of non-fixed nodes
+	Eigen::Vector2d x[3];
+	for (int i = 0; i < 3; i++)
+	{
+		uint32_t node = m_indices[_e * 3 + i];
+		x[i] = Eigen::Vector2d(m_restVertices[node].x, m_restVertices[node].y);
+		int freeId = m_nodeToFreeId.at(node);
+		if (freeId >= 0)
+		{
+			x[i] += _vecU.segment<2>(2 * freeId);
+		}
+	}
+
+	// deformation gradient F = Ds * Dm^-1
+	Eigen::Matrix2d Ds;
+	Ds.col(0) = x[1] - x[0];
+	Ds.col(1) = x[2] - x[0];
+	return Ds * m_elementsInvDm[_e];
+}
+
+
+void Fem::updateRotations()
+{
+	const size_t nbTriangles = m_indices.size() / 3;
 
-		cpt++;
+	#pragma omp parallel for
+	for (int tId = 0; tId < (int)nbTriangles; tId++)
+	{
+		const Eigen::Matrix2d F = computeDeformationGradient(tId, m_vecU);
+
+		// 2D polar decomposition F = R * S in closed form:
+		// R is the rotation of angle theta which makes R^T * F symmetric
+		const double theta = std::atan2(F(1, 0) - F(0, 1), F(0, 0) + F(1, 1));
+		const double c = std::cos(theta);
+		const double s = std::sin(theta);
+		m_elementsRot[tId] << c, -s,
+							  s, c;
 	}
+}
+
+
+double Fem::evaluateNeoHookean(const Eigen::VectorXd& _vecU, Eigen::VectorXd* _vecGrad, bool _computeHessians)
+{
+	const size_t nbTriangles = m_indices.size() / 3;
+	std::vector<Eigen::Matrix<double, 6, 1> > elementsGrad(_vecGrad != nullptr ? nbTriangles : 0);
+
+	double energy = 0.0;
+	bool isInverted = false;
+
+	#pragma omp parallel for reduction(+:energy) reduction(||:isInverted)
+	for (int tId = 0; tId < (int)nbTriangles; tId++)
+	{
+		const Eigen::Matrix2d F = computeDeformationGradient(tId, _vecU);
+		const double J = F.determinant();
+		if (J <= 0.0)
+		{
+			isInverted = true;
+			continue;
+		}
+
+		const Eigen::Matrix2d& invDm = m_elementsInvDm[tId];
+		const double area = 0.5 / std::abs(invDm.determinant());
+		const double logJ = std::log(J);
+		const Eigen::Matrix2d invFT = F.inverse().transpose();
+
+		// W(F) = mu / 2 * (tr(F^T * F) - 2) - mu * log(J) + lambda / 2 * log(J)^2
+		energy += area * (0.5 * m_mu * (F.squaredNorm() - 2.0) - m_mu * logJ + 0.5 * m_lambda * logJ * logJ);
+
+		if (_vecGrad == nullptr && !_computeHessians)
+			continue;
+
+		// G maps the displacements of the 3 nodes to vec(F) (column-major),
+		// with the gradients of the shape functions g_1, g_2 (rows of Dm^-1) and g_0 = -g_1 - g_2
+		Eigen::Matrix<double, 4, 6> G = Eigen::Matrix<double, 4, 6>::Zero();
+		const Eigen::RowVector2d gradN[3] = { -invDm.row(0) - invDm.row(1), invDm.row(0), invDm.row(1) };
+		for (int a = 0; a < 3; a++)
+		{
+			for (int c = 0; c < 2; c++)
+			{
+				for (int j = 0; j < 2; j++)
+				{
+					G(c + 2 * j, 2 * a + c) = gradN[a][j];
+				}
+			}
+		}
+
+		if (_vecGrad != nullptr)
+		{
+			// first Piola-Kirchhoff stress P = mu * (F - F^-T) + lambda * log(J) * F^-T
+			const Eigen::Matrix2d P = m_mu * (F - invFT) + m_lambda * logJ * invFT;
+			elementsGrad[tId] = area * G.transpose() * Eigen::Map<const Eigen::Vector4d>(P.data());
+		}
+
+		if (_computeHessians)
+		{
+			// dP = mu * dF + (mu - lambda * log(J)) * F^-T * dF^T * F^-T + lambda * tr(F^-1 * dF) * F^-T
+			Eigen::Matrix4d dPdF;
+			for (int k = 0; k < 4; k++)
+			{
+				Eigen::Matrix2d dF = Eigen::Matrix2d::Zero();
+				dF(k % 2, k / 2) = 1.0;
+				const Eigen::Matrix2d dP = m_mu * dF + (m_mu - m_lambda * logJ) * invFT * dF.transpose() * invFT
+										 + m_lambda * (invFT.transpose() * dF).trace() * invFT;
+				dPdF.col(k) = Eigen::Map<const Eigen::Vector4d>(dP.data());
+			}
+
+			// projection to SPD: negative eigenvalues are clamped to 0
+			Eigen::SelfAdjointEigenSolver<Eigen::Matrix4d> eigenSolver(0.5 * (dPdF + dPdF.transpose()));
+			const Eigen::Vector4d eigenValues = eigenSolver.eigenvalues().cwiseMax(0.0);
+			dPdF.noalias() = eigenSolver.eigenvectors() * eigenValues.asDiagonal() * eigenSolver.eigenvectors().transpose();
+
+			m_elementsHessian[tId].noalias() = area * G.transpose() * dPdF * G;
+		}
+	}
+
+	if (isInverted)
+	{
+		return std::numeric_limits<double>::infinity();
+	}
+
+	if (_vecGrad != nullptr)
+	{
+		_vecGrad->setZero(getNbFreeDofs());
+		for (size_t tId = 0; tId < nbTriangles; tId++)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				int freeId = m_nodeToFreeId.at(m_indices[tId * 3 + i]);
+				if (freeId >= 0)
+				{
+					_vecGrad->segment<2>(2 * freeId) += elementsGrad[tId].segment<2>(2 * i);
+				}
+			}
+		}
+	}
+
+	return energy;
+}
+
+
+bool Fem::solveNewton()
+{
+	auto elapsedMs = [](const std::chrono::steady_clock::time_point& _start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _start).count();
+	};
+
+	m_assemblyTime = 0.0;
+	m_factorizeTime = 0.0;
+	m_solveTime = 0.0;
+	m_lineSearchTime = 0.0;
+	m_nbNewtonIterations = 0;
+	m_hasNewtonConverged = false;
+
+	// forces of each frame are load increments (as in corotational mode)
+	if (m_vecFTotal.size() != m_vecF.size())
+	{
+		m_vecFTotal = Eigen::VectorXd::Zero(m_vecF.size());
+	}
+	m_vecFTotal += m_vecF;
+
+	// total energy E(u) = W(u) - f . u, residual forces g(u) = grad W(u) - f
+	Eigen::VectorXd vecGrad;
+	double initialResidual = -1.0;
+	for (unsigned int k = 0; ; k++)
+	{
+		auto startTime = std::chrono::steady_clock::now();
+		const double energy = evaluateNeoHookean(m_vecU, &vecGrad, true) - m_vecFTotal.dot(m_vecU);
+		vecGrad -= m_vecFTotal;
+
+		const double residual = vecGrad.norm();
+		if (initialResidual < 0.0)
+		{
+			initialResidual = residual;
+		}
+		if (residual <= m_newtonTolerance * std::max(m_vecFTotal.norm(), initialResidual))
+		{
+			m_assemblyTime += elapsedMs(startTime);
+			m_hasNewtonConverged = true;
+			break;
+		}
+		if (k == m_maxNewtonIterations)
+		{
+			// the residual of the last step is checked before giving up
+			m_assemblyTime += elapsedMs(startTime);
+			std::cerr << "Fem::solveNewton(): no convergence after " << m_maxNewtonIterations
+			          << " iterations, relative residual: " << residual / std::max(m_vecFTotal.norm(), initialResidual) << std::endl;
+			return false;
+		}
+
+		// Hessian (same pattern at each iteration), or preconditioner of the matrix-free operator
+		bool success = true;
+		if (m_solverType != eFemSolverType::MATRIX_FREE_CG)
+		{
+			assembleElements<3, 2>([this](int _e, Matrix66d& _He) { _He = m_elementsHessian[_e]; }, m_indices, m_initVertices.size(), true, m_matH);
+		}
+		m_assemblyTime += elapsedMs(startTime);
+
+		startTime = std::chrono::steady_clock::now();
+		if (m_solverType == eFemSolverType::DIRECT)
+		{
+			success = m_solver.factorize(m_matH);
+		}
+		else if (m_solverType == eFemSolverType::CONJUGATE_GRADIENT)
+		{
+			m_CG.compute(m_matH);
+			success = m_CG.info() == Eigen::Success;
+		}
+		else
+		{
+			m_matrixFreeCG.compute(m_operator);
+			success = m_matrixFreeCG.info() == Eigen::Success;
+		}
+		m_factorizeTime += elapsedMs(startTime);
+
+		// Newton step H * du = -g
+		startTime = std::chrono::steady_clock::now();
+		Eigen::VectorXd vecDU = Eigen::VectorXd::Zero(vecGrad.size());
+		success = success && solveSystem(-vecGrad, vecDU);
+		m_solveTime += elapsedMs(startTime);
+		if (!success)
+		{
+			std::cerr << "Fem::solveNewton(): linear solve failed" << std::endl;
+			return false;
+		}
+
+		// backtracking line search (Armijo condition), inverted elements have infinite energy
+		startTime = std::chrono::steady_clock::now();
+		const double slope = vecGrad.dot(vecDU);
+		double step = 1.0;
+		bool isAccepted = false;
+		while (step > 1e-8)
+		{
+			Eigen::VectorXd vecTrialU = m_vecU + step * vecDU;
+			const double trialEnergy = evaluateNeoHookean(vecTrialU, nullptr, false) - m_vecFTotal.dot(vecTrialU);
+			if (trialEnergy <= energy + 1e-4 * step * slope)
+			{
+				m_vecU = vecTrialU;
+				isAccepted = true;
+				break;
+			}
+			step *= 0.5;
+		}
+		m_lineSearchTime += elapsedMs(startTime);
+		m_nbNewtonIterations++;
+
+		if (!isAccepted)
+		{
+			std::cerr << "Fem::solveNewton(): line search failed" << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+void Fem::getRotatedKe(int _e, Matrix66d& _Ke) const
+{
+	Matrix66d tmpKe;
+	const Matrix66d& Ke = getRestKe(_e, tmpKe);
+
+	// R_e * K_e * R_e^T, with R_e = diag(R, R, R): each 2x2 block is rotated
+	const Eigen::Matrix2d& R = m_elementsRot[_e];
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			_Ke.block<2, 2>(2 * i, 2 * j).noalias() = R * Ke.block<2, 2>(2 * i, 2 * j) * R.transpose();
+		}
+	}
+}
+
+
+bool Fem::updateCorotationalSystem(Eigen::VectorXd& _vecRhs)
+{
+	updateRotations();
+
+	// right-hand side: f + R_e * K_e * (X_e - R_e^T * X_e) for each element, with X_e the rest positions
+	const size_t nbTriangles = m_indices.size() / 3;
+	std::vector<Eigen::Matrix<double, 6, 1> > elementsRhs(nbTriangles);
+
+	#pragma omp parallel for
+	for (int tId = 0; tId < (int)nbTriangles; tId++)
+	{
+		const Eigen::Matrix2d& R = m_elementsRot[tId];
+		Eigen::Matrix<double, 6, 1> vecX;
+		Eigen::Matrix<double, 6, 1> vecRotX;
+		for (int i = 0; i < 3; i++)
+		{
+			const glm::vec3& p = m_restVertices[m_indices[tId * 3 + i]];
+			vecX.segment<2>(2 * i) = Eigen::Vector2d(p.x, p.y);
+			vecRotX.segment<2>(2 * i) = vecX.segment<2>(2 * i) - R.transpose() * vecX.segment<2>(2 * i);
+		}
+
+		Matrix66d tmpKe;
+		const Matrix66d& Ke = getRestKe(tId, tmpKe);
+
+		const Eigen::Matrix<double, 6, 1> vecF = Ke * vecRotX;
+		for (int i = 0; i < 3; i++)
+		{
+			elementsRhs[tId].segment<2>(2 * i) = R * vecF.segment<2>(2 * i);
+		}
+	}
+
+	// forces of each frame are load increments (as displacements accumulated by getResult() in linear mode)
+	if (m_vecFTotal.size() != m_vecF.size())
+	{
+		m_vecFTotal = Eigen::VectorXd::Zero(m_vecF.size());
+	}
+	m_vecFTotal += m_vecF;
+
+	_vecRhs = m_vecFTotal;
+	for (size_t tId = 0; tId < nbTriangles; tId++)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			int freeId = m_nodeToFreeId.at(m_indices[tId * 3 + i]);
+			if (freeId >= 0)
+			{
+				_vecRhs.segment<2>(2 * freeId) += elementsRhs[tId].segment<2>(2 * i);
+			}
+		}
+	}
+
+	// rotated K
+	if (m_solverType == eFemSolverType::MATRIX_FREE_CG)
+	{
+		// the operator applies rotated Ke on the fly, only the preconditioner is updated
+		m_matrixFreeCG.compute(m_operator);
+		return m_matrixFreeCG.info() == Eigen::Success;
+	}
+
+	assembleElements<3, 2>([this](int _e, Matrix66d& _Ke) { getRotatedKe(_e, _Ke); }, m_indices, m_initVertices.size(), true, m_matKRot);
+
+	if (m_solverType == eFemSolverType::DIRECT)
+	{
+		// numerical factorization only, the pattern was analyzed by factorizeSystem()
+		return m_solver.factorize(m_matKRot);
+	}
+
+	m_CG.compute(m_matKRot);
+	return m_CG.info() == Eigen::Success;
+}
+
+
+void Fem::buildLumpedMass()
+{
+	// a third of the mass of each triangle on each of its nodes
+	// (quadratic elements: diagonal of the consistent mass matrix, scaled to the mass of the triangle (HRZ lumping),
+	// 3/57 of the mass on each vertex and 16/57 on each edge node)
+	m_vecMass = Eigen::VectorXd::Zero(getNbFreeDofs());
+	const bool isQuadratic = m_elementType == eFemElementType::QUADRATIC_TRIANGLE;
+
+	const size_t nbTriangles = m_indices.size() / 3;
+	for (size_t tId = 0; tId < nbTriangles; tId++)
+	{
+		const glm::vec3& p1 = m_restVertices[m_indices[tId * 3]];
+		const glm::vec3& p2 = m_restVertices[m_indices[tId * 3 + 1]];
+		const glm::vec3& p3 = m_restVertices[m_indices[tId * 3 + 2]];
+		const double area = 0.5 * std::abs(((double)p2.x - p1.x) * ((double)p3.y - p1.y) - ((double)p3.x - p1.x) * ((double)p2.y - p1.y));
+
+		const int nbElementNodes = isQuadratic ? 6 : 3;
+		for (int i = 0; i < nbElementNodes; i++)
+		{
+			int freeId = m_nodeToFreeId.at(isQuadratic ? m_quadraticIndices[tId * 6 + i] : m_indices[tId * 3 + i]);
+			if (freeId >= 0)
+			{
+				const double fraction = !isQuadratic ? 1.0 / 3.0 : (i < 3 ? 3.0 / 57.0 : 16.0 / 57.0);
+				m_vecMass.segment<2>(2 * freeId).array() += m_density * area * fraction;
+			}
+		}
+	}
+}
+
+
+void Fem::getEffectiveCoefficients(double& _coefU, double& _coefV, double& _coefM, double& _coefK) const
+{
+	// u_(n+1) = u_pred + c_u * a_(n+1), v_(n+1) = v_pred + c_v * a_(n+1)
+	if (m_timeIntegration == eFemTimeIntegration::NEWMARK)
+	{
+		_coefU = m_newmarkBeta * m_timeStep * m_timeStep;
+		_coefV = m_newmarkGamma * m_timeStep;
+	}
+	else
+	{
+		_coefU = m_timeStep * m_timeStep;
+		_coefV = m_timeStep;
+	}
+
+	// M * a + (alpha * M + beta * K) * v + K * u = f
+	_coefM = 1.0 + _coefV * m_rayleighAlpha;
+	_coefK = _coefV * m_rayleighBeta + _coefU;
+}
+
+
+void Fem::multiplyK(const Eigen::VectorXd& _x, Eigen::VectorXd& _y) const
+{
+	if (m_solverType == eFemSolverType::MATRIX_FREE_CG)
+	{
+		_y = Eigen::VectorXd::Zero(_x.size());
+		m_operator.multiplyStiffness(_x, _y);
+	}
+	else
+	{
+		_y = m_matK * _x;
+	}
+}
+
+
+bool Fem::solveSystem(const Eigen::VectorXd& _b, Eigen::VectorXd& _x)
+{
+	if (m_solverType == eFemSolverType::DIRECT)
+	{
+		// two triangular solves
+		m_solver.solve(_b, _x);
+		m_nbSolverIterations = 0;
+		m_solverError = 0.0;
+		return true;
+	}
+
+	// warm start from _x
+	Eigen::ComputationInfo info;
+	if (m_solverType == eFemSolverType::MATRIX_FREE_CG)
+	{
+		_x = m_matrixFreeCG.solveWithGuess(_b, _x);
+		info = m_matrixFreeCG.info();
+		m_nbSolverIterations = (unsigned int)m_matrixFreeCG.iterations();
+		m_solverError = m_matrixFreeCG.error();
+	}
+	else
+	{
+		_x = m_CG.solveWithGuess(_b, _x);
+		info = m_CG.info();
+		m_nbSolverIterations = (unsigned int)m_CG.iterations();
+		m_solverError = m_CG.error();
+	}
+
+	std::string computationInfo = info == Eigen::Success ? "Success" : info == Eigen::NumericalIssue ? "NumericalIssue" : "NoConvergence";
+	if (info != Eigen::Success)
+	{
+		std::cerr << "m_CG solve error:       " << computationInfo << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+bool Fem::stepDynamic()
+{
+	const Eigen::Index dimVec = getNbFreeDofs();
+	const double dt = m_timeStep;
+
+	// start from rest, with the acceleration given by the equation of motion
+	if (m_vecV.size() != dimVec || m_vecA.size() != dimVec)
+	{
+		m_vecU = Eigen::VectorXd::Zero(dimVec);
+		m_vecV = Eigen::VectorXd::Zero(dimVec);
+		m_vecA = m_vecF.cwiseQuotient(m_vecMass);
+	}
+
+	// predictors (values at n+1 with a_(n+1) = 0)
+	Eigen::VectorXd vecUPred;
+	Eigen::VectorXd vecVPred;
+	if (m_timeIntegration == eFemTimeIntegration::NEWMARK)
+	{
+		vecUPred = m_vecU + dt * m_vecV + (dt * dt * (0.5 - m_newmarkBeta)) * m_vecA;
+		vecVPred = m_vecV + (dt * (1.0 - m_newmarkGamma)) * m_vecA;
+	}
+	else
+	{
+		vecUPred = m_vecU + dt * m_vecV;
+		vecVPred = m_vecV;
+	}
+
+	// A * a_(n+1) = f - alpha * M * v_pred - K * (u_pred + beta * v_pred)
+	Eigen::VectorXd vecKU;
+	multiplyK(vecUPred + m_rayleighBeta * vecVPred, vecKU);
+	Eigen::VectorXd vecRhs = m_vecF - m_rayleighAlpha * m_vecMass.cwiseProduct(vecVPred) - vecKU;
+
+	// previous acceleration is the initial guess of iterative solvers
+	if (!solveSystem(vecRhs, m_vecA))
+	{
+		return false;
+	}
+
+	double coefU, coefV, coefM, coefK;
+	getEffectiveCoefficients(coefU, coefV, coefM, coefK);
+	m_vecU = vecUPred + coefU * m_vecA;
+	m_vecV = vecVPred + coefV * m_vecA;
+
+	return true;
+}
+
+
+bool Fem::computeModalBasis()
+{
+	buildLumpedMass();
+
+	// without fixed nodes, K is singular (rigid modes): the shift makes K - shift * M SPD
+	const double shift = m_fixedConstraints.empty() ? -1e-6 * m_matK.diagonal().mean() / m_vecMass.mean() : 0.0;
+
+	if (!m_modalCacheFileName.empty() && m_modalBasis.load(m_modalCacheFileName, m_matK, m_vecMass, (int)m_nbModes))
+	{
+		std::cout << "Fem: modes read from " << m_modalCacheFileName << std::endl;
+	}
+	else
+	{
+		auto startTime = std::chrono::steady_clock::now();
+		if (!m_modalBasis.compute(m_matK, m_vecMass, (int)m_nbModes, shift))
+		{
+			std::cerr << "Fem::computeModalBasis(): eigensolver failed" << std::endl;
+			return false;
+		}
+		std::cout << "Fem: modes computed in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count() << " ms" << std::endl;
+
+		if (!m_modalCacheFileName.empty())
+		{
+			m_modalBasis.save(m_modalCacheFileName);
+		}
+	}
+	m_modalBasis.printStats();
+
+	// modal coordinates of the previous basis are meaningless
+	m_vecQ.resize(0);
+	m_vecQV.resize(0);
+	m_vecQA.resize(0);
+	m_isModalBasisDirty = false;
+	return true;
+}
+
+
+bool Fem::stepModal()
+{
+	const Eigen::MatrixXd& matModes = m_modalBasis.getModes();
+	const Eigen::ArrayXd lambdas = m_modalBasis.getEigenvalues().array();
+	const Eigen::Index nbModes = lambdas.size();
+
+	// modal forces Phi^T * f: forces are usually applied on a few nodes, only non-zeros are projected
+	Eigen::VectorXd vecG = Eigen::VectorXd::Zero(nbModes);
+	for (Eigen::Index i = 0; i < m_vecF.size(); i++)
+	{
+		if (m_vecF[i] != 0.0)
+		{
+			vecG += m_vecF[i] * matModes.row(i).transpose();
+		}
+	}
+
+	if (!isDynamic())
+	{
+		// lambda_i * q_i = g_i (modes with lambda ~ 0 are rigid modes, which are not loaded)
+		const double minLambda = 1e-8 * lambdas.abs().maxCoeff();
+		m_vecQ = (lambdas > minLambda).select(vecG.array() / lambdas, 0.0).matrix();
+	}
+	else
+	{
+		const double dt = m_timeStep;
+
+		// start from rest, with the acceleration given by the equation of motion (modal masses are 1)
+		if (m_vecQ.size() != nbModes || m_vecQV.size() != nbModes || m_vecQA.size() != nbModes)
+		{
+			m_vecQ = Eigen::VectorXd::Zero(nbModes);
+			m_vecQV = Eigen::VectorXd::Zero(nbModes);
+			m_vecQA = vecG;
+		}
+
+		// same predictors as stepDynamic()
+		Eigen::ArrayXd qPred;
+		Eigen::ArrayXd qvPred;
+		if (m_timeIntegration == eFemTimeIntegration::NEWMARK)
+		{
+			qPred = m_vecQ.array() + dt * m_vecQV.array() + (dt * dt * (0.5 - m_newmarkBeta)) * m_vecQA.array();
+			qvPred = m_vecQV.array() + (dt * (1.0 - m_newmarkGamma)) * m_vecQA.array();
+		}
+		else
+		{
+			qPred = m_vecQ.array() + dt * m_vecQV.array();
+			qvPred = m_vecQV.array();
+		}
+
+		// (c_M + c_K * lambda_i) * a_i = g_i - (alpha + beta * lambda_i) * qv_pred_i - lambda_i * q_pred_i
+		double coefU, coefV, coefM, coefK;
+		getEffectiveCoefficients(coefU, coefV, coefM, coefK);
+		const Eigen::ArrayXd damping = m_rayleighAlpha + m_rayleighBeta * lambdas;
+		m_vecQA = ((vecG.array() - damping * qvPred - lambdas * qPred) / (coefM + coefK * lambdas)).matrix();
+		m_vecQ = (qPred + coefU * m_vecQA.array()).matrix();
+		m_vecQV = (qvPred + coefV * m_vecQA.array()).matrix();
+	}
+
+	m_vecU = matModes * m_vecQ;
+	m_nbSolverIterations = 0;
+	m_solverError = 0.0;
+	return true;
+}
+
+
+bool Fem::iterate()
+{
+	if (!solveStep())
+	{
+		return false;
+	}
+
+	// output stage: stress field of the solved displacements
+	if (m_isStressOutputEnabled)
+	{
+		computeStressField();
+	}
+	else
+	{
+		m_elementsStress.clear();
+	}
+
+	return true;
+}
+
+
+eFemFormulation Fem::getActiveFormulation() const
+{
+	// precedence of the modes: MODAL > DYNAMIC > NEO_HOOKEAN > COROTATIONAL > LINEAR
+	if (isModalReduced())
+		return eFemFormulation::MODAL;
+	if (isDynamic())
+		return eFemFormulation::DYNAMIC;
+	if (m_material == eFemMaterial::NEO_HOOKEAN)
+		return eFemFormulation::NEO_HOOKEAN;
+	if (m_isCorotational)
+		return eFemFormulation::COROTATIONAL;
+	return eFemFormulation::LINEAR;
+}
+
+
+bool Fem::isDisplacementFromRest() const
+{
+	// linear quasi-static solves (full order or modal) give the increment of the current frame
+	const eFemFormulation formulation = getActiveFormulation();
+	return isDynamic() || (formulation != eFemFormulation::LINEAR && formulation != eFemFormulation::MODAL);
+}
+
+
+bool Fem::solveStep()
+{
+	assert(getNbFreeDofs() == m_vecU.size());
+	assert(getNbFreeDofs() == m_vecF.size());
+
+	if (m_isSystemDirty && !factorizeSystem())
+	{
+		return false;
+	}
+
+	const eFemFormulation formulation = getActiveFormulation();
+	if (formulation == eFemFormulation::MODAL)
+	{
+		return stepModal();
+	}
+
+	if (formulation == eFemFormulation::DYNAMIC)
+	{
+		return stepDynamic();
+	}
+
+	if (formulation == eFemFormulation::NEO_HOOKEAN)
+	{
+		return solveNewton();
+	}
+
+	// corotational mode: K and f depend on the rotations of the current shape
+	const bool isCorotational = formulation == eFemFormulation::COROTATIONAL;
+	Eigen::VectorXd vecCorotF;
+	if (isCorotational && !updateCorotationalSystem(vecCorotF))
+	{
+		std::cerr << "Fem::solveStep(): update of the corotational system failed" << std::endl;
+		return false;
+	}
+	const Eigen::VectorXd& vecF = isCorotational ? vecCorotF : m_vecF;
+
+	// warm start from previous displacements
+	return solveSystem(vecF, m_vecU);
+}
+
+
+Eigen::VectorXd Fem::getTotalDisplacements() const
+{
+	// same cases as getResult(): u is either the displacement from rest, or the increment of the current frame
+	if (isDisplacementFromRest())
+	{
+		return m_vecU;
+	}
+
+	Eigen::VectorXd vecU = m_vecU;
+	for (size_t k = 0; k < m_freeNodes.size(); k++)
+	{
+		const glm::vec3 previousU = m_initVertices[m_freeNodes[k]] - m_restVertices[m_freeNodes[k]];
+		vecU[2 * k] += previousU.x;
+		vecU[2 * k + 1] += previousU.y;
+	}
+	return vecU;
+}
+
+
+void Fem::computeStressField()
+{
+	const size_t nbTriangles = m_indices.size() / 3;
+	m_elementsStress.resize(nbTriangles);
+
+	// same formulation as the solve (see solveStep())
+	const eFemFormulation formulation = getActiveFormulation();
+	const bool isNonlinear = formulation == eFemFormulation::NEO_HOOKEAN;
+	const bool isCorotational = formulation == eFemFormulation::COROTATIONAL;
+
+	const Eigen::VectorXd vecU = getTotalDisplacements();
+	if (isCorotational)
+	{
+		// rotations of the solved displacements
+		updateRotations();
+	}
+
+	#pragma omp parallel for
+	for (int tId = 0; tId < (int)nbTriangles; tId++)
+	{
+		FemElementStress& elementStress = m_elementsStress[tId];
+		double sigmaZZ = 0.0;
+
+		if (isNonlinear)
+		{
+			// Green strain E = (F^T * F - I) / 2, Cauchy stress sigma = (mu * (F * F^T - I) + lambda * log(J) * I) / J
+			const Eigen::Matrix2d F = computeDeformationGradient(tId, vecU);
+			const double J = F.determinant();
+			const Eigen::Matrix2d E = 0.5 * (F.transpose() * F - Eigen::Matrix2d::Identity());
+			const double logJ = J > 0.0 ? std::log(J) : 0.0;
+			const Eigen::Matrix2d sigma = (m_mu * (F * F.transpose() - Eigen::Matrix2d::Identity()) + m_lambda * logJ * Eigen::Matrix2d::Identity()) / J;
+			elementStress.m_strain = Eigen::Vector3d(E(0, 0), E(1, 1), 2.0 * E(0, 1));
+			elementStress.m_stress = Eigen::Vector3d(sigma(0, 0), sigma(1, 1), sigma(0, 1));
+			sigmaZZ = m_lambda * logJ / J;
+		}
+		else if (m_elementType == eFemElementType::QUADRATIC_TRIANGLE)
+		{
+			// linear strain: value at the centroid of the element
+			Matrix312d Be;
+			buildQuadraticBe(Be, tId, Eigen::Vector3d::Constant(1.0 / 3.0));
+
+			Eigen::Matrix<double, 12, 1> ue = Eigen::Matrix<double, 12, 1>::Zero();
+			for (int i = 0; i < 6; i++)
+			{
+				int freeId = m_nodeToFreeId.at(m_quadraticIndices[tId * 6 + i]);
+				if (freeId >= 0)
+				{
+					ue.segment<2>(2 * i) = vecU.segment<2>(2 * freeId);
+				}
+			}
+
+			elementStress.m_strain = Be * ue;
+			elementStress.m_stress = m_matE * elementStress.m_strain;
+			sigmaZZ = m_lambda * (elementStress.m_strain[0] + elementStress.m_strain[1]);
+		}
+		else
+		{
+			const uint32_t* ids = &m_indices[tId * 3];
+			Matrix36d Be;
+			buildBe(Be, ids[0], ids[1], ids[2]);
+
+			// displacements of the element (0 for fixed nodes)
+			Eigen::Matrix<double, 6, 1> ue = Eigen::Matrix<double, 6, 1>::Zero();
+			for (int i = 0; i < 3; i++)
+			{
+				int freeId = m_nodeToFreeId.at(ids[i]);
+				if (freeId >= 0)
+				{
+					ue.segment<2>(2 * i) = vecU.segment<2>(2 * freeId);
+				}
+			}
+
+			if (isCorotational)
+			{
+				// displacements in the rotated frame: R_e^T * x_e - X_e
+				const Eigen::Matrix2d& R = m_elementsRot[tId];
+				for (int i = 0; i < 3; i++)
+				{
+					const Eigen::Vector2d X(m_restVertices[ids[i]].x, m_restVertices[ids[i]].y);
+					ue.segment<2>(2 * i) = R.transpose() * (X + ue.segment<2>(2 * i)) - X;
+				}
+			}
+
+			// strain B_e * u_e, stress E * B_e * u_e
+			elementStress.m_strain = Be * ue;
+			elementStress.m_stress = m_matE * elementStress.m_strain;
+			sigmaZZ = m_lambda * (elementStress.m_strain[0] + elementStress.m_strain[1]);
+
+			if (isCorotational)
+			{
+				// stress back in the world frame: R_e * sigma * R_e^T
+				const Eigen::Matrix2d& R = m_elementsRot[tId];
+				Eigen::Matrix2d sigma;
+				sigma << elementStress.m_stress[0], elementStress.m_stress[2],
+						 elementStress.m_stress[2], elementStress.m_stress[1];
+				sigma = R * sigma * R.transpose();
+				elementStress.m_stress = Eigen::Vector3d(sigma(0, 0), sigma(1, 1), sigma(0, 1));
+			}
+		}
+
+		// von Mises: sqrt(((s_xx - s_yy)^2 + (s_yy - s_zz)^2 + (s_zz - s_xx)^2) / 2 + 3 * s_xy^2)
+		const Eigen::Vector3d& s = elementStress.m_stress;
+		elementStress.m_vonMises = std::sqrt(0.5 * ((s[0] - s[1]) * (s[0] - s[1]) + (s[1] - sigmaZZ) * (s[1] - sigmaZZ) + (sigmaZZ - s[0]) * (sigmaZZ - s[0]))
+		                                     + 3.0 * s[2] * s[2]);
+	}
+}
+
+
+bool Fem::getVerticesVonMises(std::vector<float>& _values) const
+{
+	if (m_elementsStress.size() != m_indices.size() / 3)
+	{
+		std::cerr << "Fem::getVerticesVonMises(): no stress field, see setStressOutput()" << std::endl;
+		return false;
+	}
+
+	std::vector<double> sums(m_restVertices.size(), 0.0);
+	std::vector<double> areas(m_restVertices.size(), 0.0);
+	for (size_t tId = 0; tId < m_elementsStress.size(); tId++)
+	{
+		const glm::vec3& p1 = m_restVertices[m_indices[tId * 3]];
+		const glm::vec3& p2 = m_restVertices[m_indices[tId * 3 + 1]];
+		const glm::vec3& p3 = m_restVertices[m_indices[tId * 3 + 2]];
+		const double area = 0.5 * std::abs(((double)p2.x - p1.x) * ((double)p3.y - p1.y) - ((double)p3.x - p1.x) * ((double)p2.y - p1.y));
+
+		for (int i = 0; i < 3; i++)
+		{
+			sums[m_indices[tId * 3 + i]] += area * m_elementsStress[tId].m_vonMises;
+			areas[m_indices[tId * 3 + i]] += area;
+		}
+	}
+
+	_values.resize(getNbVertices());
+	for (size_t i = 0; i < _values.size(); i++)
+	{
+		_values[i] = areas[i] > 0.0 ? (float)(sums[i] / areas[i]) : 0.0f;
+	}
+	return true;
+}
+
+
+double Fem::estimateErrors(std::vector<double>& _elementsError)
+{
+	const size_t nbTriangles = m_indices.size() / 3;
+	if (m_elementsStress.size() != nbTriangles)
+	{
+		computeStressField();
+	}
+
+	// area of each element
+	std::vector<double> areas(nbTriangles);
+	for (size_t tId = 0; tId < nbTriangles; tId++)
+	{
+		const glm::vec3& p1 = m_restVertices[m_indices[tId * 3]];
+		const glm::vec3& p2 = m_restVertices[m_indices[tId * 3 + 1]];
+		const glm::vec3& p3 = m_restVertices[m_indices[tId * 3 + 2]];
+		areas[tId] = 0.5 * std::abs(((double)p2.x - p1.x) * ((double)p3.y - p1.y) - ((double)p3.x - p1.x) * ((double)p2.y - p1.y));
+	}
+
+	// 1. recovered stress sigma* of each node: area-weighted mean of the stresses of its elements
+	std::vector<Eigen::Vector3d> nodesStress(m_restVertices.size(), Eigen::Vector3d::Zero());
+	std::vector<double> nodesArea(m_restVertices.size(), 0.0);
+	for (size_t tId = 0; tId < nbTriangles; tId++)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			nodesStress[m_indices[tId * 3 + i]] += areas[tId] * m_elementsStress[tId].m_stress;
+			nodesArea[m_indices[tId * 3 + i]] += areas[tId];
+		}
+	}
+	for (size_t i = 0; i < nodesStress.size(); i++)
+	{
+		if (nodesArea[i] > 0.0)
+		{
+			nodesStress[i] /= nodesArea[i];
+		}
+	}
+
+	// 2. eta_e^2 = int_e (sigma* - sigma_h)^T * E^-1 * (sigma* - sigma_h), with sigma* linear and sigma_h constant on e:
+	//    int_e d^T * C * d = A_e / 12 * (sum_i d_i^T * C * d_i + (sum_i d_i)^T * C * (sum_i d_i))
+	const Eigen::Matrix3d matC = m_matE.inverse();
+	_elementsError.resize(nbTriangles);
+	double errorSquared = 0.0;
+	double energySquared = 0.0;
+
+	#pragma omp parallel for reduction(+:errorSquared, energySquared)
+	for (int tId = 0; tId < (int)nbTriangles; tId++)
+	{
+		const Eigen::Vector3d& sigma = m_elementsStress[tId].m_stress;
+		Eigen::Vector3d sumD = Eigen::Vector3d::Zero();
+		double sumDCD = 0.0;
+		for (int i = 0; i < 3; i++)
+		{
+			const Eigen::Vector3d d = nodesStress[m_indices[tId * 3 + i]] - sigma;
+			sumD += d;
+			sumDCD += d.dot(matC * d);
+		}
+		const double etaSquared = areas[tId] / 12.0 * (sumDCD + sumD.dot(matC * sumD));
+
+		_elementsError[tId] = std::sqrt(std::max(etaSquared, 0.0));
+		errorSquared += etaSquared;
+		energySquared += areas[tId] * sigma.dot(matC * sigma);
+	}
+
+	m_relativeError = errorSquared + energySquared > 0.0 ? std::sqrt(errorSquared / (errorSquared + energySquared)) : 0.0;
+	return m_relativeError;
+}
+
+
+void Fem::refineElements(const std::vector<uint32_t>& _elements)
+{
+	if (m_elementType == eFemElementType::QUADRATIC_TRIANGLE)
+	{
+		std::cerr << "Fem::refineElements(): only available with linear elements" << std::endl;
+		return;
+	}
+
+	const size_t nbTriangles = m_indices.size() / 3;
+	const size_t nbOldVertices = m_restVertices.size();
+
+	auto edgeKey = [](uint32_t _a, uint32_t _b) { return _a < _b ? ((uint64_t)_a << 32) | _b : ((uint64_t)_b << 32) | _a; };
+
+	// local index i of the longest edge (i, i+1) of element _t (ties broken by vertex ids, for determinism)
+	auto longestEdge = [&](size_t _t)
+	{
+		int longest = 0;
+		double maxLength = -1.0;
+		uint64_t maxKey = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			uint32_t a = m_indices[_t * 3 + i];
+			uint32_t b = m_indices[_t * 3 + (i + 1) % 3];
+			const double length = glm::length(m_restVertices[b] - m_restVertices[a]);
+			if (length > maxLength || (length == maxLength && edgeKey(a, b) < maxKey))
+			{
+				longest = i;
+				maxLength = length;
+				maxKey = edgeKey(a, b);
+			}
+		}
+		return longest;
+	};
+
+	// elements of each edge
+	std::unordered_map<uint64_t, std::vector<uint32_t> > edgeElements;
+	edgeElements.reserve(2 * nbTriangles);
+	for (size_t tId = 0; tId < nbTriangles; tId++)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			edgeElements[edgeKey(m_indices[tId * 3 + i], m_indices[tId * 3 + (i + 1) % 3])].push_back((uint32_t)tId);
+		}
+	}
+
+	// 1. split edges: longest edge of each marked element, and closure:
+	//    an element with a split edge also splits its longest edge, so each element is cut into 2, 3 or 4 conforming children
+	std::unordered_map<uint64_t, uint32_t> midpoints;
+	std::vector<uint32_t> stack;
+	auto splitEdge = [&](uint32_t _t)
+	{
+		int l = longestEdge(_t);
+		uint64_t key = edgeKey(m_indices[_t * 3 + l], m_indices[_t * 3 + (l + 1) % 3]);
+		if (midpoints.emplace(key, 0).second)
+		{
+			stack.insert(stack.end(), edgeElements[key].begin(), edgeElements[key].end());
+		}
+	};
+	for (auto it = _elements.begin(); it != _elements.end(); ++it)
+	{
+		splitEdge(*it);
+	}
+	while (!stack.empty())
+	{
+		uint32_t tId = stack.back();
+		stack.pop_back();
+		splitEdge(tId);
+	}
+
+	// 2. midpoint vertices, appended in a deterministic order;
+	//    the midpoint of 2 fixed nodes is fixed (e.g., on a clamped boundary)
+	std::vector<uint64_t> splitKeys;
+	splitKeys.reserve(midpoints.size());
+	for (auto it = midpoints.begin(); it != midpoints.end(); ++it)
+	{
+		splitKeys.push_back(it->first);
+	}
+	std::sort(splitKeys.begin(), splitKeys.end());
+
+	const std::vector<int> oldNodeToFreeId = m_nodeToFreeId;
+	std::vector<std::pair<uint32_t, uint32_t> > midpointsEdge;
+	midpointsEdge.reserve(splitKeys.size());
+	for (auto it = splitKeys.begin(); it != splitKeys.end(); ++it)
+	{
+		uint32_t a = (uint32_t)(*it >> 32);
+		uint32_t b = (uint32_t)(*it & 0xFFFFFFFF);
+		uint32_t id = (uint32_t)m_restVertices.size();
+		midpoints[*it] = id;
+		midpointsEdge.push_back(std::make_pair(a, b));
+
+		m_restVertices.push_back(0.5f * (m_restVertices[a] + m_restVertices[b]));
+		m_initVertices.push_back(0.5f * (m_initVertices[a] + m_initVertices[b]));
+		if (oldNodeToFreeId.at(a) < 0 && oldNodeToFreeId.at(b) < 0)
+		{
+			m_fixedConstraints.push_back(id);
+		}
+	}
+
+	// 3. bisection of each element with split edges: the first child replaces its parent, others are appended
+	auto midpoint = [&](uint32_t _a, uint32_t _b) -> int
+	{
+		auto it = midpoints.find(edgeKey(_a, _b));
+		return it == midpoints.end() ? -1 : (int)it->second;
+	};
+
+	std::vector<uint32_t> changedElements;
+	std::vector<std::array<uint32_t, 3> > removedElements;
+	for (size_t tId = 0; tId < nbTriangles; tId++)
+	{
+		// vertices (r0, r1, r2), with (r0, r1) the longest edge
+		int l = longestEdge(tId);
+		const uint32_t r0 = m_indices[tId * 3 + l];
+		const uint32_t r1 = m_indices[tId * 3 + (l + 1) % 3];
+		const uint32_t r2 = m_indices[tId * 3 + (l + 2) % 3];
+		const int m = midpoint(r0, r1);
+		if (m < 0)
+			continue;
+
+		removedElements.push_back({ m_indices[tId * 3], m_indices[tId * 3 + 1], m_indices[tId * 3 + 2] });
+
+		// children (r0, m, r2) and (m, r1, r2), each one bisected again if its other edge is split
+		std::vector<std::array<uint32_t, 3> > children;
+		const int q = midpoint(r2, r0);
+		if (q < 0)
+		{
+			children.push_back({ r0, (uint32_t)m, r2 });
+		}
+		else
+		{
+			children.push_back({ r0, (uint32_t)m, (uint32_t)q });
+			children.push_back({ (uint32_t)q, (uint32_t)m, r2 });
+		}
+		const int p = midpoint(r1, r2);
+		if (p < 0)
+		{
+			children.push_back({ (uint32_t)m, r1, r2 });
+		}
+		else
+		{
+			children.push_back({ (uint32_t)m, r1, (uint32_t)p });
+			children.push_back({ (uint32_t)m, (uint32_t)p, r2 });
+		}
+
+		std::copy(children[0].begin(), children[0].end(), m_indices.begin() + tId * 3);
+		changedElements.push_back((uint32_t)tId);
+		for (size_t c = 1; c < children.size(); c++)
+		{
+			changedElements.push_back((uint32_t)(m_indices.size() / 3));
+			m_indices.insert(m_indices.end(), children[c].begin(), children[c].end());
+		}
+	}
+
+	// 4. incremental update of the full K: - K_e of removed elements + K_e of new elements
+	if (m_matKFull.rows() > 0)
+	{
+		std::vector<Eigen::Triplet<double> > triplets;
+		triplets.reserve(36 * (removedElements.size() + changedElements.size()));
+		auto addKe = [&triplets, this](const uint32_t* _ids, double _sign)
+		{
+			Matrix66d Ke;
+			buildKe(Ke, _ids[0], _ids[1], _ids[2]);
+			for (int i = 0; i < 3; i++)
+			{
+				for (int j = 0; j < 3; j++)
+				{
+					for (int x = 0; x < 2; x++)
+					{
+						for (int y = 0; y < 2; y++)
+						{
+							triplets.push_back(Eigen::Triplet<double>(2 * _ids[i] + x, 2 * _ids[j] + y, _sign * Ke(i * 2 + x, j * 2 + y)));
+						}
+					}
+				}
+			}
+		};
+		for (auto it = removedElements.begin(); it != removedElements.end(); ++it)
+		{
+			addKe(it->data(), -1.0);
+		}
+		for (auto it = changedElements.begin(); it != changedElements.end(); ++it)
+		{
+			addKe(&m_indices[*it * 3], 1.0);
+		}
+
+		const Eigen::Index matDim = 2 * (Eigen::Index)m_restVertices.size();
+		Eigen::SparseMatrix<double> matDeltaK(matDim, matDim);
+		matDeltaK.setFromTriplets(triplets.begin(), triplets.end());
+		m_matKFull.conservativeResize(matDim, matDim);
+		m_matKFull += matDeltaK;
+
+		// couplings of the split edges cancel out
+		m_matKFull.prune(m_matKFull.diagonal().cwiseAbs().maxCoeff(), 1e-12);
+	}
+
+	// 5. reduced system, and vectors of non-fixed dofs: forces are kept on their nodes,
+	//    displacements of midpoints are interpolated
+	const std::vector<uint32_t> oldFreeNodes = m_freeNodes;
+	setBoundaryConditionsFixed();
+
+	auto remap = [&](const Eigen::VectorXd& _vecOld, bool _interpolate)
+	{
+		Eigen::VectorXd vecNew = Eigen::VectorXd::Zero(getNbFreeDofs());
+		if (_vecOld.size() != 2 * (Eigen::Index)oldFreeNodes.size())
+			return vecNew;
+
+		auto oldValue = [&](uint32_t _node) -> Eigen::Vector2d
+		{
+			int oldId = oldNodeToFreeId.at(_node);
+			return oldId >= 0 ? Eigen::Vector2d(_vecOld.segment<2>(2 * oldId)) : Eigen::Vector2d::Zero();
+		};
+		for (size_t k = 0; k < m_freeNodes.size(); k++)
+		{
+			uint32_t node = m_freeNodes[k];
+			if (node < nbOldVertices)
+			{
+				vecNew.segment<2>(2 * k) = oldValue(node);
+			}
+			else if (_interpolate)
+			{
+				const std::pair<uint32_t, uint32_t>& edge = midpointsEdge[node - nbOldVertices];
+				vecNew.segment<2>(2 * k) = 0.5 * (oldValue(edge.first) + oldValue(edge.second));
+			}
+		}
+		return vecNew;
+	};
+	m_vecU = remap(m_vecU, true);
+	m_vecF = remap(m_vecF, false);
+	m_vecFTotal = remap(m_vecFTotal, false);
+
+	// dynamic state and stress field of the previous mesh
+	m_vecV.resize(0);
+	m_vecA.resize(0);
+	m_elementsStress.clear();
+}
+
+
+bool Fem::solveAdaptive(unsigned int _maxRefinements, double _refineFraction, double _targetError)
+{
+	const eFemFormulation formulation = getActiveFormulation();
+	if (formulation == eFemFormulation::MODAL || formulation == eFemFormulation::DYNAMIC || m_elementType == eFemElementType::QUADRATIC_TRIANGLE)
+	{
+		std::cerr << "Fem::solveAdaptive(): only available in quasi-static, full-order mode, with linear elements" << std::endl;
+		return false;
+	}
+
+	std::vector<double> elementsError;
+	for (unsigned int r = 0; ; r++)
+	{
+		if (!solveStep())
+		{
+			return false;
+		}
+		computeStressField();
+		estimateErrors(elementsError);
+
+		const size_t nbTriangles = m_indices.size() / 3;
+		std::cout << "Fem::solveAdaptive(): " << nbTriangles << " elements, " << getNbFreeDofs()
+		          << " dofs, relative error: " << m_relativeError << std::endl;
+
+		if (r >= _maxRefinements || m_relativeError <= _targetError)
+			break;
+
+		// elements with the largest errors
+		const size_t nbMarked = std::min(nbTriangles, std::max<size_t>(1, (size_t)(_refineFraction * (double)nbTriangles)));
+		std::vector<uint32_t> elements(nbTriangles);
+		std::iota(elements.begin(), elements.end(), 0);
+		std::nth_element(elements.begin(), elements.begin() + (nbMarked - 1), elements.end(),
+						 [&elementsError](uint32_t _a, uint32_t _b) { return elementsError[_a] > elementsError[_b]; });
+		elements.resize(nbMarked);
+
+		refineElements(elements);
+	}
+
+	if (!m_isStressOutputEnabled)
+	{
+		m_elementsStress.clear();
+	}
+	return true;
+}
+
+
+bool Fem::solveLoadCases(const Eigen::MatrixXd& _matF, Eigen::MatrixXd& _matU)
+{
+	if (getActiveFormulation() != eFemFormulation::LINEAR)
+	{
+		std::cerr << "Fem::solveLoadCases(): only available in linear quasi-static mode" << std::endl;
+		return false;
+	}
+
+	const Eigen::Index nbFreeDofs = getNbFreeDofs();
+	const Eigen::Index nbDofs = 2 * (Eigen::Index)m_initVertices.size();
+	const bool isFullLayout = _matF.rows() == nbDofs;
+	if (!isFullLayout && _matF.rows() != nbFreeDofs)
+	{
+		std::cerr << "Fem::solveLoadCases(): forces must have " << nbDofs << " or " << nbFreeDofs << " rows" << std::endl;
+		return false;
+	}
+
+	if (m_isSystemDirty && !factorizeSystem())
+	{
+		return false;
+	}
+
+	// forces of non-fixed nodes
+	Eigen::MatrixXd matB;
+	if (isFullLayout)
+	{
+		matB.resize(nbFreeDofs, _matF.cols());
+		for (size_t k = 0; k < m_freeNodes.size(); k++)
+		{
+			matB.middleRows<2>(2 * k) = _matF.middleRows<2>(2 * m_freeNodes[k]);
+		}
+	}
+	const Eigen::MatrixXd& matF = isFullLayout ? matB : _matF;
+
+	Eigen::MatrixXd matX = Eigen::MatrixXd::Zero(nbFreeDofs, _matF.cols());
+	Eigen::ComputationInfo info = Eigen::Success;
+	if (m_solverType == eFemSolverType::DIRECT)
+	{
+		// all columns in one substitution through the factor
+		m_solver.solveBlock(matF, matX);
+	}
+	else if (m_solverType == eFemSolverType::CONJUGATE_GRADIENT)
+	{
+		// one conjugate gradient per column, with the same preconditioner
+		matX = m_CG.solve(matF);
+		info = m_CG.info();
+	}
+	else
+	{
+		matX = m_matrixFreeCG.solve(matF);
+		info = m_matrixFreeCG.info();
+	}
+
+	if (info != Eigen::Success)
+	{
+		std::cerr << "Fem::solveLoadCases(): conjugate gradient did not converge" << std::endl;
+		return false;
+	}
+
+	if (isFullLayout)
+	{
+		_matU = Eigen::MatrixXd::Zero(nbDofs, _matF.cols());
+		for (size_t k = 0; k < m_freeNodes.size(); k++)
+		{
+			_matU.middleRows<2>(2 * m_freeNodes[k]) = matX.middleRows<2>(2 * k);
+		}
+	}
+	else
+	{
+		_matU = matX;
+	}
+
+	return true;
+}
+
+
+void Fem::printStats() const
+{
+	const eFemFormulation formulation = getActiveFormulation();
+	if (formulation == eFemFormulation::MODAL)
+	{
+		std::cout << "Fem: reduced-order mode, " << m_modalBasis.getNbModes() << " modes of " << getNbFreeDofs() << " dofs" << std::endl;
+		return;
+	}
+
+	if (formulation == eFemFormulation::NEO_HOOKEAN)
+	{
+		std::cout << "Fem: Neo-Hookean, #Newton iterations: " << m_nbNewtonIterations
+		          << ", assembly: " << m_assemblyTime << " ms, factorization: " << m_factorizeTime
+		          << " ms, solve: " << m_solveTime << " ms, line search: " << m_lineSearchTime << " ms" << std::endl;
+	}
+
+	eFemPreconditioner activePreconditioner = m_solverType == eFemSolverType::MATRIX_FREE_CG ? m_matrixFreeCG.preconditioner().getActiveType() 
+	                                                                                          : m_CG.preconditioner().getActiveType();
+	std::cout << "Fem: " << getNbFreeDofs() << " dofs";
+	printSolverStats(activePreconditioner);
+
+	if (m_solverType == eFemSolverType::MATRIX_FREE_CG)
+	{
+		std::cout << "FemOperator: " << m_operator.getNbColors() << " colors"
+		          << (m_operator.isCachingKe() ? ", cached Ke" : ", Ke computed on the fly") << std::endl;
+	}
+}
+
+
+bool Fem::getResult(std::vector<glm::vec3>& _res)
+{
+    _res.clear();
+
+	if (isDisplacementFromRest())
+	{
+		// u is the displacement from the rest shape: no accumulation
+		_res = m_restVertices;
+		for (size_t k = 0; k < m_freeNodes.size(); k++)
+		{
+			uint32_t idNode = m_freeNodes.at(k);
+			_res.at(idNode) += glm::vec3(m_vecU[2 * k], m_vecU[2 * k + 1], 0.0f);
+		}
+		m_initVertices = _res;
+		_res.resize(getNbVertices());
+		return true;
+	}
+
+	// init result with original positions
+	_res = m_initVertices;
+
+	// update position of moving nodes
+	for (size_t k = 0; k < m_freeNodes.size(); k++)
+	{
+		uint32_t idNode = m_freeNodes.at(k);
+
+		glm::vec3 displacement(m_vecU[2 * k], m_vecU[2 * k + 1], 0.0f);
+
+		_res.at(idNode) = m_initVertices.at(idNode) + displacement;
+		m_initVertices.at(idNode) = _res.at(idNode);
+	}
+
+	// edge nodes of quadratic elements are not returned
+	_res.resize(getNbVertices());
 	return true;
 }
 	
@@ -10,7 +10,13 @@
 #ifndef FEM_H
 #define FEM_H
 
-#include "dynamicalmodel.h"
+#include "femmodel.h"
+#include "sparsesolver.h"
+#include "femoperator.h"
+#include "fempreconditioner.h"
+#include "modalbasis.h"
+
+#include <string>
 
 #include <Eigen/Core>
 #include <Eigen/Sparse>
@@ -21,6 +27,57 @@
 namespace CompGeom
 {
 
+    /*!
+     * Time integration of M * a + C * v + K * u = f
+     */
+    enum class eFemTimeIntegration
+    {
+        QUASI_STATIC,       /* no inertia, K * u = f is solved at each iterate() */
+        BACKWARD_EULER,     /* implicit Euler, first order, numerically dissipative */
+        NEWMARK             /* Newmark-beta (average acceleration by default: second order, no numerical dissipation) */
+    };
+
+    /*!
+     * Material models
+     */
+    enum class eFemMaterial
+    {
+        LINEAR,             /* linear elasticity (small strains), optionally corotational */
+        NEO_HOOKEAN         /* compressible Neo-Hookean hyperelasticity, solved with Newton's method */
+    };
+
+    /*!
+     * Finite elements
+     */
+    enum class eFemElementType
+    {
+        LINEAR_TRIANGLE,    /* P1: 3 nodes, constant strain */
+        QUADRATIC_TRIANGLE  /* P2: 6 nodes (vertices and edge midpoints), linear strain */
+    };
+
+    /*!
+     * Formulation actually solved, from the selected modes (see Fem::getActiveFormulation())
+     */
+    enum class eFemFormulation
+    {
+        LINEAR,             /* linear quasi-static */
+        COROTATIONAL,       /* corotational linear quasi-static */
+        NEO_HOOKEAN,        /* Newton's method on the Neo-Hookean energy, quasi-static */
+        DYNAMIC,            /* implicit time stepping of the linear K */
+        MODAL               /* reduced-order mode, quasi-static or dynamic */
+    };
+
+    /*!
+     * Strain and stress of an element, in Voigt notation (xx, yy, xy), and von Mises equivalent stress
+     * (plane strain: the out-of-plane stress is included in von Mises)
+     */
+    struct FemElementStress
+    {
+        Eigen::Vector3d m_strain;   /*!< eps_xx, eps_yy, gamma_xy (small strain, or Green strain for NEO_HOOKEAN) */
+        Eigen::Vector3d m_stress;   /*!< sigma_xx, sigma_yy, sigma_xy (Cauchy stress) */
+        double m_vonMises;          /*!< von Mises stress */
+    };
+
 /*!
 * \class Fem
 * \brief Finite-Element Method 2D
@@ -42,11 +99,49 @@ namespace CompGeom
 * Finally, we can build the large, sparse linear system:
 * K * u = f
 *
+* In dynamic mode, M * a + C * v + K * u = f is integrated in time, with M the lumped mass matrix
+* and C = alpha * M + beta * K the Rayleigh damping. Each implicit step solves A * a_(n+1) = r,
+* where the effective matrix A = (1 + c_v * alpha) * M + (c_v * beta + c_u) * K only depends on the time step,
+* so it is factorized once (c_u = dt^2, c_v = dt for backward Euler; c_u = beta_N * dt^2, c_v = gamma_N * dt for Newmark).
+*
+* With the NEO_HOOKEAN material, the energy of an element is V_e * W(F), with F the deformation gradient and
+* W(F) = mu / 2 * (tr(F^T * F) - 2) - mu * log(J) + lambda / 2 * log(J)^2, J = det(F),
+* and the equilibrium (minimum of the total energy) is found with Newton's method: the Hessian is assembled
+* from per-element Hessians projected to SPD, and each step is followed by a backtracking line search.
+*
+* In corotational mode, the rotation R_e of each element is extracted from its deformation gradient,
+* and the element is linearized in its rotated frame: K_e is replaced by R_e * K_e * R_e^T
+* and f_e by f_e + R_e * K_e * (X_e - R_e^T * X_e), with X_e the rest positions,
+* and u is the total displacement from the rest shape (large rotations do not distort the mesh).
+*
+* In reduced-order (modal) mode, u = Phi * q is restricted to the k lowest modes Phi of K * phi = lambda * M * phi,
+* computed once (see ModalBasis) and optionally cached in a file. The modes are M-orthonormal, so the system
+* is diagonal in modal space: lambda_i * q_i = phi_i^T * f in quasi-static mode, and k independent oscillators
+* q_i'' + (alpha + beta * lambda_i) * q_i' + lambda_i * q_i = phi_i^T * f in dynamic mode, integrated with the same scheme.
+* A step then costs O(k) instead of a sparse solve, plus the projection of the forces and the expansion of u.
+*
+* With QUADRATIC_TRIANGLE elements, a node is added in the middle of each edge (numbered after the vertices),
+* shape functions are quadratic: N_i = L_i * (2 * L_i - 1) on vertices, N_ij = 4 * L_i * L_j on edges (L_i area coordinates),
+* and K_e is integrated with a 3-point Gauss quadrature (exact, as B_e is linear on straight-sided triangles).
+* Edge nodes are internal: getResult() only returns the vertices.
+*
+* Adaptive refinement (quasi-static mode) alternates solves, Zienkiewicz-Zhu error estimates and refinements:
+* the error of element e is the energy norm of sigma* - sigma_h, with sigma_h the (constant) stress of the element
+* and sigma* the recovered stress, interpolated from the area-weighted mean of the stresses around each node.
+* The worst elements are refined by longest-edge bisection, with a closure which keeps the mesh conforming,
+* new vertices are appended (existing vertex ids are kept), and K is only updated with the changed elements.
+*
 */
-class Fem : public DynamicalModel
+class Fem : public FemModel
 {
-    // Conjugate gradient solver
-    typedef Eigen::ConjugateGradient<Eigen::MatrixXd, Eigen::Lower|Eigen::Upper> FemCG;
+    // Conjugate gradient solver on the matrix-free operator
+    typedef Eigen::ConjugateGradient<FemOperator, Eigen::Lower|Eigen::Upper, FemPreconditioner> FemMatrixFreeCG;
+
+    // Fixed-size element matrices
+    typedef Eigen::Matrix<double, 3, 6> Matrix36d;
+    typedef Eigen::Matrix<double, 6, 6> Matrix66d;
+    typedef Eigen::Matrix<double, 3, 12> Matrix312d;
+    typedef Eigen::Matrix<double, 12, 12> Matrix1212d;
 
 public:
 
@@ -58,7 +153,7 @@ public:
     * \fn Fem
     * \brief Default constructor
     */
-    Fem() = default;
+    Fem() : FemModel(2) {}
 
 
     /*!
@@ -72,7 +167,170 @@ public:
     |                                     GETTERS / SETTERS                                         |
     +-----------------------------------------------------------------------------------------------*/
 
-    
+    /*!
+    * \fn setSolverType
+    * \brief Selects the solver of the global system (K is factorized again at next iterate())
+    */
+    void setSolverType(eFemSolverType _solverType);
+
+    /*!
+    * \fn setLevelScheduling
+    * \brief In DIRECT mode, solves with the level-scheduled triangular solver (rows of a level are solved in parallel)
+    */
+    inline void setLevelScheduling(bool _useLevelScheduling) { m_solver.setLevelScheduling(_useLevelScheduling); }
+
+    /*!
+    * \fn setElementsKeCaching
+    * \brief In MATRIX_FREE_CG mode, stores all element stiffness matrices (true), or recomputes them at each product (false)
+    */
+    inline void setElementsKeCaching(bool _cacheElementsKe) { m_cacheElementsKe = _cacheElementsKe; m_isSystemDirty = true; }
+
+    /*!
+    * \fn setPreconditioner
+    * \brief Selects the preconditioner of the conjugate gradient (CONJUGATE_GRADIENT and MATRIX_FREE_CG modes)
+    */
+    void setPreconditioner(eFemPreconditioner _preconditioner) override;
+
+    /*!
+    * \fn setSolverTolerance
+    * \brief Sets the relative residual tolerance and the max number of iterations of both conjugate gradients (0 = 2 * size)
+    */
+    void setSolverTolerance(double _tolerance, unsigned int _maxIterations = 0) override;
+
+    /*!
+    * \fn setElementType
+    * \brief Selects linear or quadratic elements (before initialize()). Quadratic elements are solved
+    *        with the linear material only, and with CONJUGATE_GRADIENT instead of MATRIX_FREE_CG
+    */
+    void setElementType(eFemElementType _elementType);
+
+    /*!
+    * \fn getElementType
+    */
+    inline eFemElementType getElementType() const { return m_elementType; }
+
+    /*!
+    * \fn getNbVertices
+    * \brief Returns the number of vertices of the mesh (nodes without edge nodes)
+    */
+    inline size_t getNbVertices() const { return m_restVertices.size() - m_edgeNodes.size(); }
+
+    /*!
+    * \fn getIndices
+    * \brief Returns the vertex indices of the elements (3 per triangle), which change with adaptive refinement
+    */
+    inline const std::vector<uint32_t>& getIndices() const { return m_indices; }
+
+    /*!
+    * \fn getRelativeError
+    * \brief Returns the relative error estimated by the last estimateErrors()
+    */
+    inline double getRelativeError() const { return m_relativeError; }
+
+    /*!
+    * \fn setTimeIntegration
+    * \brief Selects quasi-static or dynamic mode, and the time step (the effective matrix is factorized again at next iterate())
+    */
+    void setTimeIntegration(eFemTimeIntegration _timeIntegration, double _timeStep = 0.01);
+
+    /*!
+    * \fn getTimeIntegration
+    */
+    inline eFemTimeIntegration getTimeIntegration() const { return m_timeIntegration; }
+
+    /*!
+    * \fn isDynamic
+    */
+    inline bool isDynamic() const { return m_timeIntegration != eFemTimeIntegration::QUASI_STATIC; }
+
+    /*!
+    * \fn setRayleighDamping
+    * \brief Sets the damping matrix C = _alpha * M + _beta * K
+    */
+    void setRayleighDamping(double _alpha, double _beta);
+
+    /*!
+    * \fn setNewmarkParameters
+    * \brief Sets beta and gamma of the Newmark scheme (default: 0.25, 0.5, unconditionally stable for gamma >= 0.5, beta >= gamma / 2)
+    */
+    void setNewmarkParameters(double _beta, double _gamma);
+
+    /*!
+    * \fn setDensity
+    * \brief Sets the mass per unit area, used to build the lumped mass matrix
+    */
+    void setDensity(double _density);
+
+    /*!
+    * \fn setMaterial
+    * \brief Selects the material model (quasi-static mode only)
+    */
+    void setMaterial(eFemMaterial _material);
+
+    /*!
+    * \fn getMaterial
+    */
+    inline eFemMaterial getMaterial() const { return m_material; }
+
+    /*!
+    * \fn setNewtonParameters
+    * \brief Sets the max number of Newton iterations per iterate(), and the tolerance on the norm of the residual forces
+    *        (relative to the norm of the external forces)
+    */
+    inline void setNewtonParameters(unsigned int _maxIterations, double _tolerance) { m_maxNewtonIterations = _maxIterations; m_newtonTolerance = _tolerance; }
+
+    /*!
+    * \fn getNbNewtonIterations
+    * \brief Returns the number of Newton iterations of the last iterate()
+    */
+    inline unsigned int getNbNewtonIterations() const { return m_nbNewtonIterations; }
+
+    /*!
+    * \fn hasNewtonConverged
+    * \brief Returns true if the last iterate() reached the Newton tolerance (false if stopped by the max number of iterations)
+    */
+    inline bool hasNewtonConverged() const { return m_hasNewtonConverged; }
+
+    /*!
+    * \fn setCorotational
+    * \brief Enables the corotational formulation (K is rotated per element and solved again at each iterate())
+    */
+    void setCorotational(bool _isCorotational);
+
+    /*!
+    * \fn isCorotational
+    */
+    inline bool isCorotational() const { return m_isCorotational; }
+
+    /*!
+    * \fn setModalReduction
+    * \brief Enables the reduced-order mode with the _nbModes lowest modes (0 = full order, linear material only).
+    *        Modes are read from _cacheFileName if it matches the current system, otherwise computed and written to it
+    */
+    void setModalReduction(unsigned int _nbModes, const std::string& _cacheFileName = "");
+
+    /*!
+    * \fn isModalReduced
+    */
+    inline bool isModalReduced() const { return m_nbModes > 0; }
+
+    /*!
+    * \fn getModalBasis
+    */
+    inline const ModalBasis& getModalBasis() const { return m_modalBasis; }
+
+    /*!
+    * \fn setStressOutput
+    * \brief Enables the computation of the strain and stress of each element after each iterate()
+    */
+    inline void setStressOutput(bool _isStressOutputEnabled) { m_isStressOutputEnabled = _isStressOutputEnabled; }
+
+    /*!
+    * \fn getElementsStress
+    * \brief Returns strain and stress of each element after the last iterate(), in one contiguous array (empty if disabled)
+    */
+    inline const std::vector<FemElementStress>& getElementsStress() const { return m_elementsStress; }
+
 
     /*----------------------------------------------------------------------------------------------+
     |                                        MISCELLANEOUS                                          |
@@ -104,17 +362,13 @@ public:
 
     void addConstraints(std::vector<uint32_t>& _fixedConstraints, std::vector<std::pair<uint32_t, glm::vec3> > _movingConstraint);
 
-    /*!
-    * \fn buildPe
-    * \brief Builds the barycentric matrix for a triangle with vertices _i1, _i2, and _i3
-    */
-    void buildPe(Eigen::Matrix3d& _Pe, int _i1, int _i2, int _i3);
-	
     /*!
     * \fn buildBe
-    * \brief Builds the displacement-deformation matrix
+    * \brief Builds the displacement-deformation matrix for a triangle with vertices _i1, _i2, and _i3,
+    *        from the closed-form gradients of its linear shape functions
+    * \return : area of the triangle
     */
-    void buildBe(Eigen::MatrixXd& _Be, const Eigen::Matrix3d& _Pe);
+    double buildBe(Matrix36d& _Be, int _i1, int _i2, int _i3) const;
 
     /*!
     * \fn buildE
@@ -126,14 +380,40 @@ public:
     * \fn buildKe
     * \brief Builds the stiffness matrix for a triangle with vertices _i1, _i2, and _i3
     */
-    void buildKe(Eigen::MatrixXd& _Ke, int _i1, int _i2, int _i3);
+    void buildKe(Matrix66d& _Ke, int _i1, int _i2, int _i3) const;
 	
     /*!
     * \fn assembleK
-    * \brief Builds the global stiffness matrix
+    * \brief Builds the global (sparse) stiffness matrix from the elements' stiffness matrices
     */
     void assembleK();
 
+    /*!
+    * \fn buildQuadraticNodes
+    * \brief Adds a node in the middle of each edge, and builds the 6 nodes of each element
+    */
+    void buildQuadraticNodes();
+
+    /*!
+    * \fn buildQuadraticBe
+    * \brief Builds the displacement deformation matrix of quadratic element _e at area coordinates _L
+    * \return : area of the element
+    */
+    double buildQuadraticBe(Matrix312d& _Be, int _e, const Eigen::Vector3d& _L) const;
+
+    /*!
+    * \fn buildQuadraticKe
+    * \brief Builds the stiffness matrix of quadratic element _e (3-point Gauss quadrature)
+    */
+    void buildQuadraticKe(Matrix1212d& _Ke, int _e) const;
+
+    /*!
+    * \fn buildDofMap
+    * \brief Builds the index of each node in the reduced system, without fixed nodes
+    *        (and without edge nodes of quadratic elements between 2 fixed vertices)
+    */
+    void buildDofMap();
+
     /*!
     * \fn setBoundaryConditionsFixed
     * \brief Eliminates the rows and columns corresponding to fixed Vertices
@@ -148,34 +428,277 @@ public:
 
     void updateBoundaryConditions();
 
+    /*!
+    * \fn solveLoadCases
+    * \brief Solves K * U = F for several load cases at once, against the same factorization of K
+    *        (linear quasi-static mode only). In DIRECT mode, all columns go through one blocked substitution
+    *        (SparseSolver::solveBlock(), each entry of the factor is read once for all load cases).
+    *        The conjugate gradient modes solve the columns one after the other.
+    * \param _matF : one column of forces per load case, either on all nodes (2 x numberOfNodes rows, with edge nodes of quadratic elements)
+    *                or on non-fixed nodes only (getNbFreeDofs() rows, same layout as the forces of iterate())
+    * \param _matU : displacements, in the layout of _matF (0 for fixed nodes)
+    * \return : success
+    */
+    bool solveLoadCases(const Eigen::MatrixXd& _matF, Eigen::MatrixXd& _matU);
+
+    /*!
+    * \fn printStats
+    * \brief Prints solver, preconditioner and iterations of the last solve
+    */
+    void printStats() const;
+
     /*!
     * \fn iterate
     * \brief Calculates the displacements u by solving the global system K * u = f
+    *        (then strain and stress of each element, if enabled)
     */
     bool iterate() override;
 
+    /*!
+    * \fn getVerticesVonMises
+    * \brief Returns the von Mises stress of each vertex (area-weighted mean of its elements), e.g. for vertex colours
+    * \return : success (false if no stress was computed)
+    */
+    bool getVerticesVonMises(std::vector<float>& _values) const;
+
+    /*!
+    * \fn solveAdaptive
+    * \brief Solves the current frame, then refines the elements with the largest estimated errors and solves again,
+    *        until _maxRefinements refinements or a relative error below _targetError (quasi-static mode only).
+    *        getResult() then returns the new vertices too (see getIndices())
+    * \param _maxRefinements : max number of refinements
+    * \param _refineFraction : fraction of elements refined at each refinement (the worst ones)
+    * \param _targetError : relative error (see estimateErrors()) below which refinement stops
+    * \return : success
+    */
+    bool solveAdaptive(unsigned int _maxRefinements, double _refineFraction = 0.1, double _targetError = 0.0);
+
+    /*!
+    * \fn estimateErrors
+    * \brief Zienkiewicz-Zhu error estimate of each element, from the stress field of the current displacements
+    * \param _elementsError : error (energy norm) of each element
+    * \return : relative global error sqrt(eta^2 / (eta^2 + |u|^2)), with |u| the energy norm of the solution
+    */
+    double estimateErrors(std::vector<double>& _elementsError);
+
+    /*!
+    * \fn refineElements
+    * \brief Longest-edge bisection of elements _elements, plus neighbors needed for conformity.
+    *        Element ids of unchanged elements are kept, and K is updated with changed elements only
+    */
+    void refineElements(const std::vector<uint32_t>& _elements);
+
 protected:
 
+    /*!
+    * \fn getActiveFormulation
+    * \brief Returns the formulation solved by solveStep(), with the precedence MODAL > DYNAMIC > NEO_HOOKEAN > COROTATIONAL > LINEAR
+    */
+    eFemFormulation getActiveFormulation() const;
+
+    /*!
+    * \fn isDisplacementFromRest
+    * \brief Returns true if m_vecU is the displacement from the rest shape, false if it is the increment of the current frame
+    */
+    bool isDisplacementFromRest() const;
+
+    /*!
+    * \fn solveStep
+    * \brief Solves the displacements of the current frame, in the selected mode
+    * \return : success
+    */
+    bool solveStep();
+
+    /*!
+    * \fn computeStressField
+    * \brief Computes strain and stress of each element from the current displacements (parallel over elements)
+    */
+    void computeStressField();
+
+    /*!
+    * \fn getTotalDisplacements
+    * \brief Returns the displacements of non-fixed nodes from the rest shape, after the solve of the current frame
+    */
+    Eigen::VectorXd getTotalDisplacements() const;
+
+    /*!
+    * \fn factorizeSystem
+    * \brief Factorizes K (DIRECT), or sets up the conjugate gradient (CONJUGATE_GRADIENT)
+    * \return : success
+    */
+    bool factorizeSystem();
+
+    /*!
+    * \fn buildLumpedMass
+    * \brief Builds the diagonal mass matrix of non-fixed dofs (a third of the mass of each triangle on each of its nodes)
+    */
+    void buildLumpedMass();
+
+    /*!
+    * \fn getEffectiveCoefficients
+    * \brief Returns the coefficients of u and v updates from a_(n+1) (c_u, c_v), and of M and K in the effective matrix (c_M, c_K)
+    */
+    void getEffectiveCoefficients(double& _coefU, double& _coefV, double& _coefM, double& _coefK) const;
+
+    /*!
+    * \fn multiplyK
+    * \brief _y = K * _x (assembled K, or matrix-free operator)
+    */
+    void multiplyK(const Eigen::VectorXd& _x, Eigen::VectorXd& _y) const;
+
+    /*!
+    * \fn solveSystem
+    * \brief Solves the factorized system with the selected solver, _x is the initial guess of iterative solvers
+    * \return : success
+    */
+    bool solveSystem(const Eigen::VectorXd& _b, Eigen::VectorXd& _x);
+
+    /*!
+    * \fn stepDynamic
+    * \brief One implicit time step (BACKWARD_EULER or NEWMARK)
+    * \return : success
+    */
+    bool stepDynamic();
+
+    /*!
+    * \fn computeModalBasis
+    * \brief Computes (or reads from the cache file) the modes of the reduced-order mode, and resets modal coordinates
+    * \return : success
+    */
+    bool computeModalBasis();
+
+    /*!
+    * \fn stepModal
+    * \brief One quasi-static solve or time step in modal space, then u = Phi * q
+    * \return : success
+    */
+    bool stepModal();
+
+    /*!
+    * \fn buildRestShapes
+    * \brief Builds the inverse of the rest edge matrix Dm of each element
+    */
+    void buildRestShapes();
+
+    /*!
+    * \fn computeDeformationGradient
+    * \brief F = Ds * Dm^-1 of element _e, for the displacements _vecU of non-fixed nodes
+    */
+    Eigen::Matrix2d computeDeformationGradient(int _e, const Eigen::VectorXd& _vecU) const;
+
+    /*!
+    * \fn evaluateNeoHookean
+    * \brief Elastic energy for the displacements _vecU, and optionally its gradient and the element Hessians (m_elementsHessian)
+    * \return : energy (infinity if an element is inverted)
+    */
+    double evaluateNeoHookean(const Eigen::VectorXd& _vecU, Eigen::VectorXd* _vecGrad, bool _computeHessians);
+
+    /*!
+    * \fn solveNewton
+    * \brief Newton's method with backtracking line search, from the current displacements
+    * \return : success (false if the tolerance is not reached within m_maxNewtonIterations)
+    */
+    bool solveNewton();
+
+    /*!
+    * \fn updateRotations
+    * \brief Extracts the rotation of each element from the current displacements (polar decomposition)
+    */
+    void updateRotations();
+
+    /*!
+    * \fn getRestKe
+    * \brief Returns the cached K_e of element _e, or computes it in _tmpKe if element matrices are not cached
+    */
+    inline const Matrix66d& getRestKe(int _e, Matrix66d& _tmpKe) const
+    {
+        if (!m_elementsKe.empty())
+            return m_elementsKe[_e];
+        buildKe(_tmpKe, m_indices[_e * 3], m_indices[_e * 3 + 1], m_indices[_e * 3 + 2]);
+        return _tmpKe;
+    }
+
+    /*!
+    * \fn getRotatedKe
+    * \brief Returns R_e * K_e * R_e^T for element _e
+    */
+    void getRotatedKe(int _e, Matrix66d& _Ke) const;
+
+    /*!
+    * \fn updateCorotationalSystem
+    * \brief Updates rotations, the rotated K (factorized or preconditioned again) and the right-hand side _vecRhs
+    * \return : success
+    */
+    bool updateCorotationalSystem(Eigen::VectorXd& _vecRhs);
+
     /*----------------------------------------------------------------------------------------------+
     |                                         ATTRIBUTES                                            |
     +-----------------------------------------------------------------------------------------------*/
 
 
-    Eigen::MatrixXd m_matK;                      /*!< Global stiffness matrix */
+    Eigen::SparseMatrix<double> m_matKFull;      /*!< Global stiffness matrix, all nodes */
+    Eigen::SparseMatrix<double> m_matK;          /*!< Global stiffness matrix, without fixed nodes */
     Eigen::Matrix3d m_matE;                      /*!< Elasticity matrix */
     Eigen::VectorXd m_vecU;
     Eigen::VectorXd m_vecF;
-    FemCG m_CG;
+    FemOperator m_operator;                      /*!< matrix-free K (MATRIX_FREE_CG mode) */
+    FemMatrixFreeCG m_matrixFreeCG;
+    bool m_cacheElementsKe = true;               /*!< store element stiffness matrices in m_operator */
+
+    eFemMaterial m_material = eFemMaterial::LINEAR; /*!< material model */
+    std::vector<Matrix66d> m_elementsHessian;    /*!< SPD projected Hessian of each element (NEO_HOOKEAN) */
+    Eigen::SparseMatrix<double> m_matH;          /*!< Hessian of the total energy, without fixed nodes (NEO_HOOKEAN) */
+    unsigned int m_maxNewtonIterations = 20;     /*!< max number of Newton iterations per iterate() */
+    double m_newtonTolerance = 1e-6;             /*!< relative tolerance on the residual forces */
+    unsigned int m_nbNewtonIterations = 0;       /*!< Newton iterations of the last iterate() */
+    bool m_hasNewtonConverged = false;           /*!< convergence status of the last Newton solve */
+    double m_assemblyTime = 0.0;                 /*!< time of element evaluation and assembly during the last iterate(), in ms */
+    double m_factorizeTime = 0.0;                /*!< time of factorizations (or preconditioner setups), in ms */
+    double m_solveTime = 0.0;                    /*!< time of linear solves, in ms */
+    double m_lineSearchTime = 0.0;               /*!< time of line searches, in ms */
+
+    eFemTimeIntegration m_timeIntegration = eFemTimeIntegration::QUASI_STATIC; /*!< quasi-static or dynamic mode */
+    double m_timeStep = 0.01;                    /*!< time step of dynamic mode */
+    double m_density = 1.0;                      /*!< mass per unit area */
+    double m_rayleighAlpha = 0.0;                /*!< mass proportional damping */
+    double m_rayleighBeta = 0.0;                 /*!< stiffness proportional damping */
+    double m_newmarkBeta = 0.25;                 /*!< Newmark parameters (average acceleration) */
+    double m_newmarkGamma = 0.5;
+    Eigen::VectorXd m_vecMass;                   /*!< lumped mass of non-fixed dofs */
+    Eigen::VectorXd m_vecV;                      /*!< velocities of non-fixed dofs (dynamic mode) */
+    Eigen::VectorXd m_vecA;                      /*!< accelerations of non-fixed dofs (dynamic mode) */
+    Eigen::SparseMatrix<double> m_matA;          /*!< effective matrix c_M * M + c_K * K (dynamic mode) */
+
+    unsigned int m_nbModes = 0;                  /*!< number of modes of the reduced-order mode (0 = full order) */
+    std::string m_modalCacheFileName;            /*!< file of cached modes (none if empty) */
+    ModalBasis m_modalBasis;                     /*!< lowest modes of K * phi = lambda * M * phi */
+    bool m_isModalBasisDirty = true;             /*!< true if K, M or the number of modes changed since the modes were computed */
+    Eigen::VectorXd m_vecQ;                      /*!< modal displacements, velocities and accelerations (reduced-order mode) */
+    Eigen::VectorXd m_vecQV;
+    Eigen::VectorXd m_vecQA;
+
+    bool m_isStressOutputEnabled = false;        /*!< computation of the stress field after each iterate() */
+    std::vector<FemElementStress> m_elementsStress; /*!< strain and stress of each element */
+    double m_relativeError = 0.0;                /*!< relative error of the last estimateErrors() */
+
+    eFemElementType m_elementType = eFemElementType::LINEAR_TRIANGLE; /*!< linear or quadratic elements */
+    std::vector<uint32_t> m_quadraticIndices;    /*!< node indices of quadratic elements: 3 vertices, then edge nodes (0,1), (1,2), (2,0) */
+    std::vector<std::pair<uint32_t, uint32_t> > m_edgeNodes; /*!< vertices of the edge of each edge node (node id = number of vertices + k) */
+
+    bool m_isCorotational = false;               /*!< corotational formulation (m_vecU is then the displacement from rest) */
+    Eigen::VectorXd m_vecFTotal;                 /*!< accumulated external forces (corotational mode) */
+    std::vector<Matrix66d> m_elementsKe;         /*!< stiffness matrix of each element, in its rest frame (corotational mode) */
+    std::vector<Eigen::Matrix2d> m_elementsInvDm; /*!< inverse of the rest edge matrix of each element (corotational mode) */
+    std::vector<Eigen::Matrix2d> m_elementsRot;  /*!< rotation of each element (corotational mode) */
+    Eigen::SparseMatrix<double> m_matKRot;       /*!< rotated stiffness matrix, without fixed nodes (corotational mode) */
 
     double m_mu = 10.5;						     /*!< Lame parameters */
 	double m_lambda = 0.5;
 
-    std::vector<glm::vec3> m_initVertices;       /* initial vertices */
+    std::vector<glm::vec3> m_initVertices;       /* initial vertices (updated by getResult()), then edge nodes */
+    std::vector<glm::vec3> m_restVertices;       /* rest vertices, on which element matrices are built, then edge nodes */
     std::vector<uint32_t> m_indices;
 
-    std::vector<uint32_t> m_fixedConstraints;    /* each fixed constraint point is identified by its id */
-    std::vector<std::pair<uint32_t, glm::vec3> > m_movingConstraints; /* each moving constraint point is identified by its id and target position */
-
 
 }; // class Fem
 
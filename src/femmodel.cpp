@@ -0,0 +1,91 @@
+/*********************************************************************************************************************
+ *
+ * femmodel.cpp
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+
+#include "femmodel.h"
+
+#include <iostream>
+
+
+namespace CompGeom
+{
+
+    void FemModel::setDirectSolverType(eSparseSolverType _directSolverType)
+    {
+        m_solver.setType(_directSolverType);
+
+        // new backend needs its own symbolic analysis
+        m_isPatternAnalyzed = false;
+        m_isSystemDirty = true;
+    }
+
+
+    void FemModel::setPreconditioner(eFemPreconditioner _preconditioner)
+    {
+        m_preconditioner = _preconditioner;
+        m_isSystemDirty = true;
+    }
+
+
+    void FemModel::setSolverTolerance(double _tolerance, unsigned int _maxIterations)
+    {
+        m_CG.setTolerance(_tolerance);
+        if (_maxIterations > 0)
+        {
+            m_CG.setMaxIterations(_maxIterations);
+        }
+    }
+
+
+    void FemModel::buildDofMap(size_t _nbNodes, const std::vector<uint32_t>& _fixedNodes)
+    {
+        // free index of each node (-1 for fixed nodes), in O(N + F)
+        m_nodeToFreeId.assign(_nbNodes, 0);
+        for (auto it = _fixedNodes.begin(); it != _fixedNodes.end(); ++it)
+        {
+            m_nodeToFreeId.at(*it) = -1;
+        }
+
+        m_freeNodes.clear();
+        m_freeNodes.reserve(_nbNodes);
+        for (uint32_t i = 0; i < _nbNodes; i++)
+        {
+            if (m_nodeToFreeId.at(i) >= 0)
+            {
+                m_nodeToFreeId.at(i) = (int)m_freeNodes.size();
+                m_freeNodes.push_back(i);
+            }
+        }
+    }
+
+
+    void FemModel::printSolverStats(eFemPreconditioner _activePreconditioner) const
+    {
+        static const char* solverNames[] = { "direct", "conjugate gradient", "matrix-free conjugate gradient" };
+        static const char* preconditionerNames[] = { "none", "Jacobi", "incomplete Cholesky", "multigrid" };
+
+        std::cout << ", " << solverNames[(int)m_solverType] << " solver";
+        if (m_solverType == eFemSolverType::DIRECT)
+        {
+            std::cout << " (" << m_solver.getName() << ", nnz(L) = " << m_solver.getNnzL() << ")" << std::endl;
+            return;
+        }
+
+        std::cout << ", " << preconditionerNames[(int)_activePreconditioner] << " preconditioner"
+                  << ", #iterations: " << m_nbSolverIterations
+                  << ", estimated error: " << m_solverError << std::endl;
+
+        if (_activePreconditioner == eFemPreconditioner::MULTIGRID)
+        {
+            m_CG.preconditioner().getMultigrid().printStats();
+        }
+    }
+
+
+} // namespace CompGeom
@@ -0,0 +1,254 @@
+/*********************************************************************************************************************
+ *
+ * femmodel.h
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#ifndef FEMMODEL_H
+#define FEMMODEL_H
+
+#include "dynamicalmodel.h"
+#include "sparsesolver.h"
+#include "fempreconditioner.h"
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+#include <Eigen/IterativeLinearSolvers>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+namespace CompGeom
+{
+
+    /*!
+     * Solvers for the global system K * u = f
+     */
+    enum class eFemSolverType
+    {
+        DIRECT,             /* sparse Cholesky factorization of K, computed once (see SparseSolver) */
+        CONJUGATE_GRADIENT, /* conjugate gradient, warm-started from previous displacements */
+        MATRIX_FREE_CG      /* conjugate gradient on the element-by-element operator, K is never assembled (see FemOperator) */
+    };
+
+/*!
+* \class FemModel
+* \brief Common part of the finite-element models (Fem in 2D, TetFem in 3D)
+*
+* Fixed nodes are eliminated from the global system: node i is the m_nodeToFreeId[i]-th node of the
+* reduced system (-1 if fixed), and its dofs are m_nbDofsPerNode * m_nodeToFreeId[i] + d.
+* Element matrices are assembled in parallel (see assembleElements()), and the reduced system is solved
+* with a sparse direct solver or a preconditioned conjugate gradient.
+*/
+class FemModel : public DynamicalModel
+{
+protected:
+
+    // Conjugate gradient solver
+    typedef Eigen::ConjugateGradient<Eigen::SparseMatrix<double>, Eigen::Lower|Eigen::Upper, FemPreconditioner> FemCG;
+
+public:
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        CONSTRUCTORS                                           |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn FemModel
+    * \brief Constructor
+    * \param _nbDofsPerNode : number of coordinates of each node (2 in 2D, 3 in 3D)
+    */
+    explicit FemModel(int _nbDofsPerNode) : m_nbDofsPerNode(_nbDofsPerNode) {}
+
+
+    /*!
+    * \fn ~FemModel
+    * \brief Destructor
+    */
+    virtual ~FemModel() {};
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                     GETTERS / SETTERS                                         |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn getSolverType
+    */
+    inline eFemSolverType getSolverType() const { return m_solverType; }
+
+    /*!
+    * \fn setDirectSolverType
+    * \brief Selects the sparse direct solver used in DIRECT mode
+    */
+    void setDirectSolverType(eSparseSolverType _directSolverType);
+
+    /*!
+    * \fn setPreconditioner
+    * \brief Selects the preconditioner of the conjugate gradient
+    */
+    virtual void setPreconditioner(eFemPreconditioner _preconditioner);
+
+    /*!
+    * \fn setSolverTolerance
+    * \brief Sets the relative residual tolerance and the max number of iterations of the conjugate gradient (0 = 2 * size)
+    */
+    virtual void setSolverTolerance(double _tolerance, unsigned int _maxIterations = 0);
+
+    /*!
+    * \fn getNbFreeDofs
+    * \brief Returns the size of the reduced system (m_nbDofsPerNode coords per non-fixed node)
+    */
+    inline Eigen::Index getNbFreeDofs() const { return m_nbDofsPerNode * (Eigen::Index)m_freeNodes.size(); }
+
+    /*!
+    * \fn getNbSolverIterations
+    * \brief Returns the number of conjugate gradient iterations of the last solve (0 in DIRECT mode)
+    */
+    inline unsigned int getNbSolverIterations() const { return m_nbSolverIterations; }
+
+    /*!
+    * \fn getSolverError
+    * \brief Returns the relative residual of the last conjugate gradient solve (0.0 in DIRECT mode)
+    */
+    inline double getSolverError() const { return m_solverError; }
+
+
+protected:
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        MISCELLANEOUS                                          |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn buildDofMap
+    * \brief Builds the index of each node in the reduced system (without fixed nodes)
+    * \param _nbNodes : number of nodes
+    * \param _fixedNodes : nodes eliminated from the system
+    */
+    void buildDofMap(size_t _nbNodes, const std::vector<uint32_t>& _fixedNodes);
+
+    /*!
+    * \fn assembleElements
+    * \brief Assembles the element matrices given by _kernel, on all nodes or on non-fixed nodes only (_isReduced).
+    *        Elements are processed in parallel, each thread fills its own list of triplets
+    * \param _kernel : callable (int _e, Eigen::Matrix<double, NbDofs, NbDofs>& _Ke), NbDofs = NbNodes * NbDofsPerNode
+    * \param _elementsNodes : NbNodes node indices per element
+    * \param _nbNodes : number of nodes (size of the full system)
+    */
+    template<int NbNodes, int NbDofsPerNode, typename ElementKernel>
+    void assembleElements(const ElementKernel& _kernel, const std::vector<uint32_t>& _elementsNodes, size_t _nbNodes,
+                          bool _isReduced, Eigen::SparseMatrix<double>& _matK) const
+    {
+        typedef Eigen::Matrix<double, NbNodes * NbDofsPerNode, NbNodes * NbDofsPerNode> MatrixKe;
+        constexpr int nbEntries = NbNodes * NbDofsPerNode * NbNodes * NbDofsPerNode;
+        assert(NbDofsPerNode == m_nbDofsPerNode);
+
+        const size_t nbElements = _elementsNodes.size() / NbNodes;
+
+        // (duplicates are summed by setFromTriplets)
+        int nbThreads = 1;
+#ifdef _OPENMP
+        nbThreads = omp_get_max_threads();
+#endif
+        std::vector<std::vector<Eigen::Triplet<double> > > threadTriplets(nbThreads);
+
+        #pragma omp parallel
+        {
+            int threadId = 0;
+#ifdef _OPENMP
+            threadId = omp_get_thread_num();
+#endif
+            std::vector<Eigen::Triplet<double> >& triplets = threadTriplets.at(threadId);
+            triplets.reserve(nbEntries * (nbElements / nbThreads + 1));
+
+            #pragma omp for
+            for (int e = 0; e < (int)nbElements; e++)
+            {
+                MatrixKe Ke;
+                _kernel(e, Ke);
+
+                // node index in global matrix K (-1 if the node is not in the system)
+                int nodeIds[NbNodes];
+                for (int i = 0; i < NbNodes; i++)
+                {
+                    uint32_t node = _elementsNodes[e * NbNodes + i];
+                    nodeIds[i] = _isReduced ? m_nodeToFreeId.at(node) : (int)node;
+                }
+
+                for (int i = 0; i < NbNodes; i++)
+                {
+                    for (int j = 0; j < NbNodes; j++)
+                    {
+                        // fixed nodes are eliminated from the system
+                        if (nodeIds[i] < 0 || nodeIds[j] < 0)
+                            continue;
+
+                        const int destI = NbDofsPerNode * nodeIds[i];
+                        const int destJ = NbDofsPerNode * nodeIds[j];
+
+                        // copy block (i, j) of Ke into K
+                        for (int x = 0; x < NbDofsPerNode; x++)
+                        {
+                            for (int y = 0; y < NbDofsPerNode; y++)
+                            {
+                                triplets.push_back(Eigen::Triplet<double>(destI + x, destJ + y, Ke(NbDofsPerNode * i + x, NbDofsPerNode * j + y)));
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // merge thread buffers
+        std::vector<Eigen::Triplet<double> > triplets;
+        triplets.reserve(nbEntries * nbElements);
+        for (auto it = threadTriplets.begin(); it != threadTriplets.end(); ++it)
+        {
+            triplets.insert(triplets.end(), it->begin(), it->end());
+        }
+
+        const Eigen::Index matDim = _isReduced ? getNbFreeDofs() : NbDofsPerNode * (Eigen::Index)_nbNodes;
+        _matK.resize(matDim, matDim);
+        _matK.setFromTriplets(triplets.begin(), triplets.end());
+    }
+
+    /*!
+    * \fn printSolverStats
+    * \brief Prints the selected solver and, for the conjugate gradient, its preconditioner and the iterations of the last solve
+    * \param _activePreconditioner : preconditioner actually used by the conjugate gradient
+    */
+    void printSolverStats(eFemPreconditioner _activePreconditioner) const;
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                         ATTRIBUTES                                            |
+    +-----------------------------------------------------------------------------------------------*/
+
+    const int m_nbDofsPerNode;                   /*!< number of coords of each node */
+
+    SparseSolver m_solver;                       /*!< sparse Cholesky factorization of K (DIRECT mode) */
+    FemCG m_CG;
+    eFemSolverType m_solverType = eFemSolverType::DIRECT; /*!< solver of the global system */
+    eFemPreconditioner m_preconditioner = eFemPreconditioner::JACOBI; /*!< preconditioner of the conjugate gradient */
+    bool m_isSystemDirty = true;                 /*!< true if K changed since last factorization */
+    bool m_isPatternAnalyzed = false;            /*!< true if the symbolic factorization of K can be reused */
+    unsigned int m_nbSolverIterations = 0;       /*!< conjugate gradient iterations of the last solve */
+    double m_solverError = 0.0;                  /*!< relative residual of the last solve */
+
+    std::vector<uint32_t> m_fixedConstraints;    /* each fixed constraint point is identified by its id */
+    std::vector<int> m_nodeToFreeId;             /* index of each node in the reduced system (-1 if fixed) */
+    std::vector<uint32_t> m_freeNodes;           /* non-fixed nodes, in reduced system order */
+    std::vector<std::pair<uint32_t, glm::vec3> > m_movingConstraints; /* each moving constraint point is identified by its id and target position */
+
+
+}; // class FemModel
+
+} // namespace CompGeom
+
+#endif // FEMMODEL_H
@@ -0,0 +1,175 @@
+/*********************************************************************************************************************
+ *
+ * femoperator.cpp
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+
+#include "femoperator.h"
+
+#include <algorithm>
+#include <assert.h>
+
+
+namespace CompGeom
+{
+
+    void FemOperator::initialize(Eigen::Index _nbDofs, const std::vector<std::array<int, 6> >& _elementsDofs,
+                                 const ElementKernel& _kernel, bool _cacheKe)
+    {
+        m_nbDofs = _nbDofs;
+        m_elementsDofs = _elementsDofs;
+        m_kernel = _kernel;
+        m_shift.resize(0);
+        m_stiffnessScale = 1.0;
+
+        m_elementsKe.clear();
+        if (_cacheKe)
+        {
+            m_elementsKe.resize(m_elementsDofs.size());
+
+            #pragma omp parallel for
+            for (int e = 0; e < (int)m_elementsDofs.size(); e++)
+            {
+                m_kernel(e, m_elementsKe[e]);
+            }
+        }
+
+        colorElements();
+    }
+
+
+    void FemOperator::colorElements()
+    {
+        const int nbElements = (int)m_elementsDofs.size();
+
+        // colors already used around each node (a node is identified by its x dof / 2)
+        std::vector<std::vector<int> > nodeColors(m_nbDofs / 2);
+        std::vector<int> colors(nbElements, 0);
+        int nbColors = 0;
+
+        std::vector<int> forbidden;
+        for (int e = 0; e < nbElements; e++)
+        {
+            forbidden.clear();
+            for (int i = 0; i < 3; i++)
+            {
+                int dof = m_elementsDofs[e][2 * i];
+                if (dof >= 0)
+                    forbidden.insert(forbidden.end(), nodeColors[dof / 2].begin(), nodeColors[dof / 2].end());
+            }
+
+            int c = 0;
+            while (std::find(forbidden.begin(), forbidden.end(), c) != forbidden.end())
+                c++;
+
+            colors[e] = c;
+            nbColors = std::max(nbColors, c + 1);
+            for (int i = 0; i < 3; i++)
+            {
+                int dof = m_elementsDofs[e][2 * i];
+                if (dof >= 0)
+                    nodeColors[dof / 2].push_back(c);
+            }
+        }
+
+        // bucket sort elements by color
+        m_colorPtr.assign(nbColors + 1, 0);
+        for (int e = 0; e < nbElements; e++)
+        {
+            m_colorPtr[colors[e] + 1]++;
+        }
+        for (int c = 0; c < nbColors; c++)
+        {
+            m_colorPtr[c + 1] += m_colorPtr[c];
+        }
+
+        m_colorElements.resize(nbElements);
+        std::vector<int> cursor(m_colorPtr.begin(), m_colorPtr.end() - 1);
+        for (int e = 0; e < nbElements; e++)
+        {
+            m_colorElements[cursor[colors[e]]++] = e;
+        }
+    }
+
+
+    void FemOperator::multiply(const Eigen::Ref<const Eigen::VectorXd>& _x, Eigen::Ref<Eigen::VectorXd> _y, double _alpha) const
+    {
+        multiplyStiffness(_x, _y, _alpha * m_stiffnessScale);
+        if (m_shift.size() > 0)
+        {
+            _y += _alpha * m_shift.cwiseProduct(_x);
+        }
+    }
+
+
+    void FemOperator::multiplyStiffness(const Eigen::Ref<const Eigen::VectorXd>& _x, Eigen::Ref<Eigen::VectorXd> _y, double _alpha) const
+    {
+        assert(_x.size() == m_nbDofs && _y.size() == m_nbDofs);
+
+        for (size_t c = 0; c + 1 < m_colorPtr.size(); c++)
+        {
+            // elements of a same color do not share nodes: no concurrent writes in _y
+            #pragma omp parallel for
+            for (int k = m_colorPtr[c]; k < m_colorPtr[c + 1]; k++)
+            {
+                const int e = m_colorElements[k];
+                const std::array<int, 6>& dofs = m_elementsDofs[e];
+
+                // gather (fixed dofs have zero displacement)
+                Eigen::Matrix<double, 6, 1> x_e;
+                for (int i = 0; i < 6; i++)
+                {
+                    x_e[i] = dofs[i] >= 0 ? _x[dofs[i]] : 0.0;
+                }
+
+                Matrix66d tmpKe;
+                const Eigen::Matrix<double, 6, 1> y_e = getKe(e, tmpKe) * x_e;
+
+                // scatter
+                for (int i = 0; i < 6; i++)
+                {
+                    if (dofs[i] >= 0)
+                        _y[dofs[i]] += _alpha * y_e[i];
+                }
+            }
+        }
+    }
+
+
+    Eigen::VectorXd FemOperator::diagonal() const
+    {
+        Eigen::VectorXd diag = Eigen::VectorXd::Zero(m_nbDofs);
+
+        for (size_t c = 0; c + 1 < m_colorPtr.size(); c++)
+        {
+            #pragma omp parallel for
+            for (int k = m_colorPtr[c]; k < m_colorPtr[c + 1]; k++)
+            {
+                const int e = m_colorElements[k];
+                const std::array<int, 6>& dofs = m_elementsDofs[e];
+
+                Matrix66d tmpKe;
+                const Matrix66d& Ke = getKe(e, tmpKe);
+                for (int i = 0; i < 6; i++)
+                {
+                    if (dofs[i] >= 0)
+                        diag[dofs[i]] += Ke(i, i);
+                }
+            }
+        }
+
+        diag *= m_stiffnessScale;
+        if (m_shift.size() > 0)
+        {
+            diag += m_shift;
+        }
+
+        return diag;
+    }
+
+
+} // namespace CompGeom
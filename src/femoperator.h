@@ -0,0 +1,225 @@
+/*********************************************************************************************************************
+ *
+ * femoperator.h
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#ifndef FEMOPERATOR_H
+#define FEMOPERATOR_H
+
+#include <vector>
+#include <array>
+#include <functional>
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+#include <Eigen/IterativeLinearSolvers>
+
+
+namespace CompGeom
+{
+    class FemOperator;
+}
+
+
+namespace Eigen
+{
+namespace internal
+{
+    // FemOperator is seen by Eigen's iterative solvers as a sparse matrix
+    template<>
+    struct traits<CompGeom::FemOperator> : public Eigen::internal::traits<Eigen::SparseMatrix<double> >
+    {};
+}
+}
+
+
+namespace CompGeom
+{
+
+/*!
+* \class FemOperator
+* \brief Matrix-free global stiffness operator of a linear triangle mesh: y = K * x is computed element by element
+*        (y_e = K_e * x_e, scattered into y), so that the global matrix K is never stored.
+*
+* Elements are colored such that elements of a same color do not share any node,
+* so that elements of a same color are processed in parallel without write conflicts.
+* Element matrices K_e are cached (memory proportional to the number of elements), or recomputed at each product.
+*
+* A diagonal shift can be added, so that the operator is A = D + s * K (e.g., effective matrix M + c * K of implicit time stepping).
+*
+* The operator can be used with Eigen iterative solvers, e.g.:
+* Eigen::ConjugateGradient<FemOperator, Eigen::Lower|Eigen::Upper, Eigen::IdentityPreconditioner>
+*/
+class FemOperator : public Eigen::EigenBase<FemOperator>
+{
+
+public:
+
+    typedef double Scalar;
+    typedef double RealScalar;
+    typedef int StorageIndex;
+    enum
+    {
+        ColsAtCompileTime = Eigen::Dynamic,
+        MaxColsAtCompileTime = Eigen::Dynamic,
+        IsRowMajor = false
+    };
+
+    typedef Eigen::Matrix<double, 6, 6> Matrix66d;
+    typedef std::function<void(int, Matrix66d&)> ElementKernel;  /*!< computes K_e of an element */
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        CONSTRUCTORS                                           |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn FemOperator
+    * \brief Default constructor
+    */
+    FemOperator() = default;
+
+    /*!
+    * \fn ~FemOperator
+    * \brief Destructor
+    */
+    virtual ~FemOperator() = default;
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                     GETTERS / SETTERS                                         |
+    +-----------------------------------------------------------------------------------------------*/
+
+    inline Eigen::Index rows() const { return m_nbDofs; }
+    inline Eigen::Index cols() const { return m_nbDofs; }
+
+    /*!
+    * \fn getNbColors
+    * \brief Returns the number of element colors (i.e., number of sequential steps in a product)
+    */
+    inline size_t getNbColors() const { return m_colorPtr.empty() ? 0 : m_colorPtr.size() - 1; }
+
+    /*!
+    * \fn setShift
+    * \brief The operator becomes A = diag(_diagonal) + _stiffnessScale * K (empty _diagonal: A = _stiffnessScale * K)
+    */
+    inline void setShift(const Eigen::VectorXd& _diagonal, double _stiffnessScale) { m_shift = _diagonal; m_stiffnessScale = _stiffnessScale; }
+
+    /*!
+    * \fn isCachingKe
+    */
+    inline bool isCachingKe() const { return !m_elementsKe.empty(); }
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        MISCELLANEOUS                                          |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn initialize
+    * \brief Sets the elements of the operator, and colors them
+    * \param _nbDofs : size of the operator
+    * \param _elementsDofs : the 6 dofs (x, y of each node) of each element, -1 for a fixed dof
+    * \param _kernel : function computing K_e for an element
+    * \param _cacheKe : if true, all K_e are computed once and stored, otherwise they are computed at each product
+    */
+    void initialize(Eigen::Index _nbDofs, const std::vector<std::array<int, 6> >& _elementsDofs,
+                    const ElementKernel& _kernel, bool _cacheKe = true);
+
+    /*!
+    * \fn multiply
+    * \brief _y += _alpha * A * _x
+    */
+    void multiply(const Eigen::Ref<const Eigen::VectorXd>& _x, Eigen::Ref<Eigen::VectorXd> _y, double _alpha = 1.0) const;
+
+    /*!
+    * \fn multiplyStiffness
+    * \brief _y += _alpha * K * _x (without shift)
+    */
+    void multiplyStiffness(const Eigen::Ref<const Eigen::VectorXd>& _x, Eigen::Ref<Eigen::VectorXd> _y, double _alpha = 1.0) const;
+
+    /*!
+    * \fn diagonal
+    * \brief Returns the diagonal of A (e.g., for a Jacobi preconditioner)
+    */
+    Eigen::VectorXd diagonal() const;
+
+    /*!
+    * \fn operator*
+    * \brief Product with a dense vector, evaluated by multiply()
+    */
+    template<typename Rhs>
+    Eigen::Product<FemOperator, Rhs, Eigen::AliasFreeProduct> operator*(const Eigen::MatrixBase<Rhs>& _x) const
+    {
+        return Eigen::Product<FemOperator, Rhs, Eigen::AliasFreeProduct>(*this, _x.derived());
+    }
+
+
+protected:
+
+    /*!
+    * \fn colorElements
+    * \brief Greedy coloring: each element gets the smallest color not used by an element sharing one of its nodes
+    */
+    void colorElements();
+
+    /*!
+    * \fn getKe
+    * \brief Returns cached K_e, or computes it in _tmpKe
+    */
+    inline const Matrix66d& getKe(int _e, Matrix66d& _tmpKe) const
+    {
+        if (!m_elementsKe.empty())
+            return m_elementsKe[_e];
+        m_kernel(_e, _tmpKe);
+        return _tmpKe;
+    }
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                         ATTRIBUTES                                            |
+    +-----------------------------------------------------------------------------------------------*/
+
+    Eigen::Index m_nbDofs = 0;                          /*!< size of the operator */
+    std::vector<std::array<int, 6> > m_elementsDofs;    /*!< dofs of each element (-1 = fixed) */
+    ElementKernel m_kernel;                             /*!< element stiffness matrix */
+    std::vector<Matrix66d> m_elementsKe;                /*!< cached element stiffness matrices (empty if not cached) */
+
+    Eigen::VectorXd m_shift;                            /*!< diagonal added to the operator (empty if none) */
+    double m_stiffnessScale = 1.0;                      /*!< scale of K in the operator */
+
+    std::vector<int> m_colorElements;   /*!< elements sorted by color */
+    std::vector<int> m_colorPtr;        /*!< start of each color in m_colorElements */
+
+
+}; // class FemOperator
+
+} // namespace CompGeom
+
+
+namespace Eigen
+{
+namespace internal
+{
+    // y += alpha * FemOperator * x, used by Eigen iterative solvers
+    template<typename Rhs>
+    struct generic_product_impl<CompGeom::FemOperator, Rhs, SparseShape, DenseShape, GemvProduct>
+        : generic_product_impl_base<CompGeom::FemOperator, Rhs, generic_product_impl<CompGeom::FemOperator, Rhs> >
+    {
+        typedef typename Product<CompGeom::FemOperator, Rhs>::Scalar Scalar;
+
+        // _dst is written in place (a vector, or a column of the solution in multi-column solves)
+        template<typename Dest>
+        static void scaleAndAddTo(Dest& _dst, const CompGeom::FemOperator& _lhs, const Rhs& _rhs, const Scalar& _alpha)
+        {
+            _lhs.multiply(_rhs, _dst, _alpha);
+        }
+    };
+}
+}
+
+#endif // FEMOPERATOR_H
@@ -0,0 +1,82 @@
+/*********************************************************************************************************************
+ *
+ * fempreconditioner.cpp
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+
+#include "fempreconditioner.h"
+
+#include <iostream>
+
+
+namespace CompGeom
+{
+
+    void FemPreconditioner::computeSparse(const Eigen::SparseMatrix<double>& _matA)
+    {
+        switch (m_activeType)
+        {
+            case eFemPreconditioner::NONE:
+            {
+                m_info = Eigen::Success;
+                break;
+            }
+            case eFemPreconditioner::JACOBI:
+            {
+                m_invDiag = _matA.diagonal().cwiseInverse();
+                m_info = Eigen::Success;
+                break;
+            }
+            case eFemPreconditioner::INCOMPLETE_CHOLESKY:
+            {
+                m_ic.compute(_matA);
+                m_info = m_ic.info();
+                break;
+            }
+            case eFemPreconditioner::MULTIGRID:
+            {
+                m_multigrid.setup(_matA, m_blockSize);
+                m_info = m_multigrid.info();
+                break;
+            }
+        }
+
+        if (m_info != Eigen::Success)
+        {
+            std::cerr << "FemPreconditioner: computation failed, using JACOBI instead" << std::endl;
+            m_activeType = eFemPreconditioner::JACOBI;
+            m_invDiag = _matA.diagonal().cwiseInverse();
+            m_info = Eigen::Success;
+        }
+    }
+
+
+    Eigen::VectorXd FemPreconditioner::solve(const Eigen::VectorXd& _b) const
+    {
+        switch (m_activeType)
+        {
+            case eFemPreconditioner::JACOBI:
+                return m_invDiag.cwiseProduct(_b);
+
+            case eFemPreconditioner::INCOMPLETE_CHOLESKY:
+                return m_ic.solve(_b);
+
+            case eFemPreconditioner::MULTIGRID:
+            {
+                Eigen::VectorXd x = Eigen::VectorXd::Zero(_b.size());
+                m_multigrid.vCycle(_b, x);
+                return x;
+            }
+
+            case eFemPreconditioner::NONE:
+                break;
+        }
+        return _b;
+    }
+
+
+} // namespace CompGeom
@@ -0,0 +1,199 @@
+/*********************************************************************************************************************
+ *
+ * fempreconditioner.h
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#ifndef FEMPRECONDITIONER_H
+#define FEMPRECONDITIONER_H
+
+#include <iostream>
+#include <type_traits>
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+#include <Eigen/IterativeLinearSolvers>
+
+#include "femoperator.h"
+#include "multigrid.h"
+
+
+namespace CompGeom
+{
+
+    /*!
+     * List of preconditioners for the conjugate gradient
+     */
+    enum class eFemPreconditioner
+    {
+        NONE,                 /* identity */
+        JACOBI,               /* inverse of the diagonal */
+        INCOMPLETE_CHOLESKY,  /* incomplete Cholesky factorization with threshold (assembled matrix only) */
+        MULTIGRID             /* one V-cycle of smoothed aggregation multigrid (assembled matrix only) */
+    };
+
+
+/*!
+* \class FemPreconditioner
+* \brief Preconditioner selectable at runtime, usable as the Preconditioner template argument of Eigen::ConjugateGradient,
+*        with either an assembled sparse matrix or a matrix-free FemOperator.
+*        Preconditioners which need an assembled matrix fall back to JACOBI for a FemOperator.
+*/
+class FemPreconditioner
+{
+    typedef Eigen::IncompleteCholesky<double, Eigen::Lower, Eigen::AMDOrdering<int> > IncompleteCholesky;
+
+
+public:
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        CONSTRUCTORS                                           |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn FemPreconditioner
+    * \brief Default constructor
+    */
+    FemPreconditioner() = default;
+
+    /*!
+    * \fn FemPreconditioner
+    * \brief Constructor required by Eigen iterative solvers (the preconditioner is then computed by compute())
+    */
+    template<typename MatType>
+    explicit FemPreconditioner(const MatType& _mat) { compute(_mat); }
+
+    /*!
+    * \fn ~FemPreconditioner
+    * \brief Destructor
+    */
+    virtual ~FemPreconditioner() = default;
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                     GETTERS / SETTERS                                         |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn setType
+    * \brief Selects the preconditioner (compute() must be called again after this)
+    */
+    inline void setType(eFemPreconditioner _type) { m_type = _type; m_info = Eigen::InvalidInput; }
+
+    /*!
+    * \fn getType
+    */
+    inline eFemPreconditioner getType() const { return m_type; }
+
+    /*!
+    * \fn getActiveType
+    * \brief Returns the preconditioner actually used (see fallback for matrix-free operators)
+    */
+    inline eFemPreconditioner getActiveType() const { return m_activeType; }
+
+    /*!
+    * \fn info
+    */
+    inline Eigen::ComputationInfo info() const { return m_info; }
+
+    /*!
+    * \fn setBlockSize
+    * \brief Sets the number of dofs per node (2 in 2D, 3 in 3D), used by MULTIGRID aggregation
+    */
+    inline void setBlockSize(int _blockSize) { m_blockSize = _blockSize; m_info = Eigen::InvalidInput; }
+
+    /*!
+    * \fn getMultigrid
+    */
+    inline AlgebraicMultigrid& getMultigrid() { return m_multigrid; }
+    inline const AlgebraicMultigrid& getMultigrid() const { return m_multigrid; }
+
+    /*!
+    * \fn needsAssembledMatrix
+    * \brief Returns true if _type is not available for a matrix-free operator (JACOBI is used instead)
+    */
+    static inline bool needsAssembledMatrix(eFemPreconditioner _type)
+    {
+        return _type == eFemPreconditioner::INCOMPLETE_CHOLESKY || _type == eFemPreconditioner::MULTIGRID;
+    }
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        MISCELLANEOUS                                          |
+    +-----------------------------------------------------------------------------------------------*/
+
+    template<typename MatType>
+    FemPreconditioner& analyzePattern(const MatType&) { return *this; }
+
+    template<typename MatType>
+    FemPreconditioner& factorize(const MatType& _mat) { return compute(_mat); }
+
+    /*!
+    * \fn compute
+    * \brief Builds the preconditioner of a sparse matrix (or a sparse matrix expression), or of a FemOperator
+    */
+    template<typename MatType>
+    FemPreconditioner& compute(const MatType& _mat)
+    {
+        m_activeType = m_type;
+
+        if constexpr (std::is_same<MatType, FemOperator>::value)
+        {
+            // silent fallback: this runs at each solve, owners warn when the preconditioner is selected
+            if (needsAssembledMatrix(m_type))
+            {
+                m_activeType = eFemPreconditioner::JACOBI;
+            }
+            if (m_activeType == eFemPreconditioner::JACOBI)
+            {
+                m_invDiag = _mat.diagonal().cwiseInverse();
+            }
+            m_info = Eigen::Success;
+        }
+        else
+        {
+            computeSparse(Eigen::SparseMatrix<double>(_mat));
+        }
+
+        return *this;
+    }
+
+    /*!
+    * \fn solve
+    * \brief Applies the preconditioner to a residual
+    */
+    Eigen::VectorXd solve(const Eigen::VectorXd& _b) const;
+
+
+protected:
+
+    /*!
+    * \fn computeSparse
+    * \brief Builds the preconditioner of an assembled matrix
+    */
+    void computeSparse(const Eigen::SparseMatrix<double>& _matA);
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                         ATTRIBUTES                                            |
+    +-----------------------------------------------------------------------------------------------*/
+
+    eFemPreconditioner m_type = eFemPreconditioner::JACOBI;        /*!< selected preconditioner */
+    eFemPreconditioner m_activeType = eFemPreconditioner::JACOBI;  /*!< preconditioner actually used */
+    int m_blockSize = 2;                                           /*!< number of dofs per node */
+
+    Eigen::VectorXd m_invDiag;          /*!< JACOBI */
+    IncompleteCholesky m_ic;            /*!< INCOMPLETE_CHOLESKY */
+    AlgebraicMultigrid m_multigrid;     /*!< MULTIGRID */
+
+    Eigen::ComputationInfo m_info = Eigen::InvalidInput;
+
+
+}; // class FemPreconditioner
+
+} // namespace CompGeom
+
+#endif // FEMPRECONDITIONER_H
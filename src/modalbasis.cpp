@@ -0,0 +1,294 @@
+/*********************************************************************************************************************
+ *
+ * modalbasis.cpp
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+
+#include "modalbasis.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <random>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <assert.h>
+
+#include <Eigen/Eigenvalues>
+
+
+namespace CompGeom
+{
+
+    static const char s_modalFileMagic[8] = { 'C', 'G', 'M', 'O', 'D', 'E', 'S', '1' };
+
+
+    bool ModalBasis::compute(const SpMat& _matK, const Eigen::VectorXd& _vecMass, int _nbModes, double _shift)
+    {
+        assert(_matK.rows() == _matK.cols() && _matK.rows() == _vecMass.size());
+
+        const Eigen::Index n = _matK.rows();
+        const Eigen::Index nbModes = std::min((Eigen::Index)std::max(_nbModes, 0), n);
+        m_modes.resize(n, 0);
+        m_eigenvalues.resize(0);
+        m_nbLanczosVectors = 0;
+        m_fingerprint = computeFingerprint(_matK, _vecMass);
+
+        if (nbModes == 0)
+        {
+            m_info = Eigen::Success;
+            return true;
+        }
+
+        // shift-invert operator M^1/2 * (K - sigma * M)^-1 * M^1/2, factorized once
+        SpMat matShifted = _matK;
+        if (_shift != 0.0)
+        {
+            matShifted.diagonal() -= _shift * _vecMass;
+        }
+        SparseSolver solver;
+        if (!solver.compute(matShifted))
+        {
+            std::cerr << "ModalBasis: factorization of K - sigma * M failed" << std::endl;
+            m_info = Eigen::NumericalIssue;
+            return false;
+        }
+        const Eigen::VectorXd sqrtMass = _vecMass.cwiseSqrt();
+
+        // deterministic pseudo-random vectors, orthonormalized against the current basis
+        std::mt19937 generator(1234);
+        std::uniform_real_distribution<double> distribution(-1.0, 1.0);
+        auto randomVector = [&](Eigen::Index _nbVectors, const Eigen::MatrixXd& _matV) -> Eigen::VectorXd
+        {
+            Eigen::VectorXd v(n);
+            for (Eigen::Index i = 0; i < n; i++)
+            {
+                v[i] = distribution(generator);
+            }
+            for (int pass = 0; pass < 2; pass++)
+            {
+                v -= _matV.leftCols(_nbVectors) * (_matV.leftCols(_nbVectors).transpose() * v);
+            }
+            return v.normalized();
+        };
+
+        // Lanczos basis, extended until the nbModes largest Ritz values converge
+        Eigen::Index size = std::min(n, 2 * nbModes + 20);
+        Eigen::MatrixXd matV(n, size + 1);
+        matV.col(0) = randomVector(0, matV);
+        Eigen::VectorXd alphas(size);
+        Eigen::VectorXd betas(size);
+
+        Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> tridiagonalSolver;
+        Eigen::VectorXd vecB(n);
+        Eigen::VectorXd vecX(n);
+        Eigen::Index j = 0;
+        while (true)
+        {
+            for (; j < size; j++)
+            {
+                // w = M^1/2 * (K - sigma * M)^-1 * M^1/2 * v_j
+                vecB = sqrtMass.cwiseProduct(matV.col(j));
+                solver.solve(vecB, vecX);
+                Eigen::VectorXd w = sqrtMass.cwiseProduct(vecX);
+                alphas[j] = matV.col(j).dot(w);
+
+                // full reorthogonalization (twice is enough), the three-term recurrence alone loses orthogonality
+                for (int pass = 0; pass < 2; pass++)
+                {
+                    w -= matV.leftCols(j + 1) * (matV.leftCols(j + 1).transpose() * w);
+                }
+                betas[j] = w.norm();
+
+                if (j + 1 == n)
+                {
+                    betas[j] = 0.0;
+                    break;
+                }
+
+                if (betas[j] <= 1e-12 * alphas.head(j + 1).cwiseAbs().maxCoeff())
+                {
+                    // invariant subspace: restart from a new direction (T is then block-diagonal)
+                    betas[j] = 0.0;
+                    matV.col(j + 1) = randomVector(j + 1, matV);
+                }
+                else
+                {
+                    matV.col(j + 1) = w / betas[j];
+                }
+            }
+            const Eigen::Index m = std::min(j + 1, size);
+
+            // Ritz values of the tridiagonal matrix T = V^T * Op * V
+            Eigen::MatrixXd matT = Eigen::MatrixXd::Zero(m, m);
+            matT.diagonal() = alphas.head(m);
+            matT.diagonal(1) = betas.head(m - 1);
+            matT.diagonal(-1) = betas.head(m - 1);
+            tridiagonalSolver.compute(matT);
+
+            // residual of Ritz pair i: |beta_m * s_(m,i)|
+            bool isConverged = true;
+            for (Eigen::Index i = m - nbModes; i < m; i++)
+            {
+                const double theta = tridiagonalSolver.eigenvalues()[i];
+                const double residual = std::abs(betas[m - 1] * tridiagonalSolver.eigenvectors()(m - 1, i));
+                isConverged = isConverged && residual <= m_tolerance * std::abs(theta);
+            }
+
+            if (isConverged || m == n)
+            {
+                if (!isConverged)
+                {
+                    std::cerr << "ModalBasis: Lanczos did not converge" << std::endl;
+                }
+                m_nbLanczosVectors = m;
+                break;
+            }
+
+            // extend the basis
+            size = std::min(n, 2 * size);
+            matV.conservativeResize(n, size + 1);
+            alphas.conservativeResize(size);
+            betas.conservativeResize(size);
+            j = m;
+        }
+
+        // largest theta = lowest lambda, phi = M^-1/2 * V * s
+        m_modes.resize(n, nbModes);
+        m_eigenvalues.resize(nbModes);
+        const Eigen::Index m = m_nbLanczosVectors;
+        for (Eigen::Index i = 0; i < nbModes; i++)
+        {
+            const double theta = tridiagonalSolver.eigenvalues()[m - 1 - i];
+            if (theta <= 0.0)
+            {
+                std::cerr << "ModalBasis: K - sigma * M is not positive definite" << std::endl;
+                m_info = Eigen::NumericalIssue;
+                return false;
+            }
+            m_eigenvalues[i] = _shift + 1.0 / theta;
+            m_modes.col(i) = (matV.leftCols(m) * tridiagonalSolver.eigenvectors().col(m - 1 - i)).cwiseQuotient(sqrtMass);
+        }
+
+        m_info = Eigen::Success;
+        return true;
+    }
+
+
+    Eigen::Vector4d ModalBasis::computeFingerprint(const SpMat& _matK, const Eigen::VectorXd& _vecMass) const
+    {
+        double sumK = 0.0;
+        double sumSquaredK = 0.0;
+        for (int col = 0; col < _matK.outerSize(); col++)
+        {
+            for (SpMat::InnerIterator it(_matK, col); it; ++it)
+            {
+                sumK += (double)(it.row() + 1) * it.value();
+                sumSquaredK += it.value() * it.value();
+            }
+        }
+        return Eigen::Vector4d((double)_matK.nonZeros(), sumK, sumSquaredK, _vecMass.sum());
+    }
+
+
+    bool ModalBasis::save(const std::string& _fileName) const
+    {
+        std::ofstream file(_fileName, std::ios::binary);
+        if (!file)
+        {
+            std::cerr << "ModalBasis::save(): cannot open " << _fileName << std::endl;
+            return false;
+        }
+
+        const int64_t nbDofs = (int64_t)m_modes.rows();
+        const int64_t nbModes = (int64_t)m_modes.cols();
+        file.write(s_modalFileMagic, sizeof(s_modalFileMagic));
+        file.write(reinterpret_cast<const char*>(&nbDofs), sizeof(nbDofs));
+        file.write(reinterpret_cast<const char*>(&nbModes), sizeof(nbModes));
+        file.write(reinterpret_cast<const char*>(m_fingerprint.data()), 4 * sizeof(double));
+        file.write(reinterpret_cast<const char*>(m_eigenvalues.data()), nbModes * sizeof(double));
+        file.write(reinterpret_cast<const char*>(m_modes.data()), nbDofs * nbModes * sizeof(double));
+
+        if (!file)
+        {
+            std::cerr << "ModalBasis::save(): write error in " << _fileName << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+
+    bool ModalBasis::load(const std::string& _fileName, const SpMat& _matK, const Eigen::VectorXd& _vecMass, int _nbModes)
+    {
+        std::ifstream file(_fileName, std::ios::binary);
+        if (!file)
+        {
+            return false;
+        }
+
+        char magic[sizeof(s_modalFileMagic)];
+        int64_t nbDofs = 0;
+        int64_t nbModes = 0;
+        Eigen::Vector4d fingerprint;
+        file.read(magic, sizeof(magic));
+        file.read(reinterpret_cast<char*>(&nbDofs), sizeof(nbDofs));
+        file.read(reinterpret_cast<char*>(&nbModes), sizeof(nbModes));
+        file.read(reinterpret_cast<char*>(fingerprint.data()), 4 * sizeof(double));
+        if (!file || std::memcmp(magic, s_modalFileMagic, sizeof(magic)) != 0)
+        {
+            std::cerr << "ModalBasis::load(): " << _fileName << " is not a modes file" << std::endl;
+            return false;
+        }
+
+        // the cached modes must belong to the same system
+        const Eigen::Vector4d expectedFingerprint = computeFingerprint(_matK, _vecMass);
+        const bool isSameSystem = nbDofs == (int64_t)_matK.rows()
+                               && ((fingerprint - expectedFingerprint).array().abs() <= 1e-10 * expectedFingerprint.array().abs()).all();
+        if (!isSameSystem || nbModes < (int64_t)_nbModes)
+        {
+            std::cout << "ModalBasis::load(): " << _fileName << " does not match the current system, modes are computed again" << std::endl;
+            return false;
+        }
+
+        Eigen::VectorXd eigenvalues(nbModes);
+        Eigen::MatrixXd modes(nbDofs, nbModes);
+        file.read(reinterpret_cast<char*>(eigenvalues.data()), nbModes * sizeof(double));
+        file.read(reinterpret_cast<char*>(modes.data()), nbDofs * nbModes * sizeof(double));
+        if (!file)
+        {
+            std::cerr << "ModalBasis::load(): read error in " << _fileName << std::endl;
+            return false;
+        }
+
+        m_eigenvalues = eigenvalues.head(_nbModes);
+        m_modes = modes.leftCols(_nbModes);
+        m_fingerprint = fingerprint;
+        m_nbLanczosVectors = 0;
+        m_info = Eigen::Success;
+        return true;
+    }
+
+
+    void ModalBasis::printStats() const
+    {
+        if (m_eigenvalues.size() == 0)
+            return;
+
+        // f = sqrt(lambda) / (2 * pi)
+        const double twoPi = 2.0 * 3.14159265358979323846;
+        std::cout << "ModalBasis: " << m_eigenvalues.size() << " modes of " << m_modes.rows() << " dofs";
+        if (m_nbLanczosVectors > 0)
+        {
+            std::cout << ", " << m_nbLanczosVectors << " Lanczos vectors";
+        }
+        std::cout << ", frequencies: " << std::sqrt(std::max(m_eigenvalues[0], 0.0)) / twoPi
+                  << " to " << std::sqrt(std::max(m_eigenvalues[m_eigenvalues.size() - 1], 0.0)) / twoPi << " Hz" << std::endl;
+    }
+
+
+} // namespace CompGeom
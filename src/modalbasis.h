@@ -0,0 +1,165 @@
+/*********************************************************************************************************************
+ *
+ * modalbasis.h
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#ifndef MODALBASIS_H
+#define MODALBASIS_H
+
+#include <string>
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+
+#include "sparsesolver.h"
+
+
+namespace CompGeom
+{
+
+/*!
+* \class ModalBasis
+* \brief Lowest vibration modes of an elastic model, i.e., the smallest eigenpairs of K * phi = lambda * M * phi,
+*        with K the (sparse, SPD) stiffness matrix and M a lumped (diagonal) mass matrix.
+*
+* The generalized problem is transformed into the standard symmetric problem with the operator
+* M^1/2 * (K - sigma * M)^-1 * M^1/2, whose largest eigenvalues theta are the eigenvalues lambda = sigma + 1 / theta
+* closest to the shift sigma (shift-invert). They are found with the Lanczos method (with full reorthogonalization),
+* and each Lanczos iteration costs one solve with the sparse Cholesky factorization of K - sigma * M.
+* The Krylov basis is extended until all requested Ritz pairs converge.
+*
+* Modes are M-orthonormal: Phi^T * M * Phi = I and Phi^T * K * Phi = diag(lambda).
+* They can be saved to / loaded from a binary file, which is only accepted for the same K and M.
+*/
+class ModalBasis
+{
+    typedef Eigen::SparseMatrix<double> SpMat;
+
+
+public:
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        CONSTRUCTORS                                           |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn ModalBasis
+    * \brief Default constructor
+    */
+    ModalBasis() = default;
+
+    /*!
+    * \fn ~ModalBasis
+    * \brief Destructor
+    */
+    virtual ~ModalBasis() = default;
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                     GETTERS / SETTERS                                         |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn setTolerance
+    * \brief Sets the relative residual tolerance of the eigenpairs
+    */
+    inline void setTolerance(double _tolerance) { m_tolerance = _tolerance; }
+
+    /*!
+    * \fn getNbModes
+    */
+    inline Eigen::Index getNbModes() const { return m_eigenvalues.size(); }
+
+    /*!
+    * \fn getModes
+    * \brief Returns the modes, one per column, sorted by increasing eigenvalue
+    */
+    inline const Eigen::MatrixXd& getModes() const { return m_modes; }
+
+    /*!
+    * \fn getEigenvalues
+    * \brief Returns the eigenvalues (squared angular frequencies), in increasing order
+    */
+    inline const Eigen::VectorXd& getEigenvalues() const { return m_eigenvalues; }
+
+    /*!
+    * \fn getNbLanczosVectors
+    * \brief Returns the size of the Krylov basis of the last computation (0 if the modes were loaded)
+    */
+    inline Eigen::Index getNbLanczosVectors() const { return m_nbLanczosVectors; }
+
+    /*!
+    * \fn info
+    */
+    inline Eigen::ComputationInfo info() const { return m_info; }
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        MISCELLANEOUS                                          |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn compute
+    * \brief Computes the _nbModes lowest modes
+    * \param _matK : stiffness matrix
+    * \param _vecMass : diagonal of the mass matrix
+    * \param _nbModes : number of modes
+    * \param _shift : shift sigma, K - sigma * M must be SPD (e.g., slightly negative if K has rigid modes)
+    * \return : success
+    */
+    bool compute(const SpMat& _matK, const Eigen::VectorXd& _vecMass, int _nbModes, double _shift = 0.0);
+
+    /*!
+    * \fn save
+    * \brief Writes the modes to a binary file
+    * \return : success
+    */
+    bool save(const std::string& _fileName) const;
+
+    /*!
+    * \fn load
+    * \brief Reads the modes from a binary file written by save(), if it was computed with the same K and M
+    *        and has at least _nbModes modes (only the _nbModes lowest are kept)
+    * \return : success
+    */
+    bool load(const std::string& _fileName, const SpMat& _matK, const Eigen::VectorXd& _vecMass, int _nbModes);
+
+    /*!
+    * \fn printStats
+    * \brief Prints number of modes, size of the Krylov basis and range of frequencies
+    */
+    void printStats() const;
+
+
+protected:
+
+    /*!
+    * \fn computeFingerprint
+    * \brief Summary of K and M, which identifies the system of cached modes
+    */
+    Eigen::Vector4d computeFingerprint(const SpMat& _matK, const Eigen::VectorXd& _vecMass) const;
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                         ATTRIBUTES                                            |
+    +-----------------------------------------------------------------------------------------------*/
+
+    Eigen::MatrixXd m_modes;                /*!< M-orthonormal modes, one per column */
+    Eigen::VectorXd m_eigenvalues;          /*!< eigenvalue of each mode, in increasing order */
+    Eigen::Vector4d m_fingerprint = Eigen::Vector4d::Zero(); /*!< summary of K and M of the modes */
+
+    double m_tolerance = 1e-8;              /*!< relative residual tolerance of the eigenpairs */
+    Eigen::Index m_nbLanczosVectors = 0;    /*!< size of the Krylov basis of the last computation */
+
+    Eigen::ComputationInfo m_info = Eigen::InvalidInput;
+
+
+}; // class ModalBasis
+
+} // namespace CompGeom
+
+#endif // MODALBASIS_H
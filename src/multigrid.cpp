@@ -0,0 +1,270 @@
+/*********************************************************************************************************************
+ *
+ * multigrid.cpp
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+
+#include "multigrid.h"
+
+#include <iostream>
+#include <algorithm>
+#include <random>
+#include <cmath>
+#include <assert.h>
+
+
+namespace CompGeom
+{
+
+    bool AlgebraicMultigrid::setup(const SpMat& _matA, int _blockSize)
+    {
+        assert(_matA.rows() == _matA.cols() && _matA.rows() % _blockSize == 0);
+
+        m_levels.clear();
+        m_levels.push_back(MultigridLevel());
+        m_levels.back().m_matA = _matA;
+
+        while (true)
+        {
+            MultigridLevel& level = m_levels.back();
+            const SpMat& matA = level.m_matA;
+
+            level.m_invDiag = matA.diagonal().cwiseInverse();
+            level.m_omega = 4.0 / (3.0 * estimateSpectralRadius(matA, level.m_invDiag));
+
+            if (m_levels.size() >= m_maxLevels || matA.rows() <= m_coarsestSize)
+                break;
+
+            // 1. tentative prolongation: each dof of an aggregate is interpolated from the corresponding coarse dof
+            std::vector<int> aggregates;
+            const int nbAggregates = aggregate(matA, _blockSize, aggregates);
+            const int nbNodes = (int)aggregates.size();
+
+            // stop if coarsening stagnates
+            if (nbAggregates * 10 > nbNodes * 9)
+                break;
+
+            std::vector<int> aggregateSizes(nbAggregates, 0);
+            for (int i = 0; i < nbNodes; i++)
+            {
+                aggregateSizes[aggregates[i]]++;
+            }
+
+            std::vector<Eigen::Triplet<double> > triplets;
+            triplets.reserve(matA.rows());
+            for (int i = 0; i < nbNodes; i++)
+            {
+                // unit norm columns
+                const double value = 1.0 / std::sqrt((double)aggregateSizes[aggregates[i]]);
+                for (int k = 0; k < _blockSize; k++)
+                {
+                    triplets.push_back(Eigen::Triplet<double>(_blockSize * i + k, _blockSize * aggregates[i] + k, value));
+                }
+            }
+            SpMat matP0(matA.rows(), (Eigen::Index)nbAggregates * _blockSize);
+            matP0.setFromTriplets(triplets.begin(), triplets.end());
+
+            // 2. smoothed prolongation P = (I - w * D^-1 * A) * P0
+            SpMat matDAP0 = (level.m_omega * level.m_invDiag).asDiagonal() * (matA * matP0);
+            SpMat matP = matP0 - matDAP0;
+            SpMat matR = matP.transpose();
+
+            // 3. Galerkin coarse matrix
+            MultigridLevel coarseLevel;
+            coarseLevel.m_matA = matR * matA * matP;
+            level.m_matP = matP;
+            level.m_matR = matR;
+
+            m_levels.push_back(coarseLevel);
+        }
+
+        m_info = m_coarsestSolver.compute(m_levels.back().m_matA) ? Eigen::Success : Eigen::NumericalIssue;
+        if (m_info != Eigen::Success)
+        {
+            std::cerr << "AlgebraicMultigrid: factorization of coarsest level failed" << std::endl;
+        }
+
+        return m_info == Eigen::Success;
+    }
+
+
+    int AlgebraicMultigrid::aggregate(const SpMat& _matA, int _blockSize, std::vector<int>& _aggregates) const
+    {
+        const int nbNodes = (int)_matA.rows() / _blockSize;
+
+        // norm of the block (i, j) of each pair of connected nodes
+        std::vector<std::vector<std::pair<int, double> > > blocks(nbNodes);
+        for (int col = 0; col < _matA.outerSize(); col++)
+        {
+            const int j = col / _blockSize;
+            for (SpMat::InnerIterator it(_matA, col); it; ++it)
+            {
+                const int i = (int)it.row() / _blockSize;
+                std::vector<std::pair<int, double> >& blocksI = blocks[i];
+                auto itB = std::find_if(blocksI.begin(), blocksI.end(), [j](const std::pair<int, double>& _b) { return _b.first == j; });
+                if (itB == blocksI.end())
+                    blocksI.push_back(std::make_pair(j, it.value() * it.value()));
+                else
+                    itB->second += it.value() * it.value();
+            }
+        }
+
+        std::vector<double> diagNorms(nbNodes, 0.0);
+        for (int i = 0; i < nbNodes; i++)
+        {
+            for (auto it = blocks[i].begin(); it != blocks[i].end(); ++it)
+            {
+                if (it->first == i)
+                    diagNorms[i] = std::sqrt(it->second);
+            }
+        }
+
+        // strong connections: |A_ij| >= theta * sqrt(|A_ii| * |A_jj|)
+        std::vector<std::vector<int> > strongNeighbors(nbNodes);
+        for (int i = 0; i < nbNodes; i++)
+        {
+            for (auto it = blocks[i].begin(); it != blocks[i].end(); ++it)
+            {
+                const int j = it->first;
+                if (j != i && std::sqrt(it->second) >= m_strengthThreshold * std::sqrt(diagNorms[i] * diagNorms[j]))
+                    strongNeighbors[i].push_back(j);
+            }
+        }
+
+        _aggregates.assign(nbNodes, -1);
+        int nbAggregates = 0;
+
+        // 1. nodes whose strong neighborhood is free start a new aggregate
+        for (int i = 0; i < nbNodes; i++)
+        {
+            if (_aggregates[i] >= 0)
+                continue;
+
+            bool isFree = std::all_of(strongNeighbors[i].begin(), strongNeighbors[i].end(), [&_aggregates](int _j) { return _aggregates[_j] < 0; });
+            if (!isFree)
+                continue;
+
+            _aggregates[i] = nbAggregates;
+            for (auto it = strongNeighbors[i].begin(); it != strongNeighbors[i].end(); ++it)
+            {
+                _aggregates[*it] = nbAggregates;
+            }
+            nbAggregates++;
+        }
+
+        // 2. remaining nodes join an aggregate of a strong neighbor (or form their own)
+        std::vector<int> firstPass = _aggregates;
+        for (int i = 0; i < nbNodes; i++)
+        {
+            if (_aggregates[i] >= 0)
+                continue;
+
+            for (auto it = strongNeighbors[i].begin(); it != strongNeighbors[i].end(); ++it)
+            {
+                if (firstPass[*it] >= 0)
+                {
+                    _aggregates[i] = firstPass[*it];
+                    break;
+                }
+            }
+
+            if (_aggregates[i] < 0)
+            {
+                _aggregates[i] = nbAggregates++;
+            }
+        }
+
+        return nbAggregates;
+    }
+
+
+    double AlgebraicMultigrid::estimateSpectralRadius(const SpMat& _matA, const Eigen::VectorXd& _invDiag) const
+    {
+        // deterministic pseudo-random start vector, which is not close to the near-kernel of A
+        std::mt19937 generator(1234);
+        std::uniform_real_distribution<double> distribution(-1.0, 1.0);
+        Eigen::VectorXd v(_matA.rows());
+        for (Eigen::Index i = 0; i < v.size(); i++)
+        {
+            v[i] = distribution(generator);
+        }
+
+        double rho = 1.0;
+        for (int k = 0; k < 15; k++)
+        {
+            double norm = v.norm();
+            if (norm <= 0.0)
+                break;
+            v /= norm;
+            Eigen::VectorXd w = _invDiag.asDiagonal() * (_matA * v);
+            rho = v.dot(w) > 0.0 ? w.norm() : rho;
+            v = w;
+        }
+
+        // power iterations underestimate rho
+        return 1.1 * rho;
+    }
+
+
+    void AlgebraicMultigrid::vCycle(const Eigen::VectorXd& _b, Eigen::VectorXd& _x) const
+    {
+        if (m_levels.empty())
+        {
+            _x = _b;
+            return;
+        }
+        vCycle(0, _b, _x);
+    }
+
+
+    void AlgebraicMultigrid::vCycle(size_t _level, const Eigen::VectorXd& _b, Eigen::VectorXd& _x) const
+    {
+        const MultigridLevel& level = m_levels[_level];
+
+        if (_level + 1 == m_levels.size())
+        {
+            m_coarsestSolver.solve(_b, _x);
+            return;
+        }
+
+        // pre-smoothing
+        for (unsigned int k = 0; k < m_nbSmoothingSteps; k++)
+        {
+            _x += level.m_omega * level.m_invDiag.cwiseProduct(_b - level.m_matA * _x);
+        }
+
+        // coarse grid correction
+        Eigen::VectorXd coarseB = level.m_matR * (_b - level.m_matA * _x);
+        Eigen::VectorXd coarseX = Eigen::VectorXd::Zero(coarseB.size());
+        vCycle(_level + 1, coarseB, coarseX);
+        _x += level.m_matP * coarseX;
+
+        // post-smoothing
+        for (unsigned int k = 0; k < m_nbSmoothingSteps; k++)
+        {
+            _x += level.m_omega * level.m_invDiag.cwiseProduct(_b - level.m_matA * _x);
+        }
+    }
+
+
+    void AlgebraicMultigrid::printStats() const
+    {
+        if (m_levels.empty())
+            return;
+
+        double nnzTotal = 0.0;
+        std::cout << "AlgebraicMultigrid: " << m_levels.size() << " levels (";
+        for (size_t l = 0; l < m_levels.size(); l++)
+        {
+            nnzTotal += (double)m_levels[l].m_matA.nonZeros();
+            std::cout << m_levels[l].m_matA.rows() << (l + 1 < m_levels.size() ? ", " : "");
+        }
+        std::cout << " dofs), operator complexity: " << nnzTotal / (double)m_levels.front().m_matA.nonZeros() << std::endl;
+    }
+
+
+} // namespace CompGeom
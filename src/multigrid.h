@@ -0,0 +1,162 @@
+/*********************************************************************************************************************
+ *
+ * multigrid.h
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#ifndef MULTIGRID_H
+#define MULTIGRID_H
+
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+
+#include "sparsesolver.h"
+
+
+namespace CompGeom
+{
+
+/*!
+* \class AlgebraicMultigrid
+* \brief Smoothed aggregation algebraic multigrid, for SPD systems A * x = b with block dofs
+*        (e.g., x and y displacements of each node).
+*
+* Each level is coarsened by greedy aggregation of strongly connected nodes,
+* the tentative (piecewise constant) prolongation P0 is smoothed by one damped Jacobi step: P = (I - w * D^-1 * A) * P0,
+* and coarse matrices are Galerkin products A_c = P^T * A * P. The coarsest level is solved with a sparse Cholesky factorization.
+*
+* One V-cycle (damped Jacobi pre- and post-smoothing) is a symmetric operator, so it can be used as a preconditioner for CG.
+*/
+class AlgebraicMultigrid
+{
+    typedef Eigen::SparseMatrix<double> SpMat;
+
+    /*!
+    * \struct MultigridLevel
+    */
+    struct MultigridLevel
+    {
+        SpMat m_matA;               /*!< matrix of the level */
+        Eigen::VectorXd m_invDiag;  /*!< inverse diagonal of A (Jacobi smoother) */
+        double m_omega = 0.0;       /*!< Jacobi damping, 4 / (3 * rho(D^-1 * A)) */
+        SpMat m_matP;               /*!< prolongation to this level, from next coarser level */
+        SpMat m_matR;               /*!< restriction (P^T) */
+    };
+
+
+public:
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        CONSTRUCTORS                                           |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn AlgebraicMultigrid
+    * \brief Default constructor
+    */
+    AlgebraicMultigrid() = default;
+
+    /*!
+    * \fn ~AlgebraicMultigrid
+    * \brief Destructor
+    */
+    virtual ~AlgebraicMultigrid() = default;
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                     GETTERS / SETTERS                                         |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn setParameters
+    * \param _maxLevels : max number of levels
+    * \param _coarsestSize : a level smaller than this is not coarsened (and solved directly)
+    * \param _nbSmoothingSteps : number of pre- and post-smoothing steps
+    */
+    inline void setParameters(unsigned int _maxLevels, unsigned int _coarsestSize, unsigned int _nbSmoothingSteps)
+    { m_maxLevels = _maxLevels; m_coarsestSize = _coarsestSize; m_nbSmoothingSteps = _nbSmoothingSteps; }
+
+    /*!
+    * \fn getNbLevels
+    */
+    inline size_t getNbLevels() const { return m_levels.size(); }
+
+    /*!
+    * \fn info
+    */
+    inline Eigen::ComputationInfo info() const { return m_info; }
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        MISCELLANEOUS                                          |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn setup
+    * \brief Builds the hierarchy of levels
+    * \param _matA : SPD matrix
+    * \param _blockSize : number of dofs per node (dofs of a node are consecutive, and aggregated together)
+    * \return : success
+    */
+    bool setup(const SpMat& _matA, int _blockSize = 2);
+
+    /*!
+    * \fn vCycle
+    * \brief Applies one V-cycle to A * _x = _b, starting from _x
+    */
+    void vCycle(const Eigen::VectorXd& _b, Eigen::VectorXd& _x) const;
+
+    /*!
+    * \fn printStats
+    * \brief Prints size of each level and operator complexity
+    */
+    void printStats() const;
+
+
+protected:
+
+    /*!
+    * \fn aggregate
+    * \brief Greedy aggregation of the nodes of _matA, based on strong connections
+    * \return : number of aggregates
+    */
+    int aggregate(const SpMat& _matA, int _blockSize, std::vector<int>& _aggregates) const;
+
+    /*!
+    * \fn estimateSpectralRadius
+    * \brief Estimates the largest eigenvalue of D^-1 * A with a few power iterations
+    */
+    double estimateSpectralRadius(const SpMat& _matA, const Eigen::VectorXd& _invDiag) const;
+
+    /*!
+    * \fn vCycle
+    * \brief Recursive V-cycle from level _level
+    */
+    void vCycle(size_t _level, const Eigen::VectorXd& _b, Eigen::VectorXd& _x) const;
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                         ATTRIBUTES                                            |
+    +-----------------------------------------------------------------------------------------------*/
+
+    std::vector<MultigridLevel> m_levels;   /*!< levels, from finest to coarsest */
+    SparseSolver m_coarsestSolver;          /*!< direct solver of the coarsest level */
+
+    unsigned int m_maxLevels = 10;          /*!< max number of levels */
+    unsigned int m_coarsestSize = 500;      /*!< min number of dofs of a coarsened level */
+    unsigned int m_nbSmoothingSteps = 2;    /*!< number of Jacobi pre- and post-smoothing steps */
+    double m_strengthThreshold = 0.08;      /*!< threshold of strong connections between nodes */
+
+    Eigen::ComputationInfo m_info = Eigen::InvalidInput;
+
+
+}; // class AlgebraicMultigrid
+
+} // namespace CompGeom
+
+#endif // MULTIGRID_H
@@ -10,6 +10,8 @@
 #include "pbd.h"
 
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 
 
 namespace CompGeom
@@ -38,21 +40,21 @@ namespace CompGeom
 			if( std::find(vertIds.begin(), vertIds.end(), std::make_pair(id0, id1)) == vertIds.end()
 			 && std::find(vertIds.begin(), vertIds.end(), std::make_pair(id1, id0)) == vertIds.end() )
 			{
-				this->addDistanceConstraint(id0, id1, 0.5f);
+				this->addDistanceConstraint(id0, id1, m_compliance);
 				vertIds.push_back(std::make_pair(id0, id1));
 			}
 
 			if( std::find(vertIds.begin(), vertIds.end(), std::make_pair(id1, id2)) == vertIds.end()
 			 && std::find(vertIds.begin(), vertIds.end(), std::make_pair(id2, id1)) == vertIds.end() )
 			{
-				this->addDistanceConstraint(id1, id2, 0.5f);
+				this->addDistanceConstraint(id1, id2, m_compliance);
 				vertIds.push_back(std::make_pair(id1, id2));
 			}
 
 			if( std::find(vertIds.begin(), vertIds.end(), std::make_pair(id2, id0)) == vertIds.end()
 			 && std::find(vertIds.begin(), vertIds.end(), std::make_pair(id0, id2)) == vertIds.end() )
 			{
-				this->addDistanceConstraint(id2, id0, 0.5f);
+				this->addDistanceConstraint(id2, id0, m_compliance);
 				vertIds.push_back(std::make_pair(id2, id0));
 			}
 		}
@@ -64,6 +66,8 @@ namespace CompGeom
 			this->addAnchorConstraint(*it, _verticesPos.at(*it));
 		}
 
+		this->colorConstraints();
+
 		return true;
 	}
 
@@ -93,13 +97,13 @@ namespace CompGeom
 		m_movingConstraints = _movingConstraint;
 	}
 
-	void Pbd::addDistanceConstraint(const unsigned int _idPt1, const unsigned int _idPt2, const float _stiffness)
+	void Pbd::addDistanceConstraint(const unsigned int _idPt1, const unsigned int _idPt2, const float _compliance)
 	{
 		assert(_idPt1 != _idPt2);
 
 		DistanceConstraint distanceConstraint( _idPt1, _idPt2
 											 , m_pointsT.at(_idPt1).getPosition(), m_pointsT.at(_idPt2).getPosition()
-											 , _stiffness );
+											 , _compliance );
         m_distanceConstraints.push_back(distanceConstraint);
 	}
 
@@ -107,6 +111,64 @@ namespace CompGeom
 	{
 		AnchorConstraint anchorConstraint( _idPt, _pos );
         m_anchorConstraints.push_back(anchorConstraint);
+
+		// infinite mass: distance constraints do not move anchored points
+		m_pointsT.at(_idPt).setFixed(true);
+	}
+
+
+	void Pbd::setCompliance(float _compliance)
+	{
+		m_compliance = _compliance;
+		for (auto& distanceConstraint : m_distanceConstraints)
+		{
+			distanceConstraint.m_compliance = _compliance;
+		}
+	}
+
+
+	void Pbd::colorConstraints()
+	{
+		// greedy colouring: each constraint takes the first colour which is not used by a constraint of its vertices
+		std::vector<std::vector<uint32_t> > vertexColors(m_pointsT.size());
+		std::vector<uint32_t> constraintColors(m_distanceConstraints.size());
+		uint32_t nbColors = 0;
+		for (size_t j = 0; j < m_distanceConstraints.size(); j++)
+		{
+			std::vector<uint32_t>& colors1 = vertexColors.at(m_distanceConstraints[j].m_pointsIds.first);
+			std::vector<uint32_t>& colors2 = vertexColors.at(m_distanceConstraints[j].m_pointsIds.second);
+
+			uint32_t color = 0;
+			while (std::find(colors1.begin(), colors1.end(), color) != colors1.end()
+				|| std::find(colors2.begin(), colors2.end(), color) != colors2.end())
+			{
+				color++;
+			}
+
+			constraintColors[j] = color;
+			colors1.push_back(color);
+			colors2.push_back(color);
+			nbColors = std::max(nbColors, color + 1);
+		}
+
+		// constraints of a colour are contiguous (stable: original order within a colour)
+		m_colorOffsets.assign(nbColors + 1, 0);
+		for (size_t j = 0; j < constraintColors.size(); j++)
+		{
+			m_colorOffsets[constraintColors[j] + 1]++;
+		}
+		for (uint32_t c = 0; c < nbColors; c++)
+		{
+			m_colorOffsets[c + 1] += m_colorOffsets[c];
+		}
+
+		std::vector<size_t> positions(m_colorOffsets.begin(), m_colorOffsets.end() - 1);
+		std::vector<DistanceConstraint> sortedConstraints(m_distanceConstraints);
+		for (size_t j = 0; j < m_distanceConstraints.size(); j++)
+		{
+			sortedConstraints[positions[constraintColors[j]]++] = m_distanceConstraints[j];
+		}
+		m_distanceConstraints.swap(sortedConstraints);
 	}
 
 
@@ -114,6 +176,9 @@ namespace CompGeom
 	{
 		m_pointsT.clear();
 		m_pointsTestimate.clear();
+		m_distanceConstraints.clear();
+		m_anchorConstraints.clear();
+		m_colorOffsets.clear();
 	}
 
 
@@ -161,118 +226,116 @@ namespace CompGeom
 		
 	}
 
-	// https://github.com/marcelogm/pbd/blob/master/src/simulation/Simulator.cpp
+	// https://matthias-research.github.io/pages/publications/smallsteps.pdf
     bool Pbd::iterate()
 	{
-		const auto iterations = 10;
-		const auto delta_t = 0.01f;
-		const float dampingFactor = 0.1f;
+		const float h = m_timeStep / (float)m_nbSubsteps;
+
+		// XPBD: alpha~ = alpha / h^2, stiffness only depends on compliance, not on the number of substeps
+		const float invSquaredStep = 1.0f / (h * h);
 
-		// 1. Apply external forces
+		// velocities decay at the same rate whatever the number of substeps
+		const float dampingCoeff = std::exp(-m_damping * h);
+
+		// 1. External forces, constant over the frame
 
 		// F_t
+		clearForces();
 		updateExternalForces();
-		// V_t+1 = V_t + F_t * dt
-		m_integrationEuler.updateVelocitiesFw(m_pointsT, dampingFactor, delta_t);
 
+		// constraints added since initialize() are coloured again
+		if (m_colorOffsets.empty() || m_colorOffsets.back() != m_distanceConstraints.size())
+		{
+			colorConstraints();
+		}
 
-		// 2. Integrate
+		for (unsigned int step = 0; step < m_nbSubsteps; step++)
+		{
+			// 2. Predict
 
-		// copy P_t and V_t in m_pointsTinit
-		//copyPoints(m_pointsT, m_pointsTestimate);
+			// V = V + F / m * h
+			m_integrationEuler.updateVelocitiesFw(m_pointsT, 0.0f, h);
 
-		for (size_t step = 0; step < 10 /*substeps*/; step++)
-		{
+			// estimate P = X + V * h
 			copyPoints(m_pointsT, m_pointsTestimate);
+			m_integrationEuler.updatePositionsBw(m_pointsT, m_pointsTestimate, h);
 
-			// estimate P_t+1 = P_t + V_t+1 * dt
-			m_integrationEuler.updatePositionsBw(m_pointsT, m_pointsTestimate, delta_t);
-		}
 
-	
-		// 3. Solve
-		for (int i = 0; i < iterations; i++)
-		{
-			for(int j=0 ; j<m_distanceConstraints.size(); j++)
+			// 3. Solve: a single iteration, multipliers start from 0 at each substep
+
+			for (size_t c = 0; c + 1 < m_colorOffsets.size(); c++)
 			{
-				project_DistanceConstraint(m_distanceConstraints.at(j), iterations);
+				const int first = (int)m_colorOffsets[c];
+				const int last = (int)m_colorOffsets[c + 1];
+
+				// constraints of a colour share no vertex: they are projected in parallel
+				// (small batches are not worth the threads overhead)
+				#pragma omp parallel for if (last - first > 512)
+				for (int j = first; j < last; j++)
+				{
+					m_distanceConstraints[j].m_lambda = 0.0f;
+					project_DistanceConstraint(m_distanceConstraints[j], m_distanceConstraints[j].m_compliance * invSquaredStep);
+				}
 			}
 			for(int j=0 ; j<m_anchorConstraints.size(); j++)
 			{
 				project_AnchorConstraint(m_anchorConstraints.at(j));
 			}
-		}
-		
-
-		// 4. Update vertices and velocities
-
-		assert(m_pointsTestimate.size() == m_pointsT.size());
 
-        for(int i=0 ; i<m_pointsT.size(); i++)
-        {
-            if(!m_pointsT.at(i).isFixed())
-            {
-				const auto p = m_pointsTestimate.at(i).getPosition(); 
-				const auto x = m_pointsT.at(i).getPosition();
-                const glm::vec3 newVel = (1.0f / delta_t) * (p - x);
-                m_pointsT.at(i).setVelocity(newVel);
-				m_pointsT.at(i).setPosition(p);
-            }
-			else
-			{
-				m_pointsT.at(i).setVelocity(glm::vec3(0.0));
-			}
-        }
 
+			// 4. Update vertices and velocities: V = (P - X) / h, X = P
 
-		// 5. Velocity update: dump velocities
+			assert(m_pointsTestimate.size() == m_pointsT.size());
 
-		for(int i=0 ; i<m_pointsT.size(); i++)
-        {
-            if(!m_pointsT.at(i).isFixed())
-            {
-                const glm::vec3 newVel = m_pointsT.at(i).getVelocity() * 0.00998f; // @@@ 0.998f
-                m_pointsT.at(i).setVelocity(newVel);
-            }
-			else
+			for(int i=0 ; i<m_pointsT.size(); i++)
 			{
-				m_pointsT.at(i).setVelocity(glm::vec3(0.0));
+				if(!m_pointsT.at(i).isFixed())
+				{
+					const auto p = m_pointsTestimate.at(i).getPosition();
+					const auto x = m_pointsT.at(i).getPosition();
+					const glm::vec3 newVel = (dampingCoeff / h) * (p - x);
+					m_pointsT.at(i).setVelocity(newVel);
+					m_pointsT.at(i).setPosition(p);
+				}
+				else
+				{
+					m_pointsT.at(i).setVelocity(glm::vec3(0.0));
+				}
 			}
-        }
+		}
+
 		return true;
 	}
 
-	void Pbd::project_DistanceConstraint(DistanceConstraint& _distanceConstraint, int _nbIterations)
+	void Pbd::project_DistanceConstraint(DistanceConstraint& _distanceConstraint, float _alphaTilde)
 	{
-		auto stiffness = _distanceConstraint.m_stiffness;
-
-		//auto object = current->getObject();
 		auto i1 = _distanceConstraint.m_pointsIds.first;
 		auto i2 = _distanceConstraint.m_pointsIds.second;
-		auto p1 = m_pointsTestimate.at(i1).getPosition();
-		auto p2 = m_pointsTestimate.at(i2).getPosition();
-
-		// distance_constraint = | x_{1,2} - d |
-		//auto error = glm::l2Norm(p1 - p2) - distance;
-		glm::vec3 springVec = p2 - p1;
-        float error = glm::length(springVec) - _distanceConstraint.m_restLength;
-        
-
-		// gradient_x_1 C(x_1, x_2) = n
-		// gradient_x_2 C(x_1, x_2) = -n
-		// n = x_{1,2} / | x_{1,2} |
-		//glm::vec3 gradient = (p1 - p2) / (float)(glm::l2Norm(p1 - p2) + 0.1);
-		glm::vec3 gradient = (p1 - p2) / (float)(glm::length(p1 - p2) + 0.1);
-
-		glm::vec3 delta_p_1 = _distanceConstraint.m_scalar_1 * -error * gradient;
-		glm::vec3 delta_p_2 = _distanceConstraint.m_scalar_2 * error * gradient;
-
-		// k = 1 ? (1 ? k)^(1/ns)
-		auto k = 1.f - pow(1.f - stiffness, 1.f / float(_nbIterations));
-
-		// delta_x_1 = - (w_1 / (w_1 + w_2)) * (| x_{1,2} - d |) * n
-		m_pointsTestimate.at(i1).setPosition(p1 + k * delta_p_1);
-		m_pointsTestimate.at(i2).setPosition(p2 + k * delta_p_2);
+		Point& pt1 = m_pointsTestimate.at(i1);
+		Point& pt2 = m_pointsTestimate.at(i2);
+		auto p1 = pt1.getPosition();
+		auto p2 = pt2.getPosition();
+
+		// inverse masses (0 for fixed points)
+		const float w_1 = pt1.isFixed() ? 0.0f : 1.0f / pt1.getMass();
+		const float w_2 = pt2.isFixed() ? 0.0f : 1.0f / pt2.getMass();
+
+		// C(x_1, x_2) = | x_{1,2} | - d
+		float length = glm::length(p1 - p2);
+		if (w_1 + w_2 + _alphaTilde <= 0.0f || length < 1e-7f)
+			return;
+		float error = length - _distanceConstraint.m_restLength;
+
+		// gradient_x_1 C = n, gradient_x_2 C = -n, with n = x_{1,2} / | x_{1,2} |
+		glm::vec3 gradient = (p1 - p2) / length;
+
+		// delta_lambda = (-C - alpha~ * lambda) / (w_1 + w_2 + alpha~)
+		float deltaLambda = (-error - _alphaTilde * _distanceConstraint.m_lambda) / (w_1 + w_2 + _alphaTilde);
+		_distanceConstraint.m_lambda += deltaLambda;
+
+		// delta_x_i = w_i * delta_lambda * gradient_x_i C
+		pt1.setPosition(p1 + w_1 * deltaLambda * gradient);
+		pt2.setPosition(p2 - w_2 * deltaLambda * gradient);
 	}
 
 	void Pbd::project_AnchorConstraint(AnchorConstraint& _anchorConstraint)
@@ -14,6 +14,8 @@
 
 #include "numericalintegration.h"
 
+#include <algorithm>
+
 
 namespace CompGeom
 {
@@ -36,37 +38,34 @@ class DistanceConstraint
 {
 public:
 
-    void precomputeInverseMassCoeff() 
-    {
-	    auto w_1 = 1.0; //current->getObject()->getMasses()->at(i1).inverse;
-	    auto w_2 = 1.0; //current->getObject()->getMasses()->at(i2).inverse;
-	    // inverse masses precomputation
-	    m_scalar_1 = 1.f / (w_1 / (w_1 + w_2));
-	    m_scalar_2 = 1.f / (w_2 / (w_1 + w_2));
-    }
-
     DistanceConstraint( const unsigned int _id1, const unsigned int _id2
                       , glm::vec3& _p1, glm::vec3& _p2
-                      , float _stiffness)
+                      , float _compliance)
         : m_pointsIds(_id1, _id2)
-        , m_stiffness(_stiffness)
+        , m_compliance(_compliance)
         , m_restLength( glm::length(_p1 - _p2) )
-    {
-        precomputeInverseMassCoeff() ;
-    }
+    {}
 
     std::pair<unsigned int, unsigned int> m_pointsIds; /*!< adjacent points */
-    float m_stiffness  = 0.25f;          /*!< stiffness factor */
+    float m_compliance = 0.0f;           /*!< inverse stiffness (0 = inextensible) */
     float m_restLength = 0.0f;           /*!< resting length */
-
-    float m_scalar_1 = 0.0f;
-    float m_scalar_2 = 0.0f;
+    float m_lambda     = 0.0f;           /*!< Lagrange multiplier of the current substep */
 };
 
 
 /*!
 * \class Pbd
-* \brief Position Based Dynamics
+* \brief Position Based Dynamics, with compliant constraints (XPBD)
+*
+* Each frame of duration dt is split into n substeps of duration h = dt / n ("small steps" XPBD).
+* Each substep predicts positions from velocities and forces, runs one projection of all constraints, then
+* derives velocities from the corrected positions. A constraint C with compliance alpha is projected by
+* d_lambda = (-C - alpha~ * lambda) / (w_1 + w_2 + alpha~), with alpha~ = alpha / h^2 and w_i the inverse masses,
+* so stiffness does not depend on the number of substeps or iterations (unlike the PBD stiffness factor).
+*
+* Distance constraints are projected in Gauss-Seidel order. Constraints which share a vertex conflict,
+* so they are grouped by colour (greedy colouring of the constraint graph): constraints of the same colour
+* are independent and projected in parallel, colours are processed one after another.
 */
 class Pbd : public DynamicalModel
 {
@@ -100,6 +99,25 @@ public:
     */
     inline std::vector<Point>& getPointsT() { return m_pointsT; }
 
+    /*!
+    * \fn setTimeStep
+    * \brief Sets the duration of a frame (one iterate()) and its number of substeps
+    *        (positions are single precision: force increments h^2 * f / m vanish for very small substeps)
+    */
+    inline void setTimeStep(float _timeStep, unsigned int _nbSubsteps) { m_timeStep = _timeStep; m_nbSubsteps = std::max(_nbSubsteps, 1u); }
+
+    /*!
+    * \fn setCompliance
+    * \brief Sets the compliance (inverse stiffness) of all distance constraints
+    */
+    void setCompliance(float _compliance);
+
+    /*!
+    * \fn setDamping
+    * \brief Sets the velocity damping rate, in 1/s (velocities are scaled by exp(-_damping * h) at each substep)
+    */
+    inline void setDamping(float _damping) { m_damping = _damping; }
+
 
     /*----------------------------------------------------------------------------------------------+
     |                                        MISCELLANEOUS                                          |
@@ -166,12 +184,27 @@ public:
     */
     void updateInternalForces();
 
-    void project_DistanceConstraint(DistanceConstraint& _distanceConstraint, int _nbIterations);
+    /*!
+    * \fn project_DistanceConstraint
+    * \brief XPBD projection of a distance constraint, with _alphaTilde = compliance / h^2
+    */
+    void project_DistanceConstraint(DistanceConstraint& _distanceConstraint, float _alphaTilde);
     void project_AnchorConstraint(AnchorConstraint& _anchorConstraint);
 
-    void addDistanceConstraint(const unsigned int _idPt1, const unsigned int _idPt2, const float _stiffness);
+    void addDistanceConstraint(const unsigned int _idPt1, const unsigned int _idPt2, const float _compliance);
     void addAnchorConstraint(const unsigned int _idPt, const glm::vec3& _pos);
 
+    /*!
+    * \fn colorConstraints
+    * \brief Sorts distance constraints by colour, such that constraints of a colour share no vertex
+    */
+    void colorConstraints();
+
+    /*!
+    * \fn getNbColors
+    */
+    inline size_t getNbColors() const { return m_colorOffsets.empty() ? 0 : m_colorOffsets.size() - 1; }
+
 protected:
 
     /*----------------------------------------------------------------------------------------------+
@@ -182,13 +215,19 @@ protected:
 
     std::vector<Point> m_pointsTestimate;
 
-    std::vector<DistanceConstraint> m_distanceConstraints;
+    std::vector<DistanceConstraint> m_distanceConstraints; /*!< distance constraints, sorted by colour */
+    std::vector<size_t> m_colorOffsets;                    /*!< first constraint of each colour, then number of constraints */
     std::vector<AnchorConstraint> m_anchorConstraints;
 
     std::vector<std::pair<uint32_t, glm::vec3> > m_movingConstraints;
 
     NumericalIntegrationEuler m_integrationEuler;
 
+    float m_timeStep = 0.01f;           /*!< duration of a frame */
+    unsigned int m_nbSubsteps = 10;     /*!< substeps per frame (one constraint projection per substep) */
+    float m_compliance = 1e-3f;         /*!< compliance of distance constraints */
+    float m_damping = 10.0f;            /*!< velocity damping rate (1/s) */
+
 
 }; // class Pbd
 
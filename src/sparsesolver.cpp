@@ -0,0 +1,358 @@
+/*********************************************************************************************************************
+ *
+ * sparsesolver.cpp
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+
+#include "sparsesolver.h"
+
+#include <iostream>
+#include <chrono>
+#include <assert.h>
+
+
+namespace CompGeom
+{
+
+    void computeNestedDissection(const std::vector<std::vector<int> >& _adjacency, std::vector<int>& _order)
+    {
+        // subgraphs smaller than this are not split anymore
+        const size_t minSubgraphSize = 64;
+
+        const int n = (int)_adjacency.size();
+        _order.clear();
+        _order.reserve(n);
+
+        // stamp of the subgraph each node currently belongs to
+        std::vector<int> stamps(n, -1);
+        std::vector<int> levels(n, -1);
+        int curStamp = 0;
+
+        // BFS restricted to nodes with the current stamp, returns visited nodes (sorted by level)
+        auto bfs = [&](int _start, std::vector<int>& _visited)
+        {
+            _visited.clear();
+            _visited.push_back(_start);
+            levels[_start] = 0;
+            for (size_t k = 0; k < _visited.size(); k++)
+            {
+                int i = _visited[k];
+                for (int j : _adjacency[i])
+                {
+                    if (stamps[j] == curStamp && levels[j] < 0)
+                    {
+                        levels[j] = levels[i] + 1;
+                        _visited.push_back(j);
+                    }
+                }
+            }
+        };
+
+        // stack of subgraphs to split, and of separators to append once both halves are ordered
+        // (flag is true for separators, which are appended as is)
+        std::vector<std::pair<bool, std::vector<int> > > stack;
+        std::vector<int> all(n);
+        for (int i = 0; i < n; i++)
+            all[i] = i;
+        stack.push_back(std::make_pair(false, all));
+
+        std::vector<int> visited;
+        while (!stack.empty())
+        {
+            std::pair<bool, std::vector<int> > item = std::move(stack.back());
+            stack.pop_back();
+            std::vector<int>& nodes = item.second;
+
+            if (item.first || nodes.size() <= minSubgraphSize)
+            {
+                // separator or small subgraph: eliminate in current order
+                _order.insert(_order.end(), nodes.begin(), nodes.end());
+                continue;
+            }
+
+            // mark subgraph
+            curStamp++;
+            for (int i : nodes)
+            {
+                stamps[i] = curStamp;
+                levels[i] = -1;
+            }
+
+            // pseudo-peripheral node: farthest node from an arbitrary start, found twice
+            bfs(nodes.front(), visited);
+            int start = visited.back();
+            for (int i : visited)
+                levels[i] = -1;
+            bfs(start, visited);
+
+            if (visited.size() < nodes.size())
+            {
+                // disconnected subgraph: split into the reached component and the remaining nodes
+                std::vector<int> rest;
+                for (int i : nodes)
+                {
+                    if (levels[i] < 0)
+                        rest.push_back(i);
+                }
+                stack.push_back(std::make_pair(false, rest));
+                stack.push_back(std::make_pair(false, visited));
+                continue;
+            }
+
+            // separator: level containing the median node
+            int sepLevel = levels[visited[visited.size() / 2]];
+            std::vector<int> partA, partB, separator;
+            for (int i : visited)
+            {
+                if (levels[i] < sepLevel)
+                    partA.push_back(i);
+                else if (levels[i] > sepLevel)
+                    partB.push_back(i);
+                else
+                    separator.push_back(i);
+            }
+
+            // order A, then B, then separator (stack is LIFO)
+            stack.push_back(std::make_pair(true, separator));
+            stack.push_back(std::make_pair(false, partB));
+            stack.push_back(std::make_pair(false, partA));
+        }
+    }
+
+
+    void SparseSolver::setType(eSparseSolverType _type)
+    {
+#ifndef USE_CHOLMOD
+        if (_type == eSparseSolverType::SUPERNODAL_LLT)
+        {
+            std::cerr << "SparseSolver: supernodal backend requires USE_CHOLMOD, using SimplicialLLT (AMD) instead" << std::endl;
+            _type = eSparseSolverType::SIMPLICIAL_LLT_AMD;
+        }
+#endif
+        m_type = _type;
+        m_info = Eigen::InvalidInput;
+        m_nnzL = 0;
+        m_triSolver.clear();
+    }
+
+
+    void SparseSolver::setLevelScheduling(bool _useLevelScheduling)
+    {
+        m_useLevelScheduling = _useLevelScheduling;
+        m_triSolver.clear();
+        if (m_useLevelScheduling && m_info == Eigen::Success)
+        {
+            updateTriangularSolver();
+        }
+    }
+
+
+    std::string SparseSolver::getName() const
+    {
+        switch (m_type)
+        {
+            case eSparseSolverType::SIMPLICIAL_LLT_AMD:     return "SimplicialLLT (AMD)";
+            case eSparseSolverType::SIMPLICIAL_LLT_NATURAL: return "SimplicialLLT (natural)";
+#ifdef USE_METIS
+            case eSparseSolverType::SIMPLICIAL_LLT_ND:      return "SimplicialLLT (METIS)";
+#else
+            case eSparseSolverType::SIMPLICIAL_LLT_ND:      return "SimplicialLLT (nested dissection)";
+#endif
+            case eSparseSolverType::SIMPLICIAL_LDLT_AMD:    return "SimplicialLDLT (AMD)";
+            case eSparseSolverType::SUPERNODAL_LLT:         return "CholmodSupernodalLLT";
+        }
+        return "Unknown";
+    }
+
+
+    void SparseSolver::analyzePattern(const SpMat& _matA)
+    {
+        auto startTime = std::chrono::steady_clock::now();
+
+        switch (m_type)
+        {
+            case eSparseSolverType::SIMPLICIAL_LLT_AMD:     m_lltAmd.analyzePattern(_matA); break;
+            case eSparseSolverType::SIMPLICIAL_LLT_NATURAL: m_lltNatural.analyzePattern(_matA); break;
+            case eSparseSolverType::SIMPLICIAL_LLT_ND:      m_lltNd.analyzePattern(_matA); break;
+            case eSparseSolverType::SIMPLICIAL_LDLT_AMD:    m_ldltAmd.analyzePattern(_matA); break;
+            case eSparseSolverType::SUPERNODAL_LLT:
+#ifdef USE_CHOLMOD
+                m_supernodal.analyzePattern(_matA);
+#endif
+                break;
+        }
+
+        m_analyzeTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    }
+
+
+    bool SparseSolver::factorize(const SpMat& _matA)
+    {
+        auto startTime = std::chrono::steady_clock::now();
+
+        switch (m_type)
+        {
+            case eSparseSolverType::SIMPLICIAL_LLT_AMD:
+            {
+                m_lltAmd.factorize(_matA);
+                m_info = m_lltAmd.info();
+                m_nnzL = m_lltAmd.matrixL().nestedExpression().nonZeros();
+                break;
+            }
+            case eSparseSolverType::SIMPLICIAL_LLT_NATURAL:
+            {
+                m_lltNatural.factorize(_matA);
+                m_info = m_lltNatural.info();
+                m_nnzL = m_lltNatural.matrixL().nestedExpression().nonZeros();
+                break;
+            }
+            case eSparseSolverType::SIMPLICIAL_LLT_ND:
+            {
+                m_lltNd.factorize(_matA);
+                m_info = m_lltNd.info();
+                m_nnzL = m_lltNd.matrixL().nestedExpression().nonZeros();
+                break;
+            }
+            case eSparseSolverType::SIMPLICIAL_LDLT_AMD:
+            {
+                m_ldltAmd.factorize(_matA);
+                m_info = m_ldltAmd.info();
+                // unit diagonal of L is not stored, D is
+                m_nnzL = m_ldltAmd.matrixL().nestedExpression().nonZeros() + m_ldltAmd.vectorD().size();
+                break;
+            }
+            case eSparseSolverType::SUPERNODAL_LLT:
+            {
+#ifdef USE_CHOLMOD
+                m_supernodal.factorize(_matA);
+                m_info = m_supernodal.info();
+                m_nnzL = (Eigen::Index)m_supernodal.cholmod().lnz;
+#endif
+                break;
+            }
+        }
+
+        m_factorizeTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+        m_triSolver.clear();
+        if (m_useLevelScheduling && m_info == Eigen::Success)
+        {
+            updateTriangularSolver();
+        }
+
+        return m_info == Eigen::Success;
+    }
+
+
+    bool SparseSolver::compute(const SpMat& _matA)
+    {
+        analyzePattern(_matA);
+        return factorize(_matA);
+    }
+
+
+    void SparseSolver::updateTriangularSolver()
+    {
+        switch (m_type)
+        {
+            case eSparseSolverType::SIMPLICIAL_LLT_AMD:     m_triSolver.analyze(m_lltAmd.matrixL().nestedExpression()); break;
+            case eSparseSolverType::SIMPLICIAL_LLT_NATURAL: m_triSolver.analyze(m_lltNatural.matrixL().nestedExpression()); break;
+            case eSparseSolverType::SIMPLICIAL_LLT_ND:      m_triSolver.analyze(m_lltNd.matrixL().nestedExpression()); break;
+            case eSparseSolverType::SIMPLICIAL_LDLT_AMD:    m_triSolver.analyze(m_ldltAmd.matrixL().nestedExpression(), m_ldltAmd.vectorD()); break;
+            case eSparseSolverType::SUPERNODAL_LLT:         break; // factor is not accessible, backend solve is used
+        }
+    }
+
+
+    bool SparseSolver::solveTriangular(const Eigen::Ref<const Eigen::MatrixXd>& _matB, Eigen::Ref<Eigen::MatrixXd> _matX) const
+    {
+        if (m_triSolver.isEmpty())
+        {
+            return false;
+        }
+
+        // A = P^-1 * L * L^T * P
+        TriangularSolver::RowMatrixXd matTmp;
+        switch (m_type)
+        {
+            case eSparseSolverType::SIMPLICIAL_LLT_AMD:
+                matTmp = m_lltAmd.permutationP() * _matB;
+                m_triSolver.solveInPlace(matTmp);
+                _matX = m_lltAmd.permutationPinv() * matTmp;
+                return true;
+            case eSparseSolverType::SIMPLICIAL_LLT_NATURAL:
+                matTmp = _matB;
+                m_triSolver.solveInPlace(matTmp);
+                _matX = matTmp;
+                return true;
+            case eSparseSolverType::SIMPLICIAL_LLT_ND:
+                matTmp = m_lltNd.permutationP() * _matB;
+                m_triSolver.solveInPlace(matTmp);
+                _matX = m_lltNd.permutationPinv() * matTmp;
+                return true;
+            case eSparseSolverType::SIMPLICIAL_LDLT_AMD:
+                matTmp = m_ldltAmd.permutationP() * _matB;
+                m_triSolver.solveInPlace(matTmp);
+                _matX = m_ldltAmd.permutationPinv() * matTmp;
+                return true;
+            case eSparseSolverType::SUPERNODAL_LLT:
+                break;
+        }
+        return false;
+    }
+
+
+    void SparseSolver::solveBlock(const Eigen::Ref<const Eigen::MatrixXd>& _matB, Eigen::Ref<Eigen::MatrixXd> _matX)
+    {
+        assert(_matB.rows() == _matX.rows() && _matB.cols() == _matX.cols());
+
+        if (m_triSolver.isEmpty() && m_info == Eigen::Success)
+        {
+            updateTriangularSolver();
+        }
+        if (!solveTriangular(_matB, _matX))
+        {
+            solve(_matB, _matX);
+        }
+    }
+
+
+    void SparseSolver::solve(const Eigen::Ref<const Eigen::MatrixXd>& _matB, Eigen::Ref<Eigen::MatrixXd> _matX) const
+    {
+        assert(_matB.rows() == _matX.rows() && _matB.cols() == _matX.cols());
+
+        if (m_useLevelScheduling && solveTriangular(_matB, _matX))
+        {
+            return;
+        }
+
+        switch (m_type)
+        {
+            case eSparseSolverType::SIMPLICIAL_LLT_AMD:     _matX = m_lltAmd.solve(_matB); break;
+            case eSparseSolverType::SIMPLICIAL_LLT_NATURAL: _matX = m_lltNatural.solve(_matB); break;
+            case eSparseSolverType::SIMPLICIAL_LLT_ND:      _matX = m_lltNd.solve(_matB); break;
+            case eSparseSolverType::SIMPLICIAL_LDLT_AMD:    _matX = m_ldltAmd.solve(_matB); break;
+            case eSparseSolverType::SUPERNODAL_LLT:
+#ifdef USE_CHOLMOD
+                _matX = m_supernodal.solve(Eigen::MatrixXd(_matB));
+#endif
+                break;
+        }
+    }
+
+
+    void SparseSolver::printStats() const
+    {
+        std::string success = m_info == Eigen::Success ? "Success" : m_info == Eigen::NumericalIssue ? "NumericalIssue" : "Unknown";
+        std::cout << getName() << " computation: " << success
+                  << ", nnz(L) = " << m_nnzL
+                  << ", analysis: " << m_analyzeTime << " ms"
+                  << ", factorization: " << m_factorizeTime << " ms" << std::endl;
+    }
+
+
+} // namespace CompGeom
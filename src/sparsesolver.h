@@ -0,0 +1,285 @@
+/*********************************************************************************************************************
+ *
+ * sparsesolver.h
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#ifndef SPARSESOLVER_H
+#define SPARSESOLVER_H
+
+#include <vector>
+#include <string>
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+#include <Eigen/SparseCholesky>
+#include <Eigen/OrderingMethods>
+
+#ifdef USE_METIS
+#include <Eigen/MetisSupport>
+#endif
+
+#ifdef USE_CHOLMOD
+#include <Eigen/CholmodSupport>
+#endif
+
+#include "triangularsolver.h"
+
+
+namespace CompGeom
+{
+
+    /*!
+     * List of sparse direct solvers (for symmetric positive definite matrices)
+     */
+    enum class eSparseSolverType
+    {
+        SIMPLICIAL_LLT_AMD,      /* simplicial LL^T, approximate minimum degree ordering */
+        SIMPLICIAL_LLT_NATURAL,  /* simplicial LL^T, no fill-reducing ordering */
+        SIMPLICIAL_LLT_ND,       /* simplicial LL^T, nested dissection ordering (METIS if USE_METIS is defined) */
+        SIMPLICIAL_LDLT_AMD,     /* simplicial LDL^T, approximate minimum degree ordering */
+        SUPERNODAL_LLT           /* supernodal LL^T (CHOLMOD, if USE_CHOLMOD is defined, SIMPLICIAL_LLT_AMD otherwise) */
+    };
+
+
+/*!
+* \fn computeNestedDissection
+* \brief Computes a nested dissection elimination order of a graph:
+*        each (sub)graph is split by a BFS level-set separator, both halves are ordered recursively,
+*        and the separator is eliminated last
+* \param _adjacency : neighbors of each node
+* \param _order : nodes in elimination order
+*/
+void computeNestedDissection(const std::vector<std::vector<int> >& _adjacency, std::vector<int>& _order);
+
+
+/*!
+* \class NestedDissectionOrdering
+* \brief Fill-reducing ordering functor for Eigen sparse solvers, based on computeNestedDissection()
+*/
+template<typename StorageIndex>
+class NestedDissectionOrdering
+{
+public:
+    typedef Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, StorageIndex> PermutationType;
+
+    template <typename MatrixType>
+    void operator() (const MatrixType& _mat, PermutationType& _perm)
+    {
+        const int n = (int)_mat.cols();
+
+        // graph of the (symmetric) matrix pattern
+        std::vector<std::vector<int> > adjacency(n);
+        for (int j = 0; j < n; j++)
+        {
+            for (typename MatrixType::InnerIterator it(_mat, j); it; ++it)
+            {
+                int i = (int)it.index();
+                if (i != j)
+                {
+                    adjacency[i].push_back(j);
+                    adjacency[j].push_back(i);
+                }
+            }
+        }
+
+        std::vector<int> order;
+        computeNestedDissection(adjacency, order);
+
+        // k-th eliminated node
+        _perm.resize(n);
+        for (int k = 0; k < n; k++)
+        {
+            _perm.indices()(k) = StorageIndex(order[k]);
+        }
+    }
+};
+
+
+/*!
+* \class SparseSolver
+* \brief Sparse direct solver for SPD systems A * x = b, with selectable backend and fill-reducing ordering.
+*
+* The symbolic analysis (ordering, elimination tree) only depends on the sparsity pattern of A,
+* so it can be done once with analyzePattern(), and factorize() can then be called each time the values of A change.
+*/
+class SparseSolver
+{
+    typedef Eigen::SparseMatrix<double> SpMat;
+
+    typedef Eigen::SimplicialLLT<SpMat, Eigen::Lower, Eigen::AMDOrdering<int> > SimplicialLLTAmd;
+    typedef Eigen::SimplicialLLT<SpMat, Eigen::Lower, Eigen::NaturalOrdering<int> > SimplicialLLTNatural;
+#ifdef USE_METIS
+    typedef Eigen::SimplicialLLT<SpMat, Eigen::Lower, Eigen::MetisOrdering<int> > SimplicialLLTNd;
+#else
+    typedef Eigen::SimplicialLLT<SpMat, Eigen::Lower, NestedDissectionOrdering<int> > SimplicialLLTNd;
+#endif
+    typedef Eigen::SimplicialLDLT<SpMat, Eigen::Lower, Eigen::AMDOrdering<int> > SimplicialLDLTAmd;
+#ifdef USE_CHOLMOD
+    typedef Eigen::CholmodSupernodalLLT<SpMat, Eigen::Lower> SupernodalLLT;
+#endif
+
+
+public:
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        CONSTRUCTORS                                           |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn SparseSolver
+    * \brief Default constructor
+    */
+    SparseSolver() = default;
+
+    /*!
+    * \fn ~SparseSolver
+    * \brief Destructor
+    */
+    virtual ~SparseSolver() = default;
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                     GETTERS / SETTERS                                         |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn setType
+    * \brief Selects the backend (analyzePattern() must be called again after this)
+    */
+    void setType(eSparseSolverType _type);
+
+    /*!
+    * \fn getType
+    */
+    inline eSparseSolverType getType() const { return m_type; }
+
+    /*!
+    * \fn setLevelScheduling
+    * \brief Uses level-scheduled parallel triangular solves (simplicial backends only)
+    */
+    void setLevelScheduling(bool _useLevelScheduling);
+
+    /*!
+    * \fn getNnzL
+    * \brief Returns the number of non-zeros in the factor L (i.e., fill-in)
+    */
+    inline Eigen::Index getNnzL() const { return m_nnzL; }
+
+    /*!
+    * \fn getAnalyzeTime
+    * \brief Returns the duration of the last symbolic analysis (in ms)
+    */
+    inline double getAnalyzeTime() const { return m_analyzeTime; }
+
+    /*!
+    * \fn getFactorizeTime
+    * \brief Returns the duration of the last numerical factorization (in ms)
+    */
+    inline double getFactorizeTime() const { return m_factorizeTime; }
+
+    /*!
+    * \fn info
+    * \brief Returns the status of the last factorization
+    */
+    inline Eigen::ComputationInfo info() const { return m_info; }
+
+    /*!
+    * \fn getName
+    * \brief Returns a readable name for the current backend
+    */
+    std::string getName() const;
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        MISCELLANEOUS                                          |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn analyzePattern
+    * \brief Symbolic analysis, depends only on the sparsity pattern of _matA
+    */
+    void analyzePattern(const SpMat& _matA);
+
+    /*!
+    * \fn factorize
+    * \brief Numerical factorization, requires a previous call to analyzePattern() with the same pattern
+    * \return : success
+    */
+    bool factorize(const SpMat& _matA);
+
+    /*!
+    * \fn compute
+    * \brief analyzePattern() + factorize()
+    * \return : success
+    */
+    bool compute(const SpMat& _matA);
+
+    /*!
+    * \fn solve
+    * \brief Solves A * _matX = _matB, for all columns of _matB (_matX must have the same size as _matB)
+    */
+    void solve(const Eigen::Ref<const Eigen::MatrixXd>& _matB, Eigen::Ref<Eigen::MatrixXd> _matX) const;
+
+    /*!
+    * \fn solveBlock
+    * \brief Same as solve(), with one blocked substitution for all columns of _matB (each entry of L is read once
+    *        for all columns), by the level-scheduled solver, which is built on the first call after each factorization.
+    *        The backend solve is used for SUPERNODAL_LLT.
+    */
+    void solveBlock(const Eigen::Ref<const Eigen::MatrixXd>& _matB, Eigen::Ref<Eigen::MatrixXd> _matX);
+
+    /*!
+    * \fn printStats
+    * \brief Prints fill-in and timings of the last factorization
+    */
+    void printStats() const;
+
+
+protected:
+
+    /*!
+    * \fn updateTriangularSolver
+    * \brief Copies the current factor into the level-scheduled solver
+    */
+    void updateTriangularSolver();
+
+    /*!
+    * \fn solveTriangular
+    * \brief Solves with the level-scheduled solver
+    * \return : false if it is not available (SUPERNODAL_LLT, or not built)
+    */
+    bool solveTriangular(const Eigen::Ref<const Eigen::MatrixXd>& _matB, Eigen::Ref<Eigen::MatrixXd> _matX) const;
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                         ATTRIBUTES                                            |
+    +-----------------------------------------------------------------------------------------------*/
+
+    eSparseSolverType m_type = eSparseSolverType::SIMPLICIAL_LLT_AMD;  /*!< selected backend */
+
+    SimplicialLLTAmd m_lltAmd;
+    SimplicialLLTNatural m_lltNatural;
+    SimplicialLLTNd m_lltNd;
+    SimplicialLDLTAmd m_ldltAmd;
+#ifdef USE_CHOLMOD
+    SupernodalLLT m_supernodal;
+#endif
+
+    bool m_useLevelScheduling = false;  /*!< solve with m_triSolver instead of the backend */
+    TriangularSolver m_triSolver;       /*!< level-scheduled triangular solver */
+
+    Eigen::ComputationInfo m_info = Eigen::InvalidInput;  /*!< status of last factorization */
+    Eigen::Index m_nnzL = 0;            /*!< number of non-zeros in L */
+    double m_analyzeTime = 0.0;         /*!< symbolic analysis duration (ms) */
+    double m_factorizeTime = 0.0;       /*!< numerical factorization duration (ms) */
+
+
+}; // class SparseSolver
+
+} // namespace CompGeom
+
+#endif // SPARSESOLVER_H
@@ -0,0 +1,381 @@
+/*********************************************************************************************************************
+ *
+ * tetarap.cpp
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+
+#include "tetarap.h"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+
+
+namespace CompGeom
+{
+
+    // local indices of the 6 edges of a tetrahedron
+    static const int s_tetEdges[6][2] = { {0, 1}, {0, 2}, {0, 3}, {1, 2}, {1, 3}, {2, 3} };
+
+
+    bool TetArap::initialize( std::vector<glm::vec3>& _verticesPos
+                            , std::vector<uint32_t>& _indices
+                            , std::vector<uint32_t>& _fixedPointsIds
+                            , std::vector<std::pair<uint32_t, glm::vec3> >& _constraintPoints)
+    {
+        if (_indices.size() % 4 != 0)
+        {
+            std::cerr << "TetArap::initialize(): number of indices is not a multiple of 4" << std::endl;
+            return false;
+        }
+
+        const size_t nbVert = _verticesPos.size();
+        m_initVertices = _verticesPos;
+        m_tets = _indices;
+
+        const size_t nbTets = m_tets.size() / 4;
+
+        // 1. element edges incident to each vertex (an edge shared by several tetrahedra appears once per element)
+        m_vertexEdges.clear();
+        m_vertexEdges.resize(nbVert);
+        for (uint32_t t = 0; t < nbTets; t++)
+        {
+            for (int e = 0; e < 6; e++)
+            {
+                uint32_t i = m_tets.at(4 * t + s_tetEdges[e][0]);
+                uint32_t j = m_tets.at(4 * t + s_tetEdges[e][1]);
+                m_vertexEdges.at(i).push_back(std::make_pair(j, t));
+                m_vertexEdges.at(j).push_back(std::make_pair(i, t));
+            }
+        }
+
+        // 2. anchors: fixed points at their initial position, moving anchors start at their initial position
+        m_anchorsMap.clear();
+        for (auto it = _fixedPointsIds.begin(); it != _fixedPointsIds.end(); ++it)
+        {
+            m_anchorsMap.insert(std::make_pair(*it, _verticesPos.at(*it)));
+        }
+        for (auto it = _constraintPoints.begin(); it != _constraintPoints.end(); ++it)
+        {
+            m_anchorsMap.insert(std::make_pair(it->first, _verticesPos.at(it->first)));
+        }
+        m_constraints = _constraintPoints;
+
+        // 3. rest pose as initial guess
+        m_matX.resize(nbVert, 3);
+        for (size_t i = 0; i < nbVert; i++)
+        {
+            m_matX.row(i) = Eigen::Vector3d(m_initVertices.at(i).x, m_initVertices.at(i).y, m_initVertices.at(i).z);
+        }
+        m_rot.assign(nbTets, Eigen::Matrix3d::Identity());
+
+        if (!buildMatrixL())
+        {
+            std::cerr << "build L matrix error!" << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+
+    bool TetArap::iterate()
+    {
+        return this->solve(1e-6);
+    }
+
+
+    bool TetArap::getResult(std::vector<glm::vec3>& _res)
+    {
+        _res.resize(m_matX.rows());
+
+        for (int i = 0; i < m_matX.rows(); i++)
+        {
+            _res.at(i) = glm::vec3(m_matX.row(i)[0], m_matX.row(i)[1], m_matX.row(i)[2]);
+        }
+
+        return true;
+    }
+
+
+    void TetArap::updateAnchors()
+    {
+        for (auto it = m_constraints.begin(); it != m_constraints.end(); ++it)
+        {
+            glm::vec3 anchorTargetPos = it->second;
+            glm::vec3 anchorCurrentPos = m_anchorsMap.at(it->first);
+
+            glm::vec3 displacementVec = anchorTargetPos - anchorCurrentPos;
+            if (glm::length(displacementVec) > 0.001f)
+                displacementVec = glm::normalize(displacementVec) * 0.01f;
+
+            m_anchorsMap.at(it->first) = anchorCurrentPos + displacementVec;
+        }
+    }
+
+
+    bool TetArap::buildMatrixL()
+    {
+        const size_t nbVert = m_initVertices.size();
+
+        // L_ii = sum of weights of element edges incident to i (+ anchor weight), L_ij = -sum of weights of edge (i,j)
+        std::vector<Eigen::Triplet<double> > triples;
+        triples.reserve(nbVert + m_tets.size() / 4 * 12);
+
+        for (uint32_t i = 0; i < nbVert; i++)
+        {
+            double d_i = 0.0;
+            for (auto it = m_vertexEdges.at(i).begin(); it != m_vertexEdges.at(i).end(); ++it)
+            {
+                // duplicated triplets (edges shared by several tetrahedra) are summed by setFromTriplets()
+                triples.push_back(Eigen::Triplet<double>(i, it->first, -m_edgesWeight));
+                d_i += m_edgesWeight;
+            }
+
+            if (m_anchorsMap.find(i) != m_anchorsMap.end())
+            {
+                d_i += m_anchorsWeight;
+            }
+
+            triples.push_back(Eigen::Triplet<double>(i, i, d_i));
+        }
+
+        m_matL.resize((int)nbVert, (int)nbVert);
+        m_matL.setFromTriplets(triples.begin(), triples.end());
+
+        // pattern only depends on connectivity, anchor changes only need a numerical factorization
+        m_solver.analyzePattern(m_matL);
+
+        return factorizeMatrixL();
+    }
+
+
+    bool TetArap::factorizeMatrixL()
+    {
+        m_solver.factorize(m_matL);
+        m_isFactorizationDirty = false;
+
+        return m_solver.info() == Eigen::Success;
+    }
+
+
+    void TetArap::setSolverType(eSparseSolverType _solverType)
+    {
+        m_solver.setType(_solverType);
+
+        if (m_matL.rows() > 0)
+        {
+            m_solver.analyzePattern(m_matL);
+            factorizeMatrixL();
+        }
+    }
+
+
+    bool TetArap::addAnchor(const uint32_t _id, const glm::vec3& _pos)
+    {
+        if (_id >= m_initVertices.size() || m_matL.rows() != (Eigen::Index)m_initVertices.size())
+        {
+            std::cerr << "TetArap::addAnchor(): invalid vertex id or model not initialized" << std::endl;
+            return false;
+        }
+
+        auto it = m_anchorsMap.find(_id);
+        if (it != m_anchorsMap.end())
+        {
+            it->second = _pos;
+            return true;
+        }
+
+        m_anchorsMap.insert(std::make_pair(_id, _pos));
+
+        // diagonal only: sparsity pattern is unchanged
+        m_matL.coeffRef(_id, _id) += m_anchorsWeight;
+        m_isFactorizationDirty = true;
+
+        return true;
+    }
+
+
+    bool TetArap::removeAnchor(const uint32_t _id)
+    {
+        auto it = m_anchorsMap.find(_id);
+        if (it == m_anchorsMap.end())
+        {
+            return false;
+        }
+
+        // without anchors, L is the uniform (umbrella) Laplacian, which is singular (translations)
+        if (m_anchorsMap.size() == 1)
+        {
+            std::cerr << "TetArap::removeAnchor(): the last anchor cannot be removed" << std::endl;
+            return false;
+        }
+
+        m_anchorsMap.erase(it);
+        m_constraints.erase(std::remove_if(m_constraints.begin(), m_constraints.end(),
+                                           [_id](const std::pair<uint32_t, glm::vec3>& _c) { return _c.first == _id; }),
+                            m_constraints.end());
+
+        m_matL.coeffRef(_id, _id) -= m_anchorsWeight;
+        m_isFactorizationDirty = true;
+
+        return true;
+    }
+
+
+    void TetArap::extractRot(const Eigen::Matrix3d& _matJ, Eigen::Matrix3d& _matR) const
+    {
+        Eigen::JacobiSVD<Eigen::Matrix3d> svd(_matJ, Eigen::ComputeFullU | Eigen::ComputeFullV);
+
+        Eigen::Matrix3d matU = svd.matrixU();
+        const Eigen::Matrix3d& matV = svd.matrixV();
+
+        _matR = matV * matU.transpose();
+
+        // reflection: flip the axis of the smallest singular value
+        if (_matR.determinant() < 0)
+        {
+            matU.col(2) = -matU.col(2);
+            _matR = matV * matU.transpose();
+        }
+    }
+
+
+    void TetArap::localStep()
+    {
+        // rotations of the tetrahedra are independent
+        #pragma omp parallel for
+        for (int t = 0; t < (int)m_rot.size(); t++)
+        {
+            Eigen::Matrix3d J = Eigen::Matrix3d::Zero();
+
+            for (int e = 0; e < 6; e++)
+            {
+                const uint32_t i = m_tets.at(4 * t + s_tetEdges[e][0]);
+                const uint32_t j = m_tets.at(4 * t + s_tetEdges[e][1]);
+
+                const Eigen::Vector3d rv_ij(m_initVertices.at(i).x - m_initVertices.at(j).x,
+                                            m_initVertices.at(i).y - m_initVertices.at(j).y,
+                                            m_initVertices.at(i).z - m_initVertices.at(j).z);
+                const Eigen::Vector3d dv_ij = m_matX.row(i) - m_matX.row(j);
+
+                J += m_edgesWeight * rv_ij * dv_ij.transpose();
+            }
+
+            extractRot(J, m_rot.at(t));
+        }
+    }
+
+
+    bool TetArap::globalStep()
+    {
+        const size_t nbVert = m_initVertices.size();
+        Eigen::MatrixX3d matB = Eigen::MatrixX3d::Zero(nbVert, 3);
+
+        // rows of B are independent: each vertex gathers the rotated rest edges of its incident elements
+        #pragma omp parallel for
+        for (int i = 0; i < (int)nbVert; i++)
+        {
+            const Eigen::Vector3d v_i(m_initVertices.at(i).x, m_initVertices.at(i).y, m_initVertices.at(i).z);
+
+            for (auto it = m_vertexEdges.at(i).begin(); it != m_vertexEdges.at(i).end(); ++it)
+            {
+                const glm::vec3& pos_j = m_initVertices.at(it->first);
+                const Eigen::Vector3d v_ij = v_i - Eigen::Vector3d(pos_j.x, pos_j.y, pos_j.z);
+
+                matB.row(i) += m_edgesWeight * (m_rot.at(it->second) * v_ij).transpose();
+            }
+        }
+
+        for (auto it = m_anchorsMap.begin(); it != m_anchorsMap.end(); ++it)
+        {
+            glm::vec3 anchorPos = it->second;
+            matB.row(it->first) += m_anchorsWeight * Eigen::RowVector3d(anchorPos.x, anchorPos.y, anchorPos.z);
+        }
+
+        if (m_solver.info() == Eigen::Success)
+        {
+            m_solver.solve(matB, m_matX);
+            return true;
+        }
+        return false;
+    }
+
+
+    double TetArap::l2Energy() const
+    {
+        double e = 0.0;
+
+        #pragma omp parallel for reduction(+:e)
+        for (int t = 0; t < (int)m_rot.size(); t++)
+        {
+            for (int k = 0; k < 6; k++)
+            {
+                const uint32_t i = m_tets.at(4 * t + s_tetEdges[k][0]);
+                const uint32_t j = m_tets.at(4 * t + s_tetEdges[k][1]);
+
+                const Eigen::Vector3d rv_ij(m_initVertices.at(i).x - m_initVertices.at(j).x,
+                                            m_initVertices.at(i).y - m_initVertices.at(j).y,
+                                            m_initVertices.at(i).z - m_initVertices.at(j).z);
+                const Eigen::Vector3d dv_ij = m_matX.row(i) - m_matX.row(j);
+
+                e += m_edgesWeight * (dv_ij - m_rot.at(t) * rv_ij).squaredNorm();
+            }
+        }
+        return e;
+    }
+
+
+    bool TetArap::solve(double _eps)
+    {
+        bool success = false;
+
+        if (m_isFactorizationDirty && !factorizeMatrixL())
+        {
+            return false;
+        }
+
+        updateAnchors();
+
+        auto startTime = std::chrono::steady_clock::now();
+
+        size_t iter = 0;
+        double err1 = 1, err2 = 0;
+
+        // local/global iterations, warm-started from previous rotations and positions
+        while (fabs(err2 - err1) > _eps)
+        {
+            double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+            if (m_maxIterations > 0 && iter >= m_maxIterations)
+                break;
+            if (m_timeBudgetMs > 0.0 && iter > 0 && elapsedMs + elapsedMs / iter > m_timeBudgetMs)
+                break;
+
+            success = globalStep();
+            localStep();
+
+            err1 = err2;
+            err2 = l2Energy();
+            iter++;
+        }
+
+        m_hasConverged = fabs(err2 - err1) <= _eps;
+        m_nbIterations = (unsigned int)iter;
+        m_energy = err2;
+
+        // update moving anchors positions
+        for (auto it = m_constraints.begin(); it != m_constraints.end(); ++it)
+        {
+            m_anchorsMap.at(it->first) = glm::vec3(m_matX.row(it->first)[0], m_matX.row(it->first)[1], m_matX.row(it->first)[2]);
+        }
+
+        return success;
+    }
+
+
+} // namespace CompGeom
@@ -0,0 +1,238 @@
+/*********************************************************************************************************************
+ *
+ * tetarap.h
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#ifndef TETARAP_H
+#define TETARAP_H
+
+#include "dynamicalmodel.h"
+#include "sparsesolver.h"
+
+#include <map>
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+#include <Eigen/SVD>
+#include <Eigen/LU>
+
+
+namespace CompGeom
+{
+
+/*!
+* \class TetArap
+* \brief Volumetric As-Rigid-as-Possible deformation of a tetrahedral mesh.
+*        Same local/global scheme as Arap, but with one rotation per tetrahedron (instead of one per vertex),
+*        fitted to the 6 edges of the element, which preserves the volume of thick parts:
+*        E = sum_t sum_(i,j) in t  w_ij * || (x_i - x_j) - R_t * (v_i - v_j) ||^2
+*        The Laplacian of the global step only depends on the connectivity and on the anchors,
+*        so it is factorized once (see SparseSolver) and only back-substitutions are done at each iteration.
+*/
+class TetArap : public DynamicalModel
+{
+
+public:
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        CONSTRUCTORS                                           |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn TetArap
+    * \brief Default constructor
+    */
+    TetArap() = default;
+
+
+    /*!
+    * \fn ~TetArap
+    * \brief Destructor
+    */
+    virtual ~TetArap() {};
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                     GETTERS / SETTERS                                         |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn setSolveBudget
+    * \brief Bounds the work done by one call to iterate()
+    * \param _maxIterations : max number of local/global iterations (0 = unbounded)
+    * \param _timeBudgetMs : wall-clock budget in milliseconds (0.0 = unbounded)
+    */
+    inline void setSolveBudget(unsigned int _maxIterations, double _timeBudgetMs) { m_maxIterations = _maxIterations; m_timeBudgetMs = _timeBudgetMs; }
+
+    /*!
+    * \fn setSolverType
+    * \brief Selects the sparse direct solver used for the Laplacian matrix (refactorizes it if already built)
+    */
+    void setSolverType(eSparseSolverType _solverType);
+
+    /*!
+    * \fn getSolver
+    */
+    inline const SparseSolver& getSolver() const { return m_solver; }
+
+    /*!
+    * \fn getNbElements
+    */
+    inline size_t getNbElements() const { return m_tets.size() / 4; }
+
+    /*!
+    * \fn hasConverged
+    * \brief Returns true if the last solve reached the tolerance (false if stopped by the budget)
+    */
+    inline bool hasConverged() const { return m_hasConverged; }
+
+    /*!
+    * \fn getNbIterations
+    * \brief Returns the number of local/global iterations done during the last solve
+    */
+    inline unsigned int getNbIterations() const { return m_nbIterations; }
+
+    /*!
+    * \fn getEnergy
+    * \brief Returns the ARAP energy at the end of the last solve
+    */
+    inline double getEnergy() const { return m_energy; }
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        MISCELLANEOUS                                          |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn initialize
+    * \brief Initializes dynamical model
+    * \param _vertices : List of vertices
+    * \param _indices : List of indices (4 per tetrahedron)
+    * \param _fixedPointsIds : List of fixed points indices
+    * \param _constraintPoints : List of constraint points (Id, target pos)
+    * \return : success
+    */
+    bool initialize( std::vector<glm::vec3>& _verticesPos
+                   , std::vector<uint32_t>& _indices
+                   , std::vector<uint32_t>& _fixedPointsIds
+                   , std::vector<std::pair<uint32_t, glm::vec3> >& _constraintPoints) override;
+
+    /*!
+    * \fn iterate
+    * \brief Update system state for one timestep
+    * \return : success
+    */
+    bool iterate() override;
+
+    /*!
+    * \fn getResult
+    * \brief Returns new vertices' position
+    * \param _res : List of vertices to return
+    * \return : success
+    */
+    bool getResult(std::vector<glm::vec3>& _res) override;
+
+    /*!
+    * \fn updateAnchors
+    * \brief Moves anchors' positions for live animation
+    */
+    void updateAnchors();
+
+    /*!
+    * \fn addAnchor
+    * \brief Pins a vertex at a given position (or updates an existing anchor)
+    * \return : success
+    */
+    bool addAnchor(const uint32_t _id, const glm::vec3& _pos);
+
+    /*!
+    * \fn removeAnchor
+    * \brief Releases an anchor or a handle (the last one is kept: without anchors, the system is singular)
+    * \return : success
+    */
+    bool removeAnchor(const uint32_t _id);
+
+
+protected:
+
+    /*!
+    * \fn buildMatrixL
+    * \brief Builds the Laplacian matrix of the tetrahedral mesh edges (one contribution per element sharing an edge),
+    *        and does its symbolic analysis
+    */
+    bool buildMatrixL();
+
+    /*!
+    * \fn factorizeMatrixL
+    * \brief Numerical Cholesky factorization of L, reusing the symbolic analysis done in buildMatrixL()
+    * \return : success
+    */
+    bool factorizeMatrixL();
+
+    /*!
+    * \fn extractRot
+    * \brief Closest rotation to _matJ (reflections are removed)
+    */
+    void extractRot(const Eigen::Matrix3d& _matJ, Eigen::Matrix3d& _matR) const;
+
+    /*!
+    * \fn localStep
+    * \brief Computes optimal rotation of each tetrahedron, from rest edges to current edges
+    */
+    void localStep();
+
+    /*!
+    * \fn globalStep
+    * \brief Solve LX=B system to update values of X
+    * \return : success
+    */
+    bool globalStep();
+
+    /*!
+    * \fn l2Energy
+    */
+    double l2Energy() const;
+
+    /*!
+    * \fn solve
+    * \brief Complete solving process, i.e., one iteration for live animation
+    * \return : success
+    */
+    bool solve(double _eps);
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                         ATTRIBUTES                                            |
+    +-----------------------------------------------------------------------------------------------*/
+
+    SparseSolver m_solver;                  /*!< sparse Cholesky decomposition of the Laplacian matrix */
+    Eigen::SparseMatrix<double> m_matL;     /*!< Laplacian matrix, with anchors' weights in diagonal */
+    bool m_isFactorizationDirty = false;    /*!< true if anchors changed since last factorization of m_matL */
+    std::vector<Eigen::Matrix3d> m_rot;     /*!< rotation of each tetrahedron */
+    Eigen::MatrixX3d m_matX;                /*!< X matrix (coordinates of vertices) */
+
+    std::map<uint32_t, glm::vec3> m_anchorsMap; /* each anchor point is identified by its id and target position */
+    std::vector<std::pair<uint32_t, glm::vec3> > m_constraints; /* backup ultimate target position for moving anchors */
+    double m_anchorsWeight = 100.0;             /* anchors' weight */
+    double m_edgesWeight = 1.0;                 /* edges' weight (uniform) */
+
+    std::vector<glm::vec3> m_initVertices;      /* initial vertices */
+    std::vector<uint32_t> m_tets;               /* vertex indices, 4 per tetrahedron */
+    std::vector<std::vector<std::pair<uint32_t, uint32_t> > > m_vertexEdges; /* (neighbor, tetrahedron) for each element edge incident to a vertex */
+
+    unsigned int m_maxIterations = 0;   /*!< max number of local/global iterations per solve (0 = unbounded) */
+    double m_timeBudgetMs = 0.0;        /*!< wall-clock budget per solve, in ms (0.0 = unbounded) */
+    bool m_hasConverged = false;        /*!< convergence status of last solve */
+    unsigned int m_nbIterations = 0;    /*!< number of iterations of last solve */
+    double m_energy = 0.0;              /*!< ARAP energy at the end of last solve */
+
+
+}; // class TetArap
+
+} // namespace CompGeom
+
+#endif // TETARAP_H
@@ -0,0 +1,414 @@
+/*********************************************************************************************************************
+ *
+ * tetfem.cpp
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+
+#include "tetfem.h"
+
+#include <iostream>
+#include <cmath>
+
+
+namespace CompGeom
+{
+
+    bool TetFem::initialize( std::vector<glm::vec3>& _verticesPos
+                           , std::vector<uint32_t>& _indices
+                           , std::vector<uint32_t>& _fixedPointsIds
+                           , std::vector<std::pair<uint32_t, glm::vec3> >& _constraintPoints)
+    {
+        if (_indices.size() % 4 != 0)
+        {
+            std::cerr << "TetFem::initialize(): number of indices is not a multiple of 4" << std::endl;
+            return false;
+        }
+
+        m_restVertices = _verticesPos;
+        m_tets = _indices;
+        m_fixedConstraints = _fixedPointsIds;
+        m_movingConstraints = _constraintPoints;
+
+        buildE();
+        buildDofMap(m_restVertices.size(), m_fixedConstraints);
+
+        const Eigen::Index dimVec = getNbFreeDofs();
+        m_vecU = Eigen::VectorXd::Zero(dimVec);
+        m_vecF = Eigen::VectorXd::Zero(dimVec);
+        m_vecFTotal = Eigen::VectorXd::Zero(dimVec);
+
+        // element matrices and pattern of K are built at first iterate()
+        m_elementsKe.clear();
+        m_isPatternAnalyzed = false;
+        m_isSystemDirty = true;
+
+        return true;
+    }
+
+
+    void TetFem::buildE()
+    {
+        /*
+        * Isotropic elasticity matrix E, which gives the stress (s_xx, s_yy, s_zz, s_xy, s_yz, s_zx)
+        * from the strain (eps_xx, eps_yy, eps_zz, gamma_xy, gamma_yz, gamma_zx):
+        *       |lambda + 2 * mu      lambda          lambda      0   0   0 |
+        *       |    lambda       lambda + 2 * mu     lambda      0   0   0 |
+        *   E = |    lambda           lambda      lambda + 2 * mu 0   0   0 |
+        *       |      0                0               0         mu  0   0 |
+        *       |      0                0               0         0   mu  0 |
+        *       |      0                0               0         0   0   mu|
+        */
+
+        m_matE.setZero();
+        m_matE.topLeftCorner<3, 3>().setConstant(m_lambda);
+        m_matE.topLeftCorner<3, 3>().diagonal().array() += 2.0 * m_mu;
+        m_matE.bottomRightCorner<3, 3>().diagonal().setConstant(m_mu);
+    }
+
+
+    double TetFem::buildBe(Matrix612d& _Be, int _t) const
+    {
+        /*
+        * The linear shape functions N_1, N_2, N_3 of a tetrahedron are the barycentric coordinates
+        * of its nodes 1, 2, 3 (N_0 = 1 - N_1 - N_2 - N_3), so their gradients are the rows of Dm^-1,
+        * with Dm = [x_1 - x_0, x_2 - x_0, x_3 - x_0] the rest edge matrix.
+        *
+        * With (b_i, c_i, d_i) the gradient of N_i, the block of node i in Be is:
+        *         |b_i  0   0 |
+        *         | 0  c_i  0 |
+        *   Be_i =| 0   0  d_i|
+        *         |c_i b_i  0 |
+        *         | 0  d_i c_i|
+        *         |d_i  0  b_i|
+        */
+
+        const Eigen::Matrix3d& invDm = m_elementsInvDm[_t];
+
+        Eigen::Matrix<double, 3, 4> gradN;
+        gradN.rightCols<3>() = invDm.transpose();
+        gradN.col(0) = -gradN.rightCols<3>().rowwise().sum();
+
+        _Be.setZero();
+        for (int i = 0; i < 4; i++)
+        {
+            const double b = gradN(0, i);
+            const double c = gradN(1, i);
+            const double d = gradN(2, i);
+
+            _Be(0, 3 * i)     = b;
+            _Be(1, 3 * i + 1) = c;
+            _Be(2, 3 * i + 2) = d;
+            _Be(3, 3 * i)     = c;
+            _Be(3, 3 * i + 1) = b;
+            _Be(4, 3 * i + 1) = d;
+            _Be(4, 3 * i + 2) = c;
+            _Be(5, 3 * i)     = d;
+            _Be(5, 3 * i + 2) = b;
+        }
+
+        // tetrahedron volume
+        return std::abs(invDm.determinant()) > 0.0 ? 1.0 / (6.0 * std::abs(invDm.determinant())) : 0.0;
+    }
+
+
+    void TetFem::buildKe(Matrix1212d& _Ke, int _t) const
+    {
+        Matrix612d Be;
+        double vol = buildBe(Be, _t);
+
+        _Ke.noalias() = Be.transpose() * m_matE * Be * vol;
+    }
+
+
+    void TetFem::assembleK()
+    {
+        assembleElements<4, 3>([this](int _t, Matrix1212d& _Ke) { getRotatedKe(_t, _Ke); }, m_tets, m_restVertices.size(), true, m_matK);
+    }
+
+
+    void TetFem::updateRotations()
+    {
+        const size_t nbTets = getNbElements();
+        m_elementsRot.resize(nbTets);
+
+        #pragma omp parallel for
+        for (int t = 0; t < (int)nbTets; t++)
+        {
+            // current positions: rest positions + displacements of non-fixed nodes
+            Eigen::Vector3d x[4];
+            for (int i = 0; i < 4; i++)
+            {
+                uint32_t node = m_tets[4 * t + i];
+                x[i] = Eigen::Vector3d(m_restVertices[node].x, m_restVertices[node].y, m_restVertices[node].z);
+                int freeId = m_nodeToFreeId.at(node);
+                if (freeId >= 0)
+                {
+                    x[i] += m_vecU.segment<3>(3 * freeId);
+                }
+            }
+
+            // deformation gradient F = Ds * Dm^-1
+            Eigen::Matrix3d Ds;
+            for (int i = 0; i < 3; i++)
+            {
+                Ds.col(i) = x[i + 1] - x[0];
+            }
+            const Eigen::Matrix3d F = Ds * m_elementsInvDm[t];
+
+            // polar decomposition F = R * S, with R = U * V^T (reflections are removed)
+            Eigen::JacobiSVD<Eigen::Matrix3d> svd(F, Eigen::ComputeFullU | Eigen::ComputeFullV);
+            Eigen::Matrix3d matU = svd.matrixU();
+            const Eigen::Matrix3d& matV = svd.matrixV();
+
+            Eigen::Matrix3d& R = m_elementsRot[t];
+            R = matU * matV.transpose();
+            if (R.determinant() < 0)
+            {
+                // flip the axis of the smallest singular value
+                matU.col(2) = -matU.col(2);
+                R = matU * matV.transpose();
+            }
+        }
+    }
+
+
+    void TetFem::getRotatedKe(int _t, Matrix1212d& _Ke) const
+    {
+        const Matrix1212d& Ke = m_elementsKe[_t];
+        if (!m_isCorotational)
+        {
+            _Ke = Ke;
+            return;
+        }
+
+        // R_e * K_e * R_e^T, with R_e = diag(R, R, R, R): each 3x3 block is rotated
+        const Eigen::Matrix3d& R = m_elementsRot[_t];
+        for (int i = 0; i < 4; i++)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                _Ke.block<3, 3>(3 * i, 3 * j).noalias() = R * Ke.block<3, 3>(3 * i, 3 * j) * R.transpose();
+            }
+        }
+    }
+
+
+    void TetFem::addCorotationalForces(Eigen::VectorXd& _vecRhs) const
+    {
+        const size_t nbTets = getNbElements();
+        std::vector<Vector12d> elementsRhs(nbTets);
+
+        #pragma omp parallel for
+        for (int t = 0; t < (int)nbTets; t++)
+        {
+            const Eigen::Matrix3d& R = m_elementsRot[t];
+
+            // X_e - R_e^T * X_e
+            Vector12d vecRotX;
+            for (int i = 0; i < 4; i++)
+            {
+                const glm::vec3& p = m_restVertices[m_tets[4 * t + i]];
+                const Eigen::Vector3d X(p.x, p.y, p.z);
+                vecRotX.segment<3>(3 * i) = X - R.transpose() * X;
+            }
+
+            const Vector12d vecF = m_elementsKe[t] * vecRotX;
+            for (int i = 0; i < 4; i++)
+            {
+                elementsRhs[t].segment<3>(3 * i) = R * vecF.segment<3>(3 * i);
+            }
+        }
+
+        for (size_t t = 0; t < nbTets; t++)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                int freeId = m_nodeToFreeId.at(m_tets[4 * t + i]);
+                if (freeId >= 0)
+                {
+                    _vecRhs.segment<3>(3 * freeId) += elementsRhs[t].segment<3>(3 * i);
+                }
+            }
+        }
+    }
+
+
+    void TetFem::buildElements()
+    {
+        const size_t nbTets = getNbElements();
+        m_elementsInvDm.resize(nbTets);
+        m_elementsKe.resize(nbTets);
+
+        #pragma omp parallel for
+        for (int t = 0; t < (int)nbTets; t++)
+        {
+            Eigen::Matrix3d Dm;
+            const glm::vec3& p0 = m_restVertices[m_tets[4 * t]];
+            for (int i = 0; i < 3; i++)
+            {
+                const glm::vec3& p = m_restVertices[m_tets[4 * t + i + 1]];
+                Dm.col(i) = Eigen::Vector3d(p.x - p0.x, p.y - p0.y, p.z - p0.z);
+            }
+            m_elementsInvDm[t] = Dm.inverse();
+            buildKe(m_elementsKe[t], t);
+        }
+    }
+
+
+    bool TetFem::factorizeSystem()
+    {
+        if (m_elementsKe.size() != getNbElements())
+        {
+            buildElements();
+        }
+
+        assembleK();
+
+        bool success = false;
+        if (m_solverType == eFemSolverType::DIRECT)
+        {
+            // the pattern of K only depends on the mesh and on fixed nodes: it is analyzed once
+            if (!m_isPatternAnalyzed)
+            {
+                m_solver.analyzePattern(m_matK);
+                m_isPatternAnalyzed = true;
+            }
+            success = m_solver.factorize(m_matK);
+            if (!m_isCorotational)
+                m_solver.printStats();
+        }
+        else
+        {
+            m_CG.preconditioner().setType(m_preconditioner);
+            m_CG.preconditioner().setBlockSize(3);
+            m_CG.compute(m_matK);
+            success = m_CG.info() == Eigen::Success;
+        }
+
+        if (!success)
+            std::cerr << "TetFem::factorizeSystem(): computation error" << std::endl;
+
+        m_isSystemDirty = !success;
+        return success;
+    }
+
+
+    bool TetFem::iterate()
+    {
+        assert(getNbFreeDofs() == m_vecU.size());
+        assert(getNbFreeDofs() == m_vecF.size());
+
+        // in corotational mode, K depends on the rotations of the current shape
+        if (m_isCorotational)
+        {
+            if (m_elementsKe.size() != getNbElements())
+                buildElements();
+            updateRotations();
+            m_isSystemDirty = true;
+        }
+
+        if (m_isSystemDirty && !factorizeSystem())
+        {
+            return false;
+        }
+
+        // forces of each frame are load increments
+        m_vecFTotal += m_vecF;
+        Eigen::VectorXd vecRhs = m_vecFTotal;
+        if (m_isCorotational)
+        {
+            addCorotationalForces(vecRhs);
+        }
+
+        if (m_solverType == eFemSolverType::DIRECT)
+        {
+            m_solver.solve(vecRhs, m_vecU);
+            m_nbSolverIterations = 0;
+            m_solverError = 0.0;
+            return true;
+        }
+
+        // warm start from previous displacements
+        m_vecU = m_CG.solveWithGuess(vecRhs, m_vecU);
+        m_nbSolverIterations = (unsigned int)m_CG.iterations();
+        m_solverError = m_CG.error();
+        if (m_CG.info() != Eigen::Success)
+        {
+            std::cerr << "TetFem::iterate(): conjugate gradient did not converge" << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+
+    bool TetFem::getResult(std::vector<glm::vec3>& _res)
+    {
+        _res = m_restVertices;
+
+        for (size_t k = 0; k < m_freeNodes.size(); k++)
+        {
+            _res.at(m_freeNodes[k]) += glm::vec3(m_vecU[3 * k], m_vecU[3 * k + 1], m_vecU[3 * k + 2]);
+        }
+
+        return true;
+    }
+
+
+    void TetFem::updateBoundaryConditions()
+    {
+        m_vecF.setZero();
+
+        for (auto it = m_movingConstraints.begin(); it != m_movingConstraints.end(); ++it)
+        {
+            int freeId = m_nodeToFreeId.at(it->first);
+            if (freeId < 0)
+            {
+                std::cerr << "TetFem::updateBoundaryConditions(): moving constraint is a fixed node" << std::endl;
+                continue;
+            }
+
+            const Eigen::Vector3d currentPos = Eigen::Vector3d(m_restVertices[it->first].x, m_restVertices[it->first].y, m_restVertices[it->first].z)
+                                             + m_vecU.segment<3>(3 * freeId);
+            const Eigen::Vector3d targetPos(it->second.x, it->second.y, it->second.z);
+            m_vecF.segment<3>(3 * freeId) = (targetPos - currentPos) * 0.1;
+        }
+    }
+
+
+    void TetFem::setSolverType(eFemSolverType _solverType)
+    {
+        m_solverType = _solverType;
+        if (m_solverType == eFemSolverType::MATRIX_FREE_CG)
+        {
+            std::cerr << "TetFem: matrix-free mode is not available, using CONJUGATE_GRADIENT instead" << std::endl;
+            m_solverType = eFemSolverType::CONJUGATE_GRADIENT;
+        }
+        m_isSystemDirty = true;
+    }
+
+
+    void TetFem::setLameParameters(double _mu, double _lambda)
+    {
+        m_mu = _mu;
+        m_lambda = _lambda;
+        buildE();
+
+        // element matrices are built again
+        m_elementsKe.clear();
+        m_isSystemDirty = true;
+    }
+
+
+    void TetFem::printStats() const
+    {
+        std::cout << "TetFem: " << getNbFreeDofs() << " dofs" << (m_isCorotational ? ", corotational" : "");
+        printSolverStats(m_CG.preconditioner().getActiveType());
+    }
+
+
+} // namespace CompGeom
@@ -0,0 +1,231 @@
+/*********************************************************************************************************************
+ *
+ * tetfem.h
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#ifndef TETFEM_H
+#define TETFEM_H
+
+#include "femmodel.h"
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+#include <Eigen/SVD>
+#include <Eigen/LU>
+
+
+namespace CompGeom
+{
+
+/*!
+* \class TetFem
+* \brief Finite-Element Method 3D, with linear tetrahedral elements (3 dofs per node)
+*
+* Same pipeline as Fem (see FemModel), for volumetric meshes:
+* - K_e = (B_e)^T * E * B_e * V_e, with B_e the 6x12 displacement deformation matrix,
+*   E the 6x6 isotropic elasticity matrix, and V_e the volume of the tetrahedron
+* - K is assembled (sparse) on non-fixed nodes only, then K * u = f is solved
+*   with a sparse Cholesky factorization (DIRECT) or a preconditioned conjugate gradient
+*
+* u is the displacement from the rest shape, and the forces of each frame are load increments.
+* In corotational mode, the rotation R_e of each element is extracted from its deformation gradient
+* (polar decomposition), K_e is replaced by R_e * K_e * R_e^T and f_e by f_e + R_e * K_e * (X_e - R_e^T * X_e).
+*/
+class TetFem : public FemModel
+{
+    // Fixed-size element matrices
+    typedef Eigen::Matrix<double, 6, 12> Matrix612d;
+    typedef Eigen::Matrix<double, 12, 12> Matrix1212d;
+    typedef Eigen::Matrix<double, 12, 1> Vector12d;
+    typedef Eigen::Matrix<double, 6, 6> Matrix66d;
+
+public:
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        CONSTRUCTORS                                           |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn TetFem
+    * \brief Default constructor
+    */
+    TetFem() : FemModel(3) {}
+
+
+    /*!
+    * \fn ~TetFem
+    * \brief Destructor
+    */
+    virtual ~TetFem() {};
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                     GETTERS / SETTERS                                         |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn setSolverType
+    * \brief Selects the solver of the global system (MATRIX_FREE_CG is not available, CONJUGATE_GRADIENT is used instead)
+    */
+    void setSolverType(eFemSolverType _solverType);
+
+    /*!
+    * \fn setLameParameters
+    * \brief Sets the material (K is built again at next iterate())
+    */
+    void setLameParameters(double _mu, double _lambda);
+
+    /*!
+    * \fn setCorotational
+    * \brief Enables the corotational formulation (K is rotated per element and solved again at each iterate())
+    */
+    inline void setCorotational(bool _isCorotational) { m_isCorotational = _isCorotational; m_isSystemDirty = true; }
+
+    /*!
+    * \fn isCorotational
+    */
+    inline bool isCorotational() const { return m_isCorotational; }
+
+    /*!
+    * \fn getNbElements
+    */
+    inline size_t getNbElements() const { return m_tets.size() / 4; }
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        MISCELLANEOUS                                          |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn initialize
+    * \brief Initializes dynamical model
+    * \param _vertices : List of vertices
+    * \param _indices : List of indices (4 per tetrahedron)
+    * \param _fixedPointsIds : List of fixed points indices
+    * \param _constraintPoints : List of constraint points (Id, target pos)
+    * \return : success
+    */
+    bool initialize( std::vector<glm::vec3>& _verticesPos
+                   , std::vector<uint32_t>& _indices
+                   , std::vector<uint32_t>& _fixedPointsIds
+                   , std::vector<std::pair<uint32_t, glm::vec3> >& _constraintPoints) override;
+
+    /*!
+    * \fn iterate
+    * \brief Calculates the displacements u by solving the global system K * u = f
+    * \return : success
+    */
+    bool iterate() override;
+
+    /*!
+    * \fn getResult
+    * \brief Returns new vertices' position
+    * \param _res : List of vertices to return
+    * \return : success
+    */
+    bool getResult(std::vector<glm::vec3>& _res) override;
+
+    /*!
+    * \fn updateBoundaryConditions
+    * \brief Sets the forces of the next frame, which pull moving constraint points towards their target
+    */
+    void updateBoundaryConditions();
+
+    /*!
+    * \fn printStats
+    * \brief Prints solver, preconditioner and iterations of the last solve
+    */
+    void printStats() const;
+
+
+protected:
+
+    /*!
+    * \fn buildE
+    * \brief Builds the isotropic elasticity matrix
+    */
+    void buildE();
+
+    /*!
+    * \fn buildBe
+    * \brief Builds the displacement-deformation matrix of tetrahedron _t, from the gradients of its linear shape functions
+    * \return : volume of the tetrahedron
+    */
+    double buildBe(Matrix612d& _Be, int _t) const;
+
+    /*!
+    * \fn buildKe
+    * \brief Builds the stiffness matrix of tetrahedron _t
+    */
+    void buildKe(Matrix1212d& _Ke, int _t) const;
+
+    /*!
+    * \fn buildElements
+    * \brief Builds the rest edge matrix and the stiffness matrix of each element
+    */
+    void buildElements();
+
+    /*!
+    * \fn assembleK
+    * \brief Builds the global stiffness matrix (without fixed nodes) from the elements' matrices,
+    *        rotated in corotational mode
+    */
+    void assembleK();
+
+    /*!
+    * \fn updateRotations
+    * \brief Extracts the rotation of each element from the current displacements (polar decomposition)
+    */
+    void updateRotations();
+
+    /*!
+    * \fn getRotatedKe
+    * \brief Returns R_e * K_e * R_e^T for element _t (K_e in linear mode)
+    */
+    void getRotatedKe(int _t, Matrix1212d& _Ke) const;
+
+    /*!
+    * \fn addCorotationalForces
+    * \brief Adds R_e * K_e * (X_e - R_e^T * X_e) of each element to _vecRhs
+    */
+    void addCorotationalForces(Eigen::VectorXd& _vecRhs) const;
+
+    /*!
+    * \fn factorizeSystem
+    * \brief Builds K and factorizes it (DIRECT), or sets up the conjugate gradient
+    * \return : success
+    */
+    bool factorizeSystem();
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                         ATTRIBUTES                                            |
+    +-----------------------------------------------------------------------------------------------*/
+
+    Eigen::SparseMatrix<double> m_matK;          /*!< Global stiffness matrix, without fixed nodes */
+    Matrix66d m_matE;                            /*!< Elasticity matrix */
+    Eigen::VectorXd m_vecU;                      /*!< displacements of non-fixed nodes, from rest */
+    Eigen::VectorXd m_vecF;                      /*!< external forces of the next frame */
+    Eigen::VectorXd m_vecFTotal;                 /*!< accumulated external forces */
+
+    bool m_isCorotational = false;               /*!< corotational formulation */
+    std::vector<Matrix1212d> m_elementsKe;       /*!< stiffness matrix of each element, in its rest frame */
+    std::vector<Eigen::Matrix3d> m_elementsInvDm; /*!< inverse of the rest edge matrix of each element */
+    std::vector<Eigen::Matrix3d> m_elementsRot;  /*!< rotation of each element (corotational mode) */
+
+    double m_mu = 10.5;                          /*!< Lame parameters */
+    double m_lambda = 0.5;
+
+    std::vector<glm::vec3> m_restVertices;       /* rest vertices, on which element matrices are built */
+    std::vector<uint32_t> m_tets;                /* vertex indices, 4 per tetrahedron */
+
+
+}; // class TetFem
+
+} // namespace CompGeom
+
+#endif // TETFEM_H
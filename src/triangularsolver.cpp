@@ -0,0 +1,282 @@
+/*********************************************************************************************************************
+ *
+ * triangularsolver.cpp
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+
+#include "triangularsolver.h"
+
+#include <algorithm>
+#include <functional>
+#include <assert.h>
+
+
+namespace CompGeom
+{
+
+    void TriangularSolver::analyze(const Eigen::SparseMatrix<double>& _matL, const Eigen::VectorXd& _vecD)
+    {
+        const int n = (int)_matL.rows();
+        const int* colPtr = _matL.outerIndexPtr();
+        const int* colNnz = _matL.innerNonZeroPtr();
+        const int* rowIds = _matL.innerIndexPtr();
+        const double* values = _matL.valuePtr();
+
+        // the diagonal is applied separately, so that rows only hold their dependencies
+        m_invDiagL = Eigen::VectorXd::Ones(n);
+        std::vector<int> rowNnz(n, 0);
+        int nnz = 0;
+        for (int j = 0; j < n; j++)
+        {
+            const int end = colNnz ? colPtr[j] + colNnz[j] : colPtr[j + 1];
+            for (int p = colPtr[j]; p < end; p++)
+            {
+                if (rowIds[p] == j)
+                {
+                    m_invDiagL[j] = 1.0 / values[p];
+                }
+                else
+                {
+                    rowNnz[rowIds[p]]++;
+                    nnz++;
+                }
+            }
+        }
+
+        // strictly lower part, both row-major: the columns of L (compressed column storage) are the rows of L^T,
+        // the rows of L are gathered by a counting sort (faster than Eigen's generic conversions)
+        m_matL.resize(n, n);
+        m_matLt.resize(n, n);
+        m_matL.resizeNonZeros(nnz);
+        m_matLt.resizeNonZeros(nnz);
+        m_matL.outerIndexPtr()[0] = 0;
+        for (int i = 0; i < n; i++)
+        {
+            m_matL.outerIndexPtr()[i + 1] = m_matL.outerIndexPtr()[i] + rowNnz[i];
+        }
+        std::vector<int> cursor(m_matL.outerIndexPtr(), m_matL.outerIndexPtr() + n);
+        int k = 0;
+        m_matLt.outerIndexPtr()[0] = 0;
+        for (int j = 0; j < n; j++)
+        {
+            const int end = colNnz ? colPtr[j] + colNnz[j] : colPtr[j + 1];
+            for (int p = colPtr[j]; p < end; p++)
+            {
+                const int i = rowIds[p];
+                if (i != j)
+                {
+                    m_matLt.innerIndexPtr()[k] = i;
+                    m_matLt.valuePtr()[k++] = values[p];
+                    m_matL.innerIndexPtr()[cursor[i]] = j;
+                    m_matL.valuePtr()[cursor[i]++] = values[p];
+                }
+            }
+            m_matLt.outerIndexPtr()[j + 1] = k;
+        }
+
+        if (_vecD.size() == (Eigen::Index)n)
+            m_invD = _vecD.cwiseInverse();
+        else
+            m_invD.resize(0);
+
+        // forward substitution L * y = b: row i depends on rows j < i such that L(i,j) != 0
+        m_nbLevelsFw = buildLevels(m_matL, true, m_levelRowsFw, m_stagePtrFw, m_isParallelStageFw);
+
+        // backward substitution L^T * x = y: row i depends on rows j > i such that L(j,i) != 0
+        buildLevels(m_matLt, false, m_levelRowsBw, m_stagePtrBw, m_isParallelStageBw);
+    }
+
+
+    size_t TriangularSolver::buildLevels(const RowSpMat& _mat, bool _isForward,
+                                         std::vector<int>& _levelRows, std::vector<int>& _stagePtr, std::vector<char>& _isParallelStage)
+    {
+        const int n = (int)_mat.rows();
+
+        // level of a row = 1 + max level of the rows it depends on
+        std::vector<int> levels(n, 0);
+        int nbLevels = 0;
+        for (int k = 0; k < n; k++)
+        {
+            int i = _isForward ? k : n - 1 - k;
+            int lvl = 0;
+            for (RowSpMat::InnerIterator it(_mat, i); it; ++it)
+            {
+                lvl = std::max(lvl, levels[it.col()] + 1);
+            }
+            levels[i] = lvl;
+            nbLevels = std::max(nbLevels, lvl + 1);
+        }
+
+        // bucket sort rows by level
+        std::vector<int> levelPtr(nbLevels + 1, 0);
+        for (int i = 0; i < n; i++)
+        {
+            levelPtr[levels[i] + 1]++;
+        }
+        for (int l = 0; l < nbLevels; l++)
+        {
+            levelPtr[l + 1] += levelPtr[l];
+        }
+
+        _levelRows.resize(n);
+        std::vector<int> cursor(levelPtr.begin(), levelPtr.end() - 1);
+        for (int i = 0; i < n; i++)
+        {
+            _levelRows[cursor[levels[i]]++] = i;
+        }
+
+        // stages: a large level alone (parallel), or consecutive thin levels (serial, rows stay in level order)
+        _stagePtr.assign(1, 0);
+        _isParallelStage.clear();
+        for (int l = 0; l < nbLevels; l++)
+        {
+            const bool isParallel = levelPtr[l + 1] - levelPtr[l] >= s_minParallelRows;
+            if (isParallel || _isParallelStage.empty() || _isParallelStage.back())
+            {
+                _stagePtr.push_back(levelPtr[l + 1]);
+                _isParallelStage.push_back(isParallel);
+            }
+            else
+            {
+                _stagePtr.back() = levelPtr[l + 1];
+            }
+        }
+
+        // rows only depend on lower (forward) or higher (backward) rows: in a serial stage, index order is also valid,
+        // and has a better locality than level order
+        for (size_t s = 0; s < _isParallelStage.size(); s++)
+        {
+            if (!_isParallelStage[s])
+            {
+                if (_isForward)
+                    std::sort(_levelRows.begin() + _stagePtr[s], _levelRows.begin() + _stagePtr[s + 1]);
+                else
+                    std::sort(_levelRows.begin() + _stagePtr[s], _levelRows.begin() + _stagePtr[s + 1], std::greater<int>());
+            }
+        }
+
+        return (size_t)nbLevels;
+    }
+
+
+    template<int Width>
+    void TriangularSolver::substituteRows(const RowSpMat& _mat, const int* _rows, int _nbRows, const double* _invScale,
+                                          double* _x, int _nbCols) const
+    {
+        const int* outerPtr = _mat.outerIndexPtr();
+        const int* innerPtr = _mat.innerIndexPtr();
+        const double* valuePtr = _mat.valuePtr();
+
+        for (int k = 0; k < _nbRows; k++)
+        {
+            const int i = _rows[k];
+            const double scale = _invScale ? _invScale[i] : 1.0;
+            double* xi = _x + (Eigen::Index)i * _nbCols;
+
+            double acc[Width];
+            for (int c = 0; c < Width; c++)
+            {
+                acc[c] = scale * xi[c];
+            }
+            for (int p = outerPtr[i]; p < outerPtr[i + 1]; p++)
+            {
+                const double value = valuePtr[p];
+                const double* xj = _x + (Eigen::Index)innerPtr[p] * _nbCols;
+                for (int c = 0; c < Width; c++)
+                {
+                    acc[c] -= value * xj[c];
+                }
+            }
+            for (int c = 0; c < Width; c++)
+            {
+                xi[c] = acc[c] * m_invDiagL[i];
+            }
+        }
+    }
+
+
+    template<int Width>
+    void TriangularSolver::substituteStages(const RowSpMat& _mat, const std::vector<int>& _levelRows, const std::vector<int>& _stagePtr,
+                                            const std::vector<char>& _isParallelStage, const double* _invScale,
+                                            double* _x, int _nbCols) const
+    {
+        for (size_t s = 0; s < _isParallelStage.size(); s++)
+        {
+            const int first = _stagePtr[s];
+            const int last = _stagePtr[s + 1];
+
+            if (_isParallelStage[s])
+            {
+                // rows of a level are independent
+                const int chunkSize = 64;
+                #pragma omp parallel for schedule(dynamic)
+                for (int k = first; k < last; k += chunkSize)
+                {
+                    substituteRows<Width>(_mat, &_levelRows[k], std::min(chunkSize, last - k), _invScale, _x, _nbCols);
+                }
+            }
+            else
+            {
+                substituteRows<Width>(_mat, &_levelRows[first], last - first, _invScale, _x, _nbCols);
+            }
+        }
+    }
+
+
+    void TriangularSolver::substitute(const RowSpMat& _mat, const std::vector<int>& _levelRows, const std::vector<int>& _stagePtr,
+                                      const std::vector<char>& _isParallelStage, const double* _invScale, RowMatrixXd& _matX) const
+    {
+        const int nbCols = (int)_matX.cols();
+
+        // columns by blocks of at most s_blockSize, with a fixed-size accumulator
+        for (int c0 = 0; c0 < nbCols; c0 += s_blockSize)
+        {
+            double* x = _matX.data() + c0;
+            switch (std::min(s_blockSize, nbCols - c0))
+            {
+                case 1: substituteStages<1>(_mat, _levelRows, _stagePtr, _isParallelStage, _invScale, x, nbCols); break;
+                case 2: substituteStages<2>(_mat, _levelRows, _stagePtr, _isParallelStage, _invScale, x, nbCols); break;
+                case 3: substituteStages<3>(_mat, _levelRows, _stagePtr, _isParallelStage, _invScale, x, nbCols); break;
+                case 4: substituteStages<4>(_mat, _levelRows, _stagePtr, _isParallelStage, _invScale, x, nbCols); break;
+                case 5: substituteStages<5>(_mat, _levelRows, _stagePtr, _isParallelStage, _invScale, x, nbCols); break;
+                case 6: substituteStages<6>(_mat, _levelRows, _stagePtr, _isParallelStage, _invScale, x, nbCols); break;
+                case 7: substituteStages<7>(_mat, _levelRows, _stagePtr, _isParallelStage, _invScale, x, nbCols); break;
+                default: substituteStages<s_blockSize>(_mat, _levelRows, _stagePtr, _isParallelStage, _invScale, x, nbCols); break;
+            }
+        }
+    }
+
+
+    void TriangularSolver::solveInPlace(RowMatrixXd& _matX) const
+    {
+        assert(_matX.rows() == m_matL.rows());
+
+        // forward substitution: L * Y = B
+        substitute(m_matL, m_levelRowsFw, m_stagePtrFw, m_isParallelStageFw, nullptr, _matX);
+
+        // backward substitution: L^T * X = Y (or D^-1 * Y for LDL^T, applied when each row is first read)
+        substitute(m_matLt, m_levelRowsBw, m_stagePtrBw, m_isParallelStageBw, m_invD.size() ? m_invD.data() : nullptr, _matX);
+    }
+
+
+    void TriangularSolver::clear()
+    {
+        m_matL.resize(0, 0);
+        m_matLt.resize(0, 0);
+        m_invDiagL.resize(0);
+        m_invD.resize(0);
+        m_levelRowsFw.clear();
+        m_stagePtrFw.clear();
+        m_isParallelStageFw.clear();
+        m_nbLevelsFw = 0;
+        m_levelRowsBw.clear();
+        m_stagePtrBw.clear();
+        m_isParallelStageBw.clear();
+    }
+
+
+} // namespace CompGeom
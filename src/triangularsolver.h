@@ -0,0 +1,169 @@
+/*********************************************************************************************************************
+ *
+ * triangularsolver.h
+ *
+ * CompGeom
+ * Ludovic Blache
+ *
+ *********************************************************************************************************************/
+
+#ifndef TRIANGULARSOLVER_H
+#define TRIANGULARSOLVER_H
+
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+
+
+namespace CompGeom
+{
+
+/*!
+* \class TriangularSolver
+* \brief Level-scheduled parallel solver for the triangular systems L * L^T * x = b (or L * D * L^T * x = b)
+*        of a sparse Cholesky factor
+*
+* Rows of L are grouped into levels, such that all rows in a level only depend on rows of previous levels.
+* Rows of a same level are then solved in parallel (OpenMP). Levels too thin to be worth a parallel region
+* are merged with their neighbours into a stage solved by a single thread, in level order.
+*
+* The right-hand side is row-major, so all its columns are processed together for each row of L,
+* and accumulated on the stack by blocks of s_blockSize columns.
+*/
+class TriangularSolver
+{
+public:
+
+    typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrixXd;
+
+protected:
+
+    typedef Eigen::SparseMatrix<double, Eigen::RowMajor> RowSpMat;
+
+    static constexpr int s_blockSize = 8;              /*!< columns of the right-hand side accumulated together */
+    static constexpr int s_minParallelRows = 512;      /*!< min rows of a level solved in parallel */
+
+public:
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        CONSTRUCTORS                                           |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn TriangularSolver
+    * \brief Default constructor
+    */
+    TriangularSolver() = default;
+
+    /*!
+    * \fn ~TriangularSolver
+    * \brief Destructor
+    */
+    virtual ~TriangularSolver() = default;
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                     GETTERS / SETTERS                                         |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn getNbLevelsForward
+    * \brief Returns the number of levels of the forward substitution (i.e., number of sequential steps)
+    */
+    inline size_t getNbLevelsForward() const { return m_nbLevelsFw; }
+
+    /*!
+    * \fn getNbStagesForward
+    * \brief Returns the number of stages of the forward substitution (levels, after merging the thin ones)
+    */
+    inline size_t getNbStagesForward() const { return m_isParallelStageFw.size(); }
+
+    /*!
+    * \fn isEmpty
+    */
+    inline bool isEmpty() const { return m_matL.rows() == 0; }
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                        MISCELLANEOUS                                          |
+    +-----------------------------------------------------------------------------------------------*/
+
+    /*!
+    * \fn analyze
+    * \brief Copies the factor and builds the levels of the forward (L) and backward (L^T) substitutions
+    * \param _matL : lower triangular factor, column-major (unit diagonal if not stored)
+    * \param _vecD : diagonal D of a LDL^T factorization (empty for LL^T)
+    */
+    void analyze(const Eigen::SparseMatrix<double>& _matL, const Eigen::VectorXd& _vecD = Eigen::VectorXd());
+
+    /*!
+    * \fn solveInPlace
+    * \brief Solves L * L^T * X = B (or L * D * L^T * X = B), with B given in _matX
+    */
+    void solveInPlace(RowMatrixXd& _matX) const;
+
+    /*!
+    * \fn clear
+    */
+    void clear();
+
+
+protected:
+
+    /*!
+    * \fn buildLevels
+    * \brief Sorts rows by level, given the dependencies of each row stored in the outer vectors of _mat,
+    *        and groups levels into stages (one parallel level, or consecutive thin levels)
+    * \return : number of levels
+    */
+    size_t buildLevels(const RowSpMat& _mat, bool _isForward,
+                       std::vector<int>& _levelRows, std::vector<int>& _stagePtr, std::vector<char>& _isParallelStage);
+
+    /*!
+    * \fn substitute
+    * \brief Forward or backward substitution, stage by stage: x_i = (s_i * x_i - sum_j M(i,j) * x_j) / L(i,i),
+    *        with s_i = 1, or D(i,i)^-1 if _invScale is not null
+    */
+    void substitute(const RowSpMat& _mat, const std::vector<int>& _levelRows, const std::vector<int>& _stagePtr,
+                    const std::vector<char>& _isParallelStage, const double* _invScale, RowMatrixXd& _matX) const;
+
+    /*!
+    * \fn substituteStages
+    * \brief substitute() on Width columns starting at _x (row stride _nbCols)
+    */
+    template<int Width>
+    void substituteStages(const RowSpMat& _mat, const std::vector<int>& _levelRows, const std::vector<int>& _stagePtr,
+                          const std::vector<char>& _isParallelStage, const double* _invScale, double* _x, int _nbCols) const;
+
+    /*!
+    * \fn substituteRows
+    * \brief Solves rows _rows[0.._nbRows[ in order, on Width columns starting at _x (row stride _nbCols)
+    */
+    template<int Width>
+    void substituteRows(const RowSpMat& _mat, const int* _rows, int _nbRows, const double* _invScale, double* _x, int _nbCols) const;
+
+
+    /*----------------------------------------------------------------------------------------------+
+    |                                         ATTRIBUTES                                            |
+    +-----------------------------------------------------------------------------------------------*/
+
+    RowSpMat m_matL;                   /*!< strictly lower part of L, row-major (rows of L) */
+    RowSpMat m_matLt;                  /*!< strictly upper part of L^T, row-major (columns of L) */
+    Eigen::VectorXd m_invDiagL;        /*!< inverse of the diagonal of L */
+    Eigen::VectorXd m_invD;            /*!< inverse of D for LDL^T (empty for LL^T) */
+
+    std::vector<int> m_levelRowsFw;    /*!< rows of L sorted by level (forward substitution) */
+    std::vector<int> m_stagePtrFw;     /*!< start of each stage in m_levelRowsFw */
+    std::vector<char> m_isParallelStageFw; /*!< true if the rows of a stage are solved in parallel */
+    size_t m_nbLevelsFw = 0;           /*!< number of levels of the forward substitution */
+    std::vector<int> m_levelRowsBw;    /*!< rows of L^T sorted by level (backward substitution) */
+    std::vector<int> m_stagePtrBw;     /*!< start of each stage in m_levelRowsBw */
+    std::vector<char> m_isParallelStageBw; /*!< true if the rows of a stage are solved in parallel */
+
+
+}; // class TriangularSolver
+
+} // namespace CompGeom
+
+#endif // TRIANGULARSOLVER_H